@@ -21,6 +21,7 @@
   Street, Fifth Floor, Boston, MA 02110-1301, USA
 */
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include <iostream>
@@ -43,9 +44,49 @@ affine_image_generator06::affine_image_generator06(void)
 
   set_default_values();
 
+  random_state = nullptr;
+
   save_images = false;
 }
 
+affine_image_generator06::affine_image_generator06(const affine_image_generator06 & generator)
+{
+  original_image = generator.original_image ? cvCloneImage(generator.original_image) : nullptr;
+  generated_image = generator.generated_image ? cvCloneImage(generator.generated_image) : nullptr;
+  original_image_with_128_as_background = generator.original_image_with_128_as_background ?
+    cvCloneImage(generator.original_image_with_128_as_background) : nullptr;
+
+  // Copied rather than regenerated, so rand() is not called:
+  white_noise = new char[prime];
+  limited_white_noise = new int[prime];
+  memcpy(white_noise, generator.white_noise, prime * sizeof(char));
+  memcpy(limited_white_noise, generator.limited_white_noise, prime * sizeof(int));
+  index_white_noise = generator.index_white_noise;
+  noise_level = generator.noise_level;
+
+  use_random_background = generator.use_random_background;
+  change_intensities = generator.change_intensities;
+  add_gaussian_smoothing = generator.add_gaussian_smoothing;
+  add_noise = generator.add_noise;
+
+  transformation_range = generator.transformation_range;
+  for(int i = 0; i < 6; i++)
+    a[i] = generator.a[i];
+
+  own_random_state = generator.own_random_state;
+  random_state = generator.random_state ? &own_random_state : nullptr;
+
+  save_images = false;
+}
+
+void affine_image_generator06::set_random_seed(unsigned int seed)
+{
+  own_random_state = seed;
+  random_state = &own_random_state;
+  // Each seed starts the background at its own place in white_noise, the views stay independent:
+  index_white_noise = 1 + rand(random_state) % (prime - 1);
+}
+
 affine_image_generator06::~affine_image_generator06(void)
 {
   if (original_image)  cvReleaseImage(&original_image);
@@ -169,7 +210,7 @@ void affine_image_generator06::generate_random_affine_transformation(void)
 {
   float theta, phi, lambda1, lambda2;
 
-  transformation_range.generate_random_parameters(theta, phi, lambda1, lambda2);
+  transformation_range.generate_random_parameters(theta, phi, lambda1, lambda2, random_state);
   generate_affine_transformation(a, 0, 0, theta, phi, lambda1, lambda2, 0, 0);
 
   int Tx, Ty;
@@ -180,10 +221,10 @@ void affine_image_generator06::generate_random_affine_transformation(void)
   affine_transformation(float(original_image->width), float(original_image->height), nu2, nv2);
   affine_transformation(0.,                           float(original_image->height), nu3, nv3);
 
-  if (rand() % 2 == 0) Tx = -(int)min(min(nu0, nu1), min(nu2, nu3));
+  if (rand(random_state) % 2 == 0) Tx = -(int)min(min(nu0, nu1), min(nu2, nu3));
   else                 Tx = generated_image->width - (int)max(max(nu0, nu1), max(nu2, nu3));
   
-  if (rand() % 2 == 0) Ty = -(int)min(min(nv0, nv1), min(nv2, nv3));
+  if (rand(random_state) % 2 == 0) Ty = -(int)min(min(nv0, nv1), min(nv2, nv3));
   else                 Ty = generated_image->height - (int)max(max(nv0, nv1), max(nv2, nv3));
 
   generate_affine_transformation(a, 0., 0., theta, phi, lambda1, lambda2, float(Tx), float(Ty));
@@ -228,7 +269,7 @@ void affine_image_generator06::add_white_noise(IplImage * image, int gray_level_
   for(int y = 0; y < image->height; y++) {
     unsigned char * line = (unsigned char *)(image->imageData + y * image->widthStep);
 
-    int * noise = limited_white_noise + rand() % (prime - image->width);
+    int * noise = limited_white_noise + rand(random_state) % (prime - image->width);
 
     for(int x = 0; x < image->width; x++) {
       int p = int(*line);
@@ -253,7 +294,7 @@ void affine_image_generator06::replace_by_noise(IplImage * image, int value)
       if (int(row[x]) == value) {
         row[x] = white_noise[index_white_noise];
         index_white_noise++;
-        if (index_white_noise >= prime) index_white_noise = 1 + rand() % 6;
+        if (index_white_noise >= prime) index_white_noise = 1 + rand(random_state) % 6;
       }
   }
 }
@@ -265,7 +306,7 @@ void affine_image_generator06::generate_affine_image(void)
   if (use_random_background)
     cvSet(generated_image, cvScalar(128));
   else
-    cvSet(generated_image, cvScalar(rand() % 256));
+    cvSet(generated_image, cvScalar(rand(random_state) % 256));
 
   cvWarpAffine(original_image_with_128_as_background, generated_image, &A,
                CV_INTER_NN + CV_WARP_FILL_OUTLIERS /* + CV_WARP_INVERSE_MAP*/, cvScalarAll(128));
@@ -273,12 +314,12 @@ void affine_image_generator06::generate_affine_image(void)
   if (use_random_background)
     replace_by_noise(generated_image, 128);
 
-  if (add_gaussian_smoothing && rand() % 3 == 0) {
-    int aperture = 3 + 2 * (rand() % 3);
+  if (add_gaussian_smoothing && rand(random_state) % 3 == 0) {
+    int aperture = 3 + 2 * (rand(random_state) % 3);
     cvSmooth(generated_image, generated_image, CV_GAUSSIAN, aperture, aperture);
   }
 
-  if (change_intensities) cvCvtScale(generated_image, generated_image, rand(0.8f, 1.2f), rand(-10, 10));
+  if (change_intensities) cvCvtScale(generated_image, generated_image, rand(0.8f, 1.2f, random_state), rand(-10.f, 10.f, random_state));
 
   //   mcvSaveImage("g.bmp", generated_image);
   //   exit(0);
@@ -37,6 +37,14 @@ class affine_image_generator06
   affine_image_generator06(void);
   ~affine_image_generator06(void);
 
+  //! Copies the images, transformation range and parameters of the generator
+  //! (for example to generate images in several threads).
+  affine_image_generator06(const affine_image_generator06 & generator);
+
+  //! After this call, the generator uses its own random state instead of rand(): the generated
+  //! images only depend on the seed. Can be called before each image.
+  void set_random_seed(unsigned int seed);
+
   void load_transformation_range(istream & f);
   void save_transformation_range(ostream & f);
   void set_transformation_range(affine_transformation_range * range);
@@ -99,6 +107,9 @@ class affine_image_generator06
 
   affine_transformation_range transformation_range;
 
+  unsigned int own_random_state;
+  unsigned int * random_state; // null to use rand()
+
   IplImage * original_image, * original_image_with_128_as_background, * generated_image;
   float a[6];
 
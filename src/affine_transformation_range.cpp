@@ -134,17 +134,18 @@ void affine_transformation_range::constrained_scaling(float p_min_lambda1, float
 
 
 void affine_transformation_range::generate_random_parameters(float & theta, float & phi, 
-                                                             float & lambda1, float & lambda2)
+                                                             float & lambda1, float & lambda2,
+                                                             unsigned int * random_state)
 {
-  theta = min_theta + rand_01() * (max_theta - min_theta);
-  phi   = min_phi   + rand_01() * (max_phi - min_phi);
+  theta = min_theta + rand_01(random_state) * (max_theta - min_theta);
+  phi   = min_phi   + rand_01(random_state) * (max_phi - min_phi);
 
   if (scaling_method == 0) {
-    lambda1 = min_lambda1 + rand_01() * (max_lambda1 - min_lambda1);
-    lambda2 = min_lambda2 + rand_01() * (max_lambda2 - min_lambda2);
+    lambda1 = min_lambda1 + rand_01(random_state) * (max_lambda1 - min_lambda1);
+    lambda2 = min_lambda2 + rand_01(random_state) * (max_lambda2 - min_lambda2);
   } else
     do {
-      lambda1 = min_lambda1 + rand_01() * (max_lambda1 - min_lambda1);
-      lambda2 = min_lambda2 + rand_01() * (max_lambda2 - min_lambda2);
+      lambda1 = min_lambda1 + rand_01(random_state) * (max_lambda1 - min_lambda1);
+      lambda2 = min_lambda2 + rand_01(random_state) * (max_lambda2 - min_lambda2);
     } while (lambda1 * lambda2 < min_l1_l2 || lambda1 * lambda2 > max_l1_l2);
 }
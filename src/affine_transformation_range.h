@@ -47,7 +47,9 @@ class affine_transformation_range
                            float min_lambda2, float max_lambda2,
                            float min_l1_l2, float max_l1_l2);
 
-  void generate_random_parameters(float & theta, float & phi, float & lambda1, float & lambda2);
+  //! random_state: see rand_r(), rand() is used if null.
+  void generate_random_parameters(float & theta, float & phi, float & lambda1, float & lambda2,
+                                  unsigned int * random_state = nullptr);
 
   //  private:
   float min_theta, max_theta;
@@ -0,0 +1,319 @@
+/*
+  Copyright 2007 Computer Vision Lab,
+  Ecole Polytechnique Federale de Lausanne (EPFL), Switzerland.
+  All rights reserved.
+
+  Author: Vincent Lepetit (http://cvlab.epfl.ch/~lepetit)
+
+  This file is part of the ferns_demo software.
+
+  ferns_demo is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 2 of the License, or (at your option) any later
+  version.
+
+  ferns_demo is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+  PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  ferns_demo; if not, write to the Free Software Foundation, Inc., 51 Franklin
+  Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+#include <chrono>
+#include <cstring>
+
+#ifdef _OPENMP
+#include <omp.h>
+#else
+static int omp_get_max_threads(void) { return 1; }
+#endif
+
+#include "logger.h"
+#include "classifier_evaluation.h"
+
+using namespace std;
+using namespace plog;
+
+classifier_evaluation::classifier_evaluation(void)
+{
+  number_of_classes = number_of_ferns = number_of_tests_per_fern = 0;
+  seen = recognized = rejected = confusion = nullptr;
+  fern_correct = nullptr;
+  fern_true_class_log_posterior = nullptr;
+  has_fern_statistics = false;
+  number_of_samples = 0;
+  recognition_time = 0.;
+}
+
+classifier_evaluation::~classifier_evaluation(void)
+{
+  release();
+}
+
+void classifier_evaluation::alloc(int number_of_classes, int number_of_ferns)
+{
+  release();
+
+  this->number_of_classes = number_of_classes;
+  this->number_of_ferns = number_of_ferns;
+
+  seen = new int[number_of_classes];
+  recognized = new int[number_of_classes];
+  rejected = new int[number_of_classes];
+  confusion = new int[number_of_classes * number_of_classes];
+  fern_correct = new int[number_of_ferns];
+  fern_true_class_log_posterior = new double[number_of_ferns];
+
+  memset(seen, 0, number_of_classes * sizeof(int));
+  memset(recognized, 0, number_of_classes * sizeof(int));
+  memset(rejected, 0, number_of_classes * sizeof(int));
+  memset(confusion, 0, number_of_classes * number_of_classes * sizeof(int));
+  memset(fern_correct, 0, number_of_ferns * sizeof(int));
+  for(int i = 0; i < number_of_ferns; i++)
+    fern_true_class_log_posterior[i] = 0.;
+}
+
+void classifier_evaluation::release(void)
+{
+  if (seen) delete [] seen;
+  if (recognized) delete [] recognized;
+  if (rejected) delete [] rejected;
+  if (confusion) delete [] confusion;
+  if (fern_correct) delete [] fern_correct;
+  if (fern_true_class_log_posterior) delete [] fern_true_class_log_posterior;
+
+  seen = recognized = rejected = confusion = nullptr;
+  fern_correct = nullptr;
+  fern_true_class_log_posterior = nullptr;
+}
+
+void classifier_evaluation::evaluate(const fern_based_point_classifier * classifier,
+                                     keypoint * keypoints, int number_of_keypoints,
+                                     int number_of_octaves, int yape_radius,
+                                     int number_of_generated_images,
+                                     affine_image_generator06 * image_generator,
+                                     int number_of_threads, unsigned int seed)
+{
+  const ferns * Ferns = classifier->Ferns;
+  const int C = classifier->number_of_classes;
+  const int F = Ferns->number_of_ferns;
+
+  alloc(C, F);
+  number_of_tests_per_fern = Ferns->number_of_tests_per_fern;
+  quantization_bits = classifier->quantization_bits;
+  sparse_top_k = classifier->sparse_top_k;
+  use_early_termination = classifier->use_early_termination;
+  this->number_of_generated_images = number_of_generated_images;
+  has_fern_statistics = (classifier->leaves_distributions != nullptr);
+  number_of_samples = 0;
+  recognition_time = 0.;
+
+  image_generator->enable_random_background();
+
+  if (number_of_threads <= 0) number_of_threads = omp_get_max_threads();
+
+  log_info << "[classifier_evaluation::evaluate]" << "start, " << number_of_threads << " threads" << endl;
+
+  // Floating point sums depend on their order: the log-posteriors are summed per view, the views
+  // are then summed in their order.
+  double * view_fern_log_posterior = nullptr;
+  if (has_fern_statistics) {
+    view_fern_log_posterior = new double[number_of_generated_images * F];
+    for(int i = 0; i < number_of_generated_images * F; i++) view_fern_log_posterior[i] = 0.;
+  }
+
+#pragma omp parallel num_threads(number_of_threads)
+  {
+    affine_image_generator06 * generator = new affine_image_generator06(*image_generator);
+    fine_gaussian_pyramid * pyramid = new fine_gaussian_pyramid(yape_radius, Ferns->max_d, number_of_octaves);
+    fern_based_point_classifier::recognition_context * context =
+      new fern_based_point_classifier::recognition_context(classifier);
+    keypoint * projected_keypoints = new keypoint[number_of_keypoints];
+
+    // Counters of the thread, summed at the end: integer sums do not depend on the order of the threads.
+    int * thread_seen = new int[C], * thread_recognized = new int[C], * thread_rejected = new int[C];
+    int * thread_confusion = new int[C * C];
+    int * thread_fern_correct = new int[F];
+    memset(thread_seen, 0, C * sizeof(int));
+    memset(thread_recognized, 0, C * sizeof(int));
+    memset(thread_rejected, 0, C * sizeof(int));
+    memset(thread_confusion, 0, C * C * sizeof(int));
+    memset(thread_fern_correct, 0, F * sizeof(int));
+    int thread_number_of_samples = 0;
+    double thread_time = 0.;
+
+#pragma omp for schedule(dynamic)
+    for(int i = 0; i < number_of_generated_images; i++) {
+      generator->set_random_seed(seed + i);
+      generator->generate_random_affine_image();
+      pyramid->set_image(generator->generated_image);
+
+      for(int j = 0; j < number_of_keypoints; j++) {
+        keypoint * K = keypoints + j;
+        float fr_gu, fr_gv;
+        generator->affine_transformation(K->fr_u(), K->fr_v(), fr_gu, fr_gv);
+
+        keypoint * P = projected_keypoints + j;
+        P->u = fine_gaussian_pyramid::convCoordf(fr_gu, 0, int(K->scale));
+        P->v = fine_gaussian_pyramid::convCoordf(fr_gv, 0, int(K->scale));
+        P->scale = K->scale;
+      }
+
+      // The keypoints of the view are recognized as by a detector, with one batched call:
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      classifier->recognize(context, pyramid, projected_keypoints, number_of_keypoints);
+      thread_time += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+      // The points out of the image are not counted:
+      double * fern_log_posterior = has_fern_statistics ? view_fern_log_posterior + i * F : nullptr;
+      for(int b = 0; b < number_of_keypoints; b++) {
+        if (!context->batch_dropped[b]) continue;
+
+        const int j = context->batch_keypoint_index[b];
+        const int * leaves_index = context->batch_leaves_index + b * F;
+        const int guessed_class_index = projected_keypoints[j].class_index;
+        const int true_class_index = keypoints[j].class_index;
+        thread_number_of_samples++;
+        thread_seen[true_class_index]++;
+        if (guessed_class_index < 0)
+          thread_rejected[true_class_index]++;
+        else {
+          thread_confusion[true_class_index * C + guessed_class_index]++;
+          if (guessed_class_index == true_class_index)
+            thread_recognized[true_class_index]++;
+        }
+
+        if (has_fern_statistics)
+          for(int f = 0; f < F; f++) {
+            const float * ld = classifier->leaves_distributions + f * classifier->step2 + leaves_index[f] * classifier->step1;
+            int best_class = 0;
+            for(int c = 1; c < C; c++)
+              if (ld[c] > ld[best_class]) best_class = c;
+            if (best_class == true_class_index) thread_fern_correct[f]++;
+            fern_log_posterior[f] += ld[true_class_index];
+          }
+      }
+    }
+
+#pragma omp critical
+    {
+      for(int c = 0; c < C; c++) {
+        seen[c] += thread_seen[c];
+        recognized[c] += thread_recognized[c];
+        rejected[c] += thread_rejected[c];
+      }
+      for(int c = 0; c < C * C; c++)
+        confusion[c] += thread_confusion[c];
+      for(int f = 0; f < F; f++)
+        fern_correct[f] += thread_fern_correct[f];
+      number_of_samples += thread_number_of_samples;
+      recognition_time += thread_time;
+    }
+
+    delete [] thread_seen;
+    delete [] thread_recognized;
+    delete [] thread_rejected;
+    delete [] thread_confusion;
+    delete [] thread_fern_correct;
+    delete [] projected_keypoints;
+    delete context;
+    delete pyramid;
+    delete generator;
+  }
+
+  if (has_fern_statistics) {
+    for(int i = 0; i < number_of_generated_images; i++)
+      for(int f = 0; f < F; f++)
+        fern_true_class_log_posterior[f] += view_fern_log_posterior[i * F + f];
+    delete [] view_fern_log_posterior;
+  }
+
+  if (number_of_samples > 0)
+    for(int f = 0; f < F; f++)
+      fern_true_class_log_posterior[f] /= number_of_samples;
+
+  log_info << "[classifier_evaluation::evaluate]"
+           << number_of_samples << " samples, mean recall " << mean_recall() << "%, "
+           << 1e6 * time_per_keypoint() << " us per keypoint." << endl;
+}
+
+float classifier_evaluation::mean_recall(void) const
+{
+  float mean_recognition_rate = 0.;
+  int n = 0;
+  for(int i = 0; i < number_of_classes; i++)
+    if (seen[i] != 0) {
+      mean_recognition_rate += (100.0f * recognized[i]) / seen[i];
+      n++;
+    }
+
+  return n > 0 ? mean_recognition_rate / n : 0.f;
+}
+
+double classifier_evaluation::time_per_keypoint(void) const
+{
+  return number_of_samples > 0 ? recognition_time / number_of_samples : 0.;
+}
+
+bool classifier_evaluation::save_as_json(const char * filename)
+{
+  ofstream f(filename);
+
+  if (!f.is_open()) {
+    log_error << "[classifier_evaluation::save_as_json]" << "Error saving file " << filename << "." << endl;
+    return false;
+  }
+
+  bool result = save_as_json(f);
+
+  f.close();
+
+  return result;
+}
+
+// The confusion matrix is saved sparse, as [true class, recognized class, count] triplets.
+bool classifier_evaluation::save_as_json(ostream & f)
+{
+  f << "{" << endl;
+  f << "  \"number_of_classes\": " << number_of_classes << "," << endl;
+  f << "  \"number_of_ferns\": " << number_of_ferns << "," << endl;
+  f << "  \"number_of_tests_per_fern\": " << number_of_tests_per_fern << "," << endl;
+  f << "  \"quantization_bits\": " << quantization_bits << "," << endl;
+  f << "  \"sparse_top_k\": " << sparse_top_k << "," << endl;
+  f << "  \"early_termination\": " << (use_early_termination ? "true" : "false") << "," << endl;
+  f << "  \"number_of_generated_images\": " << number_of_generated_images << "," << endl;
+  f << "  \"number_of_samples\": " << number_of_samples << "," << endl;
+  f << "  \"mean_recall\": " << mean_recall() << "," << endl;
+  f << "  \"time_per_keypoint_us\": " << 1e6 * time_per_keypoint() << "," << endl;
+
+  f << "  \"classes\": [";
+  for(int c = 0; c < number_of_classes; c++)
+    f << (c ? "," : "") << endl
+      << "    {\"class\": " << c << ", \"seen\": " << seen[c] << ", \"recognized\": " << recognized[c]
+      << ", \"rejected\": " << rejected[c]
+      << ", \"recall\": " << (seen[c] ? (100.0f * recognized[c]) / seen[c] : 0.f) << "}";
+  f << endl << "  ]," << endl;
+
+  f << "  \"confusion\": [";
+  bool first = true;
+  for(int c = 0; c < number_of_classes; c++)
+    for(int g = 0; g < number_of_classes; g++)
+      if (confusion[c * number_of_classes + g] != 0) {
+        f << (first ? "" : ",") << endl << "    [" << c << ", " << g << ", " << confusion[c * number_of_classes + g] << "]";
+        first = false;
+      }
+  f << endl << "  ]," << endl;
+
+  f << "  \"ferns\": [";
+  if (has_fern_statistics)
+    for(int i = 0; i < number_of_ferns; i++)
+      f << (i ? "," : "") << endl
+        << "    {\"fern\": " << i
+        << ", \"correct_rate\": " << (number_of_samples ? (100.0f * fern_correct[i]) / number_of_samples : 0.f)
+        << ", \"mean_true_class_log_posterior\": " << fern_true_class_log_posterior[i] << "}";
+  f << endl << "  ]" << endl;
+  f << "}" << endl;
+
+  return !f.fail();
+}
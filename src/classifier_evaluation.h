@@ -0,0 +1,82 @@
+/*
+  Copyright 2007 Computer Vision Lab,
+  Ecole Polytechnique Federale de Lausanne (EPFL), Switzerland.
+  All rights reserved.
+
+  Author: Vincent Lepetit (http://cvlab.epfl.ch/~lepetit)
+
+  This file is part of the ferns_demo software.
+
+  ferns_demo is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 2 of the License, or (at your option) any later
+  version.
+
+  ferns_demo is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+  PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  ferns_demo; if not, write to the Free Software Foundation, Inc., 51 Franklin
+  Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+#ifndef classifier_evaluation_h
+#define classifier_evaluation_h
+
+#include <fstream>
+using namespace std;
+
+#include "keypoint.h"
+#include "affine_image_generator06.h"
+#include "fern_based_point_classifier.h"
+
+//! Evaluation of a classifier on generated views, to compare configurations (number of ferns,
+//! quantization, sparse distributions, early termination) for speed and accuracy.
+//! The views are generated in parallel like in fern_based_point_classifier::train(): view i is
+//! generated from the random seed seed + i, and the results do not depend on the number of threads.
+class classifier_evaluation
+{
+ public:
+  classifier_evaluation(void);
+  ~classifier_evaluation(void);
+
+  //! number_of_threads = 0: one thread per core. The keypoints are given as for test().
+  void evaluate(const fern_based_point_classifier * classifier,
+                keypoint * keypoints, int number_of_keypoints,
+                int number_of_octaves, int yape_radius,
+                int number_of_generated_images,
+                affine_image_generator06 * image_generator,
+                int number_of_threads = 0, unsigned int seed = 0);
+
+  //! Mean of the recall of the classes that were seen, in %.
+  float mean_recall(void) const;
+
+  bool save_as_json(const char * filename);
+  bool save_as_json(ostream & f);
+
+  int number_of_classes, number_of_ferns, number_of_tests_per_fern;
+  int quantization_bits, sparse_top_k;
+  bool use_early_termination;
+  int number_of_generated_images;
+
+  int number_of_samples; // Keypoints that could be dropped in the ferns.
+  int * seen;            // [class]
+  int * recognized;      // [class]
+  int * rejected;        // [class], recognized as -1 (early termination).
+  int * confusion;       // [true class][recognized class]
+
+  //! Per fern, on its own, for the samples (only when the classifier keeps its float distributions):
+  //! how often its best class is the true class, and the mean log-posterior of the true class.
+  bool has_fern_statistics;
+  int * fern_correct;
+  double * fern_true_class_log_posterior;
+
+  double recognition_time; // in seconds, summed over the threads: batched recognize() of the keypoints of each view.
+  double time_per_keypoint(void) const;
+
+  //private:
+  void alloc(int number_of_classes, int number_of_ferns);
+  void release(void);
+};
+
+#endif
@@ -22,6 +22,20 @@
 */
 #include <zlib.h>
 #include <iostream>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#else
+static int omp_get_max_threads(void) { return 1; }
+#endif
 
 #include "logger.h"
 #include "mcv.h"
@@ -34,11 +48,38 @@ void fern_based_point_classifier::init() {
   Ferns = nullptr;
   leaves_counters = nullptr;
   leaves_distributions = nullptr;
+  leaves_distributions_are_mapped = false;
   number_of_samples_for_class = nullptr;
-  preallocated_distribution_for_a_keypoint = nullptr;
+  default_context = nullptr;
+
+  quantization_bits = 0;
+  quantized_leaves_distributions = nullptr;
+  fern_offsets = nullptr;
+
+  sparse_top_k = 0;
+  sparse_classes = nullptr;
+  sparse_values = sparse_defaults = nullptr;
+
+  use_early_termination = false;
+  early_termination_steps = 0;
+  early_accept_margins = early_reject_scores = nullptr;
+
+  class_counters_for_fern = nullptr;
+  leaf_normalizations = nullptr;
+  leaf_is_dirty = fern_is_dirty = class_is_dirty = nullptr;
+  dirty_leaves = dirty_classes = nullptr;
+  number_of_dirty_leaves = number_of_dirty_classes = 0;
+  background_leaves_distributions = nullptr;
+  background_leaves_distributions_are_stale = background_leaves_distributions_are_ready = false;
 }
 
-fern_based_point_classifier::fern_based_point_classifier(char * filename)
+// The quantized rows are padded to a multiple of 16 classes for the SIMD accumulation:
+static int padded_number_of_classes(int number_of_classes)
+{
+  return (number_of_classes + 15) / 16 * 16;
+}
+
+fern_based_point_classifier::fern_based_point_classifier(char * filename, bool inference_only)
 {
   init();
 
@@ -51,15 +92,21 @@ fern_based_point_classifier::fern_based_point_classifier(char * filename)
     return;
   }
 
-  load(f);
+  load(f, inference_only);
 
   f.close();
 }
 
-fern_based_point_classifier::fern_based_point_classifier(istream & f)
+fern_based_point_classifier::fern_based_point_classifier(istream & f, bool inference_only)
+{
+  init();
+  load(f, inference_only);
+}
+
+fern_based_point_classifier::fern_based_point_classifier(const char * mapped_data, size_t mapped_size)
 {
   init();
-  load(f);
+  map(mapped_data, mapped_size);
 }
 
 fern_based_point_classifier::fern_based_point_classifier(int number_of_classes,
@@ -78,12 +125,12 @@ fern_based_point_classifier::fern_based_point_classifier(int number_of_classes,
   number_of_samples_for_class = new int[number_of_classes];
 
   int buffer_size = number_of_classes * Ferns->number_of_ferns * Ferns->number_of_leaves_per_fern;
-  leaves_counters = new short[buffer_size];
+  leaves_counters = new int[buffer_size];
   leaves_distributions = new float[buffer_size];
   step1 = number_of_classes;
   step2 = step1 * Ferns->number_of_leaves_per_fern;
 
-  preallocated_distribution_for_a_keypoint = new float[number_of_classes];
+  default_context = new recognition_context(this);
 
   set_number_of_ferns_to_use(-1);
 }
@@ -92,13 +139,34 @@ fern_based_point_classifier::~fern_based_point_classifier()
 {
   if (Ferns) delete Ferns;
   if (leaves_counters) delete [] leaves_counters;
-  if (leaves_distributions) delete [] leaves_distributions;
-  if (preallocated_distribution_for_a_keypoint) delete [] preallocated_distribution_for_a_keypoint;
+  if (leaves_distributions && !leaves_distributions_are_mapped) delete [] leaves_distributions;
   if (number_of_samples_for_class) delete [] number_of_samples_for_class;
+  if (default_context) delete default_context;
+  if (quantized_leaves_distributions) delete [] quantized_leaves_distributions;
+  if (fern_offsets) delete [] fern_offsets;
+  if (sparse_classes) delete [] sparse_classes;
+  if (sparse_values) delete [] sparse_values;
+  if (sparse_defaults) delete [] sparse_defaults;
+  if (early_accept_margins) delete [] early_accept_margins;
+  if (early_reject_scores) delete [] early_reject_scores;
+  release_incremental_training();
 }
 
-void fern_based_point_classifier::load(istream & f)
+void fern_based_point_classifier::load(istream & f, bool inference_only)
 {
+  // Optional format tag: "frozen" (distributions) or "int_counters" (counters as ints).
+  // Without tag, the counters are stored as shorts.
+  string tag;
+  f >> ws;
+  if (isalpha(f.peek())) f >> tag;
+  const bool frozen = (tag == "frozen");
+  const bool int_counters = (tag == "int_counters");
+  if (!tag.empty() && !frozen && !int_counters) {
+    log_error << "[fern_based_point_classifier::load]" << "Unknown format " << tag << "." << endl;
+    correctly_read = false;
+    return;
+  }
+
   f >> number_of_classes;
 
   if (Ferns) delete Ferns;
@@ -114,37 +182,90 @@ void fern_based_point_classifier::load(istream & f)
   number_of_samples_for_class = new int[number_of_classes];
   f.read((char *)number_of_samples_for_class, sizeof(int) * number_of_classes);
 
+  release_incremental_training();
+
   int buffer_size = number_of_classes * Ferns->number_of_ferns * Ferns->number_of_leaves_per_fern;
 
-  if (leaves_distributions) delete [] leaves_distributions;
+  if (leaves_distributions && !leaves_distributions_are_mapped) delete [] leaves_distributions;
   leaves_distributions = new float[buffer_size];
+  leaves_distributions_are_mapped = false;
 
   if (leaves_counters) delete [] leaves_counters;
-  leaves_counters = new short[buffer_size];
+  leaves_counters = nullptr;
 
-  log_info << "[fern_based_point_classifier::load]"
-           << "Reading compressed leaves distributions..." << endl;
+  step1 = number_of_classes;
+  step2 = step1 * Ferns->number_of_leaves_per_fern;
 
-  int size_of_compressed_buffer, read_buffer_size;
-  f >> size_of_compressed_buffer >> read_buffer_size;
-  Bytef * compressed_buffer = new Bytef[size_of_compressed_buffer];
-  char c; do f.read(&c, 1); while (c != '.');
-  f.read((char *)compressed_buffer, size_of_compressed_buffer);
-  uLongf uncompressed_buffer_size = buffer_size * sizeof(short);
-  (void)uncompress((Bytef*)leaves_counters, &uncompressed_buffer_size, compressed_buffer, size_of_compressed_buffer);
-  delete [] compressed_buffer;
+  if (quantized_leaves_distributions) delete [] quantized_leaves_distributions;
+  if (fern_offsets) delete [] fern_offsets;
+  quantization_bits = 0;
+  quantized_leaves_distributions = nullptr;
+  fern_offsets = nullptr;
+
+  if (sparse_classes) delete [] sparse_classes;
+  if (sparse_values) delete [] sparse_values;
+  if (sparse_defaults) delete [] sparse_defaults;
+  sparse_top_k = 0;
+  sparse_classes = nullptr;
+  sparse_values = sparse_defaults = nullptr;
+
+  if (frozen) {
+    log_info << "[fern_based_point_classifier::load]"
+             << "Reading frozen leaves distributions..." << endl;
+
+    int read_buffer_size;
+    f >> read_buffer_size;
+    char c; do f.read(&c, 1); while (c != '.');
+    if (read_buffer_size != buffer_size) {
+      log_error << "[fern_based_point_classifier::load]" << "Wrong size of leaves distributions." << endl;
+      correctly_read = false;
+      return;
+    }
+    f.read((char *)leaves_distributions, buffer_size * sizeof(float));
+  } else {
+    log_info << "[fern_based_point_classifier::load]"
+             << "Reading compressed leaves distributions..." << endl;
+
+    int size_of_compressed_buffer, read_buffer_size;
+    f >> size_of_compressed_buffer >> read_buffer_size;
+    char c; do f.read(&c, 1); while (c != '.');
+
+    if (inference_only) {
+      if (!load_counters_by_fern(f, size_of_compressed_buffer, int_counters)) {
+        log_error << "[fern_based_point_classifier::load]" << "Error while uncompressing leaves counters." << endl;
+        correctly_read = false;
+        return;
+      }
+    } else {
+      leaves_counters = new int[buffer_size];
+
+      Bytef * compressed_buffer = new Bytef[size_of_compressed_buffer];
+      f.read((char *)compressed_buffer, size_of_compressed_buffer);
+      if (int_counters) {
+        uLongf uncompressed_buffer_size = buffer_size * sizeof(int);
+        (void)uncompress((Bytef*)leaves_counters, &uncompressed_buffer_size, compressed_buffer, size_of_compressed_buffer);
+      } else {
+        short * short_counters = new short[buffer_size];
+        uLongf uncompressed_buffer_size = buffer_size * sizeof(short);
+        (void)uncompress((Bytef*)short_counters, &uncompressed_buffer_size, compressed_buffer, size_of_compressed_buffer);
+        for(int i = 0; i < buffer_size; i++)
+          leaves_counters[i] = short_counters[i];
+        delete [] short_counters;
+      }
+      delete [] compressed_buffer;
 
-  log_verb << "[fern_based_point_classifier::load]" << "uncompressed..." << endl;
+      log_verb << "[fern_based_point_classifier::load]" << "uncompressed..." << endl;
 
-  step1 = number_of_classes;
-  step2 = step1 * Ferns->number_of_leaves_per_fern;
+      finalize_training();
+    }
+  }
 
-  finalize_training();
+  load_early_termination(f);
 
   set_number_of_ferns_to_use(-1);
 
-  if (preallocated_distribution_for_a_keypoint) delete [] preallocated_distribution_for_a_keypoint;
-  preallocated_distribution_for_a_keypoint = new float[number_of_classes];
+  if (default_context) delete default_context;
+  default_context = new recognition_context(this);
 
   correctly_read = true;
 
@@ -152,6 +273,60 @@ void fern_based_point_classifier::load(istream & f)
 
 }
 
+// Uncompresses the leaves counters one fern at a time and computes the distributions of each
+// fern as soon as its counters are available. Only the counters of one fern are allocated.
+bool fern_based_point_classifier::load_counters_by_fern(istream & f, int size_of_compressed_buffer, bool int_counters)
+{
+  const int chunk_size = 1 << 16;
+  const int counter_size = int_counters ? sizeof(int) : sizeof(short);
+  Bytef * chunk = new Bytef[chunk_size];
+  char * read_counters_of_fern = new char[step2 * counter_size];
+  int * counters_of_fern = new int[step2];
+
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  int z_error = inflateInit(&stream);
+
+  int remaining_size = size_of_compressed_buffer;
+  bool ok = (z_error == Z_OK);
+  for(int i = 0; ok && i < Ferns->number_of_ferns; i++) {
+    stream.next_out = (Bytef *)read_counters_of_fern;
+    stream.avail_out = step2 * counter_size;
+
+    while (stream.avail_out > 0) {
+      if (stream.avail_in == 0) {
+        if (remaining_size == 0) break;
+        int size = min(chunk_size, remaining_size);
+        f.read((char *)chunk, size);
+        remaining_size -= size;
+        stream.next_in = chunk;
+        stream.avail_in = size;
+      }
+      z_error = inflate(&stream, Z_NO_FLUSH);
+      if (z_error != Z_OK) break;
+    }
+
+    ok = (stream.avail_out == 0) && (z_error == Z_OK || z_error == Z_STREAM_END);
+    if (!ok) break;
+
+    if (int_counters)
+      memcpy(counters_of_fern, read_counters_of_fern, step2 * sizeof(int));
+    else
+      for(int j = 0; j < step2; j++)
+        counters_of_fern[j] = ((short *)read_counters_of_fern)[j];
+    finalize_fern(i, counters_of_fern);
+  }
+
+  inflateEnd(&stream);
+  f.ignore(remaining_size);
+
+  delete [] chunk;
+  delete [] read_counters_of_fern;
+  delete [] counters_of_fern;
+
+  return ok;
+}
+
 bool fern_based_point_classifier::save(char * filename)
 {
   ofstream f(filename);
@@ -172,26 +347,47 @@ bool fern_based_point_classifier::save(char * filename)
 
 bool fern_based_point_classifier::save(ostream & f)
 {
+  if (leaves_counters == nullptr) {
+    log_error << "[fern_based_point_classifier::save]"
+              << "Leaves counters were released, can not save." << endl;
+    return false;
+  }
+
+  int buffer_size = number_of_classes * Ferns->number_of_ferns * Ferns->number_of_leaves_per_fern;
+
+  // The counters are saved as shorts when they fit, so the files stay readable by older versions:
+  bool int_counters = false;
+  for(int i = 0; i < buffer_size && !int_counters; i++)
+    int_counters = (leaves_counters[i] > 32767);
+
+  if (int_counters) f << "int_counters" << endl;
   f << number_of_classes << endl;
 
   Ferns->save(f);
 
   f.write((char *)number_of_samples_for_class, sizeof(int) * number_of_classes);
 
-  int buffer_size = number_of_classes * Ferns->number_of_ferns * Ferns->number_of_leaves_per_fern;
-  //  f.write((char *)leaves_counters, sizeof(short) * buffer_size);
-
   log_info << "[fern_based_point_classifier::save]"
            << "Compressing leaves distributions..." << endl;
 
-  Bytef * compressed_buffer = new Bytef[buffer_size * sizeof(short)];
-  uLongf size_of_compressed_buffer = buffer_size * sizeof(short);
-  int z_error = compress(compressed_buffer, &size_of_compressed_buffer, (Bytef *)leaves_counters, buffer_size * sizeof(short));
+  const int counter_size = int_counters ? sizeof(int) : sizeof(short);
+  Bytef * counters = (Bytef *)leaves_counters;
+  if (!int_counters) {
+    short * short_counters = new short[buffer_size];
+    for(int i = 0; i < buffer_size; i++)
+      short_counters[i] = short(leaves_counters[i]);
+    counters = (Bytef *)short_counters;
+  }
+
+  uLongf size_of_compressed_buffer = compressBound(buffer_size * counter_size);
+  Bytef * compressed_buffer = new Bytef[size_of_compressed_buffer];
+  int z_error = compress(compressed_buffer, &size_of_compressed_buffer, counters, buffer_size * counter_size);
+  if (!int_counters) delete [] (short *)counters;
 
   log_debug << "[fern_based_point_classifier::save]"
             << "z_error = " << z_error << endl
             << "size of compressed buffer = " << size_of_compressed_buffer << endl
-            << "Compression ratio = " << float(buffer_size * sizeof(short)) / size_of_compressed_buffer << "." << endl;
+            << "Compression ratio = " << float(buffer_size * counter_size) / size_of_compressed_buffer << "." << endl;
 
   f << size_of_compressed_buffer << " " << buffer_size << endl;
   char dot('.'); f.write(&dot, 1);
@@ -199,17 +395,274 @@ bool fern_based_point_classifier::save(ostream & f)
 
   delete [] compressed_buffer;
 
+  save_early_termination(f);
+
+  return true;
+}
+
+bool fern_based_point_classifier::save_frozen(char * filename)
+{
+  ofstream f(filename, ios::binary);
+
+  if (!f.is_open()) {
+    log_error << "[fern_based_point_classifier::save_frozen]"
+              << "Error while saving file " << filename << "." << endl;
+
+    return false;
+  }
+
+  bool result = save_frozen(f);
+
+  f.close();
+
+  return result;
+}
+
+bool fern_based_point_classifier::save_frozen(ostream & f)
+{
+  if (leaves_distributions == nullptr) {
+    log_error << "[fern_based_point_classifier::save_frozen]"
+              << "Leaves distributions were released, can not save." << endl;
+    return false;
+  }
+
+  f << "frozen" << endl;
+  f << number_of_classes << endl;
+
+  Ferns->save(f);
+
+  f.write((char *)number_of_samples_for_class, sizeof(int) * number_of_classes);
+
+  int buffer_size = number_of_classes * Ferns->number_of_ferns * Ferns->number_of_leaves_per_fern;
+
+  f << buffer_size << endl;
+  char dot('.'); f.write(&dot, 1);
+  f.write((char *)leaves_distributions, buffer_size * sizeof(float));
+
+  save_early_termination(f);
+
+  return true;
+}
+
+// Header of the mapped format. The offsets are relative to the beginning of the section and
+// multiples of mapped_alignment:
+struct mapped_classifier_header
+{
+  char magic[8];
+  int version;
+  int number_of_classes, number_of_ferns, number_of_tests_per_fern;
+  int early_termination_steps, use_early_termination;
+  long long tests_offset;             // int DX1[], DY1[], DX2[], DY2[]
+  long long samples_offset;           // int number_of_samples_for_class[]
+  long long distributions_offset;     // float leaves_distributions[]
+  long long early_termination_offset; // float early_accept_margins[], early_reject_scores[]
+  long long size;
+};
+
+static const char mapped_classifier_magic[8] = { 'F', 'E', 'R', 'N', 'C', 'L', 'S', 0 };
+static const int mapped_classifier_version = 1;
+
+static long long mapped_aligned(long long size)
+{
+  const long long a = fern_based_point_classifier::mapped_alignment;
+  return (size + a - 1) / a * a;
+}
+
+static void write_mapped_padding(ostream & f, long long from, long long to)
+{
+  for(long long i = from; i < to; i++) f.put(0);
+}
+
+bool fern_based_point_classifier::save_mapped(ostream & f)
+{
+  if (leaves_distributions == nullptr) {
+    log_error << "[fern_based_point_classifier::save_mapped]"
+              << "Leaves distributions were released, can not save." << endl;
+    return false;
+  }
+
+  const int nb_tests = Ferns->number_of_ferns * Ferns->number_of_tests_per_fern;
+  const long long buffer_size = (long long)number_of_classes * Ferns->number_of_ferns * Ferns->number_of_leaves_per_fern;
+
+  mapped_classifier_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, mapped_classifier_magic, sizeof(header.magic));
+  header.version = mapped_classifier_version;
+  header.number_of_classes = number_of_classes;
+  header.number_of_ferns = Ferns->number_of_ferns;
+  header.number_of_tests_per_fern = Ferns->number_of_tests_per_fern;
+  header.early_termination_steps = early_termination_steps;
+  header.use_early_termination = use_early_termination ? 1 : 0;
+  header.tests_offset = mapped_aligned(sizeof(header));
+  header.samples_offset = mapped_aligned(header.tests_offset + 4 * nb_tests * sizeof(int));
+  header.distributions_offset = mapped_aligned(header.samples_offset + number_of_classes * sizeof(int));
+  header.early_termination_offset = mapped_aligned(header.distributions_offset + buffer_size * sizeof(float));
+  header.size = mapped_aligned(header.early_termination_offset + 2 * early_termination_steps * sizeof(float));
+
+  f.write((char *)&header, sizeof(header));
+  write_mapped_padding(f, sizeof(header), header.tests_offset);
+
+  f.write((char *)Ferns->DX1, nb_tests * sizeof(int));
+  f.write((char *)Ferns->DY1, nb_tests * sizeof(int));
+  f.write((char *)Ferns->DX2, nb_tests * sizeof(int));
+  f.write((char *)Ferns->DY2, nb_tests * sizeof(int));
+  write_mapped_padding(f, header.tests_offset + 4 * nb_tests * sizeof(int), header.samples_offset);
+
+  f.write((char *)number_of_samples_for_class, number_of_classes * sizeof(int));
+  write_mapped_padding(f, header.samples_offset + number_of_classes * sizeof(int), header.distributions_offset);
+
+  f.write((char *)leaves_distributions, buffer_size * sizeof(float));
+  write_mapped_padding(f, header.distributions_offset + buffer_size * sizeof(float), header.early_termination_offset);
+
+  if (early_termination_steps > 0) {
+    f.write((char *)early_accept_margins, early_termination_steps * sizeof(float));
+    f.write((char *)early_reject_scores, early_termination_steps * sizeof(float));
+  }
+  write_mapped_padding(f, header.early_termination_offset + 2 * early_termination_steps * sizeof(float), header.size);
+
+  return !f.fail();
+}
+
+// The sections must be inside the mapped section, in order:
+static bool mapped_sections_are_valid(const mapped_classifier_header * header)
+{
+  if (header->number_of_classes < 0 || header->number_of_ferns <= 0 ||
+      header->number_of_tests_per_fern <= 0 || header->number_of_tests_per_fern > 30 ||
+      header->early_termination_steps < 0)
+    return false;
+
+  const long long nb_tests = (long long)header->number_of_ferns * header->number_of_tests_per_fern;
+  const long long buffer_size = (long long)header->number_of_classes * header->number_of_ferns << header->number_of_tests_per_fern;
+  const long long tests_end = header->tests_offset + 4 * nb_tests * (long long)sizeof(int);
+  const long long samples_end = header->samples_offset + header->number_of_classes * (long long)sizeof(int);
+  const long long distributions_end = header->distributions_offset + buffer_size * (long long)sizeof(float);
+  const long long early_termination_end = header->early_termination_offset + 2LL * header->early_termination_steps * (long long)sizeof(float);
+
+  return
+    header->tests_offset >= (long long)sizeof(mapped_classifier_header) &&
+    header->samples_offset >= tests_end &&
+    header->distributions_offset >= samples_end &&
+    header->early_termination_offset >= distributions_end &&
+    header->size >= early_termination_end;
+}
+
+bool fern_based_point_classifier::map(const char * mapped_data, size_t mapped_size)
+{
+  correctly_read = false;
+
+  const mapped_classifier_header * header = (const mapped_classifier_header *)mapped_data;
+  if (mapped_size < sizeof(mapped_classifier_header) ||
+      memcmp(header->magic, mapped_classifier_magic, sizeof(header->magic)) != 0) {
+    log_error << "[fern_based_point_classifier::map]" << "Not a mapped classifier." << endl;
+    return false;
+  }
+  if (header->version != mapped_classifier_version) {
+    log_error << "[fern_based_point_classifier::map]" << "Unknown version " << header->version << "." << endl;
+    return false;
+  }
+  if (header->size > (long long)mapped_size || ((size_t)mapped_data % mapped_alignment) != 0 ||
+      !mapped_sections_are_valid(header)) {
+    log_error << "[fern_based_point_classifier::map]" << "Truncated or misaligned data." << endl;
+    return false;
+  }
+
+  if (Ferns) delete Ferns;
+  Ferns = new ferns(header->number_of_ferns, header->number_of_tests_per_fern,
+                    (const int *)(mapped_data + header->tests_offset));
+
+  number_of_classes = header->number_of_classes;
+  step1 = number_of_classes;
+  step2 = step1 * Ferns->number_of_leaves_per_fern;
+
+  if (number_of_samples_for_class) delete [] number_of_samples_for_class;
+  number_of_samples_for_class = new int[number_of_classes];
+  memcpy(number_of_samples_for_class, mapped_data + header->samples_offset, number_of_classes * sizeof(int));
+
+  // A mapped classifier can not be trained, this also drops the background distributions:
+  release_incremental_training();
+  if (leaves_counters) delete [] leaves_counters;
+  leaves_counters = nullptr;
+  if (leaves_distributions && !leaves_distributions_are_mapped) delete [] leaves_distributions;
+  // The recognition only reads the distributions:
+  leaves_distributions = (float *)(mapped_data + header->distributions_offset);
+  leaves_distributions_are_mapped = true;
+
+  if (early_accept_margins) delete [] early_accept_margins;
+  if (early_reject_scores) delete [] early_reject_scores;
+  early_accept_margins = early_reject_scores = nullptr;
+  early_termination_steps = header->early_termination_steps;
+  use_early_termination = false;
+  if (early_termination_steps > 0) {
+    const float * bounds = (const float *)(mapped_data + header->early_termination_offset);
+    early_accept_margins = new float[early_termination_steps];
+    early_reject_scores = new float[early_termination_steps];
+    memcpy(early_accept_margins, bounds, early_termination_steps * sizeof(float));
+    memcpy(early_reject_scores, bounds + early_termination_steps, early_termination_steps * sizeof(float));
+    use_early_termination = (header->use_early_termination != 0);
+  }
+
+  set_number_of_ferns_to_use(-1);
+
+  if (default_context) delete default_context;
+  default_context = new recognition_context(this);
+
+  correctly_read = true;
+
   return true;
 }
 
+// The early termination bounds are an optional section at the end of the classifier:
+void fern_based_point_classifier::load_early_termination(istream & f)
+{
+  if (early_accept_margins) delete [] early_accept_margins;
+  if (early_reject_scores) delete [] early_reject_scores;
+  early_accept_margins = early_reject_scores = nullptr;
+  early_termination_steps = 0;
+  use_early_termination = false;
+
+  f >> ws;
+  if (f.eof()) {
+    f.clear();
+    return;
+  }
+  if (f.peek() != 'e') return;
+
+  string tag;
+  f >> tag >> early_termination_steps;
+  if (tag != "early_termination" || early_termination_steps != Ferns->number_of_ferns) {
+    log_error << "[fern_based_point_classifier::load_early_termination]" << "Wrong early termination section." << endl;
+    early_termination_steps = 0;
+    return;
+  }
+  char c; do f.read(&c, 1); while (c != '.');
+
+  early_accept_margins = new float[early_termination_steps];
+  early_reject_scores = new float[early_termination_steps];
+  f.read((char *)early_accept_margins, early_termination_steps * sizeof(float));
+  f.read((char *)early_reject_scores, early_termination_steps * sizeof(float));
+  use_early_termination = true;
+}
+
+void fern_based_point_classifier::save_early_termination(ostream & f)
+{
+  if (early_termination_steps == 0) return;
+
+  f << "early_termination " << early_termination_steps << endl;
+  char dot('.'); f.write(&dot, 1);
+  f.write((char *)early_accept_margins, early_termination_steps * sizeof(float));
+  f.write((char *)early_reject_scores, early_termination_steps * sizeof(float));
+}
+
 void fern_based_point_classifier::reset_leaves_distributions(int _prior_number)
 {
   int buffer_size = number_of_classes * Ferns->number_of_ferns * Ferns->number_of_leaves_per_fern;
 
   prior_number = _prior_number;
 
+  release_incremental_training();
+
   for(int i = 0; i < buffer_size; i++)
-    leaves_counters[i] = short(prior_number);
+    leaves_counters[i] = prior_number;
   for(int i = 0; i < number_of_classes; i++)
     number_of_samples_for_class[i] = 0;
 }
@@ -217,8 +670,15 @@ void fern_based_point_classifier::reset_leaves_distributions(int _prior_number)
 void fern_based_point_classifier::train(keypoint * keypoints, int number_of_keypoints,
                                         int number_of_octaves, int yape_radius,
                                         int number_of_generated_images,
-                                        affine_image_generator06 * image_generator)
+                                        affine_image_generator06 * image_generator,
+                                        int number_of_threads, unsigned int seed)
 {
+  if (number_of_threads != 1) {
+    train_in_parallel(keypoints, number_of_keypoints, number_of_octaves, yape_radius,
+                      number_of_generated_images, image_generator, number_of_threads, seed);
+    return;
+  }
+
   fine_gaussian_pyramid * pyramid = new fine_gaussian_pyramid(yape_radius, Ferns->max_d, number_of_octaves);
 
   image_generator->enable_random_background();
@@ -254,50 +714,515 @@ void fern_based_point_classifier::train(keypoint * keypoints, int number_of_keyp
   //delete pyramid;
 }
 
+void fern_based_point_classifier::train_in_parallel(keypoint * keypoints, int number_of_keypoints,
+                                                    int number_of_octaves, int yape_radius,
+                                                    int number_of_generated_images,
+                                                    affine_image_generator06 * image_generator,
+                                                    int number_of_threads, unsigned int seed)
+{
+  image_generator->enable_random_background();
+
+  if (number_of_threads <= 0) number_of_threads = omp_get_max_threads();
+
+  log_info << "[fern_based_point_classifier::train_in_parallel]" << "start, " << number_of_threads << " threads" << endl;
+
+#pragma omp parallel num_threads(number_of_threads)
+  {
+    affine_image_generator06 * generator = new affine_image_generator06(*image_generator);
+    fine_gaussian_pyramid * pyramid = new fine_gaussian_pyramid(yape_radius, Ferns->max_d, number_of_octaves);
+    ferns::drop_context * context = new ferns::drop_context(Ferns);
+    int * number_of_samples_for_class_in_thread = new int[number_of_classes];
+    for(int k = 0; k < number_of_classes; k++)
+      number_of_samples_for_class_in_thread[k] = 0;
+
+#pragma omp for schedule(dynamic)
+    for(int i = 0; i < number_of_generated_images; i++) {
+      if (i % 50 == 0)
+        log_verb << "[fern_based_point_classifier::train_in_parallel]"
+                 << "Generating view " << i << endl;
+
+      generator->set_random_seed(seed + i);
+      generator->generate_random_affine_image();
+      pyramid->set_image(generator->generated_image);
+
+      for(int j = 0; j < number_of_keypoints; j++) {
+        keypoint * K = keypoints + j;
+        float fr_gu, fr_gv;
+        generator->affine_transformation(K->fr_u(), K->fr_v(), fr_gu, fr_gv);
+
+        int gu = int( fine_gaussian_pyramid::convCoordf(fr_gu, 0, int(K->scale)) + 0.5 );
+        int gv = int( fine_gaussian_pyramid::convCoordf(fr_gv, 0, int(K->scale)) + 0.5 );
+        int level = 4 * int(K->scale) + ((yape_radius == 3) ? 1 : (yape_radius == 5) ? 2 : 3);
+
+        int * leaves_index = Ferns->drop(context, pyramid, gu, gv, level);
+        if (leaves_index) {
+          number_of_samples_for_class_in_thread[K->class_index]++;
+          // The sums of integers do not depend on the order of the threads:
+          for(int k = 0; k < Ferns->number_of_ferns; k++)
+#pragma omp atomic
+            leaves_counters[k * step2 + leaves_index[k] * step1 + K->class_index]++;
+        }
+      }
+    }
+
+#pragma omp critical
+    for(int k = 0; k < number_of_classes; k++)
+      number_of_samples_for_class[k] += number_of_samples_for_class_in_thread[k];
+
+    delete [] number_of_samples_for_class_in_thread;
+    delete context;
+    delete pyramid;
+    delete generator;
+  }
+}
+
 void fern_based_point_classifier::finalize_training(void)
 {
 
   log_info << "[fern_based_point_classifier::finalize_training]" << "start" << endl;
 
+  if (leaves_counters == nullptr) {
+    log_error << "[fern_based_point_classifier::finalize_training]"
+              << "No leaves counters (inference only or mapped classifier)." << endl;
+    return;
+  }
+
+  release_incremental_training();
+
 #pragma omp parallel for
-  for(int i = 0; i < Ferns->number_of_ferns; i++) {
-    double * number_of_samples_for_this_leaf = new double[Ferns->number_of_leaves_per_fern];
-    memset(number_of_samples_for_this_leaf,0,sizeof(double)*Ferns->number_of_leaves_per_fern);
+  for(int i = 0; i < Ferns->number_of_ferns; i++)
+    finalize_fern(i, leaves_counters + i * step2);
 
-    double number_of_samples_for_this_fern = 0.;
-    for(int j = 0; j < Ferns->number_of_leaves_per_fern; j++)
-      for(int k = 0; k < number_of_classes; k++)
-        number_of_samples_for_this_fern +=
-          double(leaves_counters[i * step2 + j * step1 + k]) / double(number_of_samples_for_class[k]);
+  if (quantization_bits != 0)
+    quantize_leaves_distributions(quantization_bits);
+  if (sparse_top_k != 0)
+    sparsify_leaves_distributions(sparse_top_k);
+}
+
+// With n_k the number of samples of class k, c_jk the counter of leaf j for class k, and
+// C_k = sum_j c_jk, finalize_fern() computes
+//   log( (c_jk / n_k) / (C_k / n_k) / (N_j / N) ) = log(c_jk / C_k) - log(N_j / N)
+// where N_j = sum_k c_jk / n_k and N = sum_j N_j. Only the second term, the normalization of
+// the leaf, depends on the other classes.
+void fern_based_point_classifier::init_incremental_training(void)
+{
+  const int number_of_ferns = Ferns->number_of_ferns;
+  const int number_of_leaves = Ferns->number_of_leaves_per_fern;
+
+  class_counters_for_fern = new int[number_of_ferns * number_of_classes];
+  leaf_normalizations = new float[number_of_ferns * number_of_leaves];
+  leaf_is_dirty = new bool[number_of_ferns * number_of_leaves];
+  fern_is_dirty = new bool[number_of_ferns];
+  class_is_dirty = new bool[number_of_classes];
+  dirty_leaves = new int[number_of_ferns * number_of_leaves];
+  dirty_classes = new int[number_of_classes];
+  number_of_dirty_leaves = number_of_dirty_classes = 0;
+
+  for(int i = 0; i < number_of_ferns * number_of_leaves; i++)
+    leaf_is_dirty[i] = false;
+  for(int k = 0; k < number_of_classes; k++)
+    class_is_dirty[k] = false;
+
+#pragma omp parallel for
+  for(int i = 0; i < number_of_ferns; i++) {
+    const int * counters_of_fern = leaves_counters + i * step2;
+    int * class_counters = class_counters_for_fern + i * number_of_classes;
 
-    for(int j = 0; j < Ferns->number_of_leaves_per_fern; j++) {
+    for(int k = 0; k < number_of_classes; k++)
+      class_counters[k] = 0;
+
+    double number_of_samples_for_this_fern = 0.;
+    double * number_of_samples_for_this_leaf = new double[number_of_leaves];
+    for(int j = 0; j < number_of_leaves; j++) {
+      number_of_samples_for_this_leaf[j] = 0.;
       for(int k = 0; k < number_of_classes; k++) {
-        number_of_samples_for_this_leaf[j] +=
-          double(leaves_counters[i * step2 + j * step1 + k]) / double(number_of_samples_for_class[k]);
+        class_counters[k] += counters_of_fern[j * step1 + k];
+        number_of_samples_for_this_leaf[j] += double(counters_of_fern[j * step1 + k]) / double(number_of_samples_for_class[k]);
       }
+      number_of_samples_for_this_fern += number_of_samples_for_this_leaf[j];
     }
 
+    for(int j = 0; j < number_of_leaves; j++)
+      leaf_normalizations[i * number_of_leaves + j] =
+        float( log(number_of_samples_for_this_leaf[j] / number_of_samples_for_this_fern) );
+
+    fern_is_dirty[i] = false;
+    delete [] number_of_samples_for_this_leaf;
+  }
+}
+
+void fern_based_point_classifier::release_incremental_training(void)
+{
+  if (class_counters_for_fern) delete [] class_counters_for_fern;
+  if (leaf_normalizations) delete [] leaf_normalizations;
+  if (leaf_is_dirty) delete [] leaf_is_dirty;
+  if (fern_is_dirty) delete [] fern_is_dirty;
+  if (class_is_dirty) delete [] class_is_dirty;
+  if (dirty_leaves) delete [] dirty_leaves;
+  if (dirty_classes) delete [] dirty_classes;
+
+  class_counters_for_fern = nullptr;
+  leaf_normalizations = nullptr;
+  leaf_is_dirty = fern_is_dirty = class_is_dirty = nullptr;
+  dirty_leaves = dirty_classes = nullptr;
+  number_of_dirty_leaves = number_of_dirty_classes = 0;
+
+  if (background_leaves_distributions) delete [] background_leaves_distributions;
+  background_leaves_distributions = nullptr;
+  background_leaves_distributions_are_stale = background_leaves_distributions_are_ready = false;
+}
+
+void fern_based_point_classifier::add_samples(fine_gaussian_pyramid * pyramid, keypoint * keypoints, int number_of_keypoints)
+{
+  for(int i = 0; i < number_of_keypoints; i++) {
+    keypoint * K = keypoints + i;
+    int * leaves_index = Ferns->drop(pyramid, int(K->u + 0.5), int(K->v + 0.5), pyramid->level_from_scale(K->scale));
+
+    if (leaves_index) add_sample(leaves_index, K->class_index);
+  }
+}
+
+void fern_based_point_classifier::add_sample(const int * leaves_index, int class_index)
+{
+  if (leaves_counters == nullptr || leaves_distributions == nullptr) {
+    log_error << "[fern_based_point_classifier::add_sample]"
+              << "Leaves counters or distributions were released, can not train." << endl;
+    return;
+  }
+  if (class_counters_for_fern == nullptr) init_incremental_training();
+
+  const int number_of_leaves = Ferns->number_of_leaves_per_fern;
+
+  number_of_samples_for_class[class_index]++;
+  for(int i = 0; i < Ferns->number_of_ferns; i++) {
+    leaves_counters[i * step2 + leaves_index[i] * step1 + class_index]++;
+    class_counters_for_fern[i * number_of_classes + class_index]++;
+
+    const int leaf = i * number_of_leaves + leaves_index[i];
+    if (!leaf_is_dirty[leaf]) {
+      leaf_is_dirty[leaf] = true;
+      dirty_leaves[number_of_dirty_leaves++] = leaf;
+    }
+    fern_is_dirty[i] = true;
+  }
+
+  if (!class_is_dirty[class_index]) {
+    class_is_dirty[class_index] = true;
+    dirty_classes[number_of_dirty_classes++] = class_index;
+  }
+}
+
+int fern_based_point_classifier::refresh_leaves_distributions(int maximum_number_of_entries)
+{
+  if (class_counters_for_fern == nullptr) return 0;
+
+  // The refreshes done in the background are not lost:
+  publish_leaves_distributions();
+  const int number_left = refresh_leaves_distributions(leaves_distributions, maximum_number_of_entries);
+  if (background_leaves_distributions) background_leaves_distributions_are_stale = true;
+
+  return number_left;
+}
+
+int fern_based_point_classifier::refresh_leaves_distributions_in_background(int maximum_number_of_entries)
+{
+  if (class_counters_for_fern == nullptr) return 0;
+
+  const int buffer_size = number_of_classes * Ferns->number_of_ferns * Ferns->number_of_leaves_per_fern;
+  if (background_leaves_distributions == nullptr) {
+    background_leaves_distributions = new float[buffer_size];
+    background_leaves_distributions_are_stale = true;
+  }
+  // leaves_distributions is only read, as by recognize():
+  if (background_leaves_distributions_are_stale) {
+    memcpy(background_leaves_distributions, leaves_distributions, buffer_size * sizeof(float));
+    background_leaves_distributions_are_stale = false;
+  }
+
+  const int number_left = refresh_leaves_distributions(background_leaves_distributions, maximum_number_of_entries);
+  background_leaves_distributions_are_ready = true;
+
+  return number_left;
+}
+
+void fern_based_point_classifier::publish_leaves_distributions(void)
+{
+  if (!background_leaves_distributions_are_ready) return;
+
+  float * previous_leaves_distributions = leaves_distributions;
+  leaves_distributions = background_leaves_distributions;
+  background_leaves_distributions = previous_leaves_distributions;
+  background_leaves_distributions_are_ready = false;
+  background_leaves_distributions_are_stale = true;
+}
+
+int fern_based_point_classifier::refresh_leaves_distributions(float * distributions, int maximum_number_of_entries)
+{
+
+  const int number_of_ferns = Ferns->number_of_ferns;
+  const int number_of_leaves = Ferns->number_of_leaves_per_fern;
+
+  // The number of samples of the ferns are needed for the normalizations of the leaves:
+  double * number_of_samples_for_fern = new double[number_of_ferns];
+  for(int i = 0; i < number_of_ferns; i++) {
+    number_of_samples_for_fern[i] = 0.;
+    if (!fern_is_dirty[i]) continue;
+    for(int k = 0; k < number_of_classes; k++)
+      number_of_samples_for_fern[i] +=
+        double(class_counters_for_fern[i * number_of_classes + k]) / double(number_of_samples_for_class[k]);
+  }
+
+  int number_of_entries = 0;
+  while (number_of_dirty_leaves > 0 &&
+         (maximum_number_of_entries < 0 || number_of_entries == 0 ||
+          number_of_entries + number_of_classes <= maximum_number_of_entries)) {
+    const int leaf = dirty_leaves[--number_of_dirty_leaves];
+    const int i = leaf / number_of_leaves, j = leaf % number_of_leaves;
+    const int * counters = leaves_counters + i * step2 + j * step1;
+
+    double number_of_samples_for_this_leaf = 0.;
+    for(int k = 0; k < number_of_classes; k++)
+      number_of_samples_for_this_leaf += double(counters[k]) / double(number_of_samples_for_class[k]);
+    leaf_normalizations[leaf] = float( log(number_of_samples_for_this_leaf / number_of_samples_for_fern[i]) );
+
+    refresh_leaf(distributions, i, j);
+    leaf_is_dirty[leaf] = false;
+    number_of_entries += number_of_classes;
+  }
+
+  const int entries_per_class = number_of_ferns * number_of_leaves;
+  while (number_of_dirty_classes > 0 &&
+         (maximum_number_of_entries < 0 || number_of_entries == 0 ||
+          number_of_entries + entries_per_class <= maximum_number_of_entries)) {
+    const int k = dirty_classes[--number_of_dirty_classes];
+    refresh_class(distributions, k);
+    class_is_dirty[k] = false;
+    number_of_entries += entries_per_class;
+  }
+
+  if (number_of_dirty_leaves == 0)
+    for(int i = 0; i < number_of_ferns; i++)
+      fern_is_dirty[i] = false;
+
+  delete [] number_of_samples_for_fern;
+
+  return number_of_dirty_leaves + number_of_dirty_classes;
+}
+
+void fern_based_point_classifier::refresh_leaf(float * distributions, int fern_index, int leaf_index)
+{
+  const int * counters = leaves_counters + fern_index * step2 + leaf_index * step1;
+  const int * class_counters = class_counters_for_fern + fern_index * number_of_classes;
+  const float leaf_normalization = leaf_normalizations[fern_index * Ferns->number_of_leaves_per_fern + leaf_index];
+  float * distribution = distributions + fern_index * step2 + leaf_index * step1;
+
+  for(int k = 0; k < number_of_classes; k++)
+    distribution[k] = float( log( double(counters[k]) / double(class_counters[k]) ) ) - leaf_normalization;
+}
+
+void fern_based_point_classifier::refresh_class(float * distributions, int class_index)
+{
+  const int number_of_leaves = Ferns->number_of_leaves_per_fern;
+
+#pragma omp parallel for
+  for(int i = 0; i < Ferns->number_of_ferns; i++) {
+    const double class_counter = double(class_counters_for_fern[i * number_of_classes + class_index]);
+    for(int j = 0; j < number_of_leaves; j++)
+      distributions[i * step2 + j * step1 + class_index] =
+        float( log( double(leaves_counters[i * step2 + j * step1 + class_index]) / class_counter ) )
+        - leaf_normalizations[i * number_of_leaves + j];
+  }
+}
+
+//! counters_of_fern: the step2 counters of the fern, leaf after leaf.
+void fern_based_point_classifier::finalize_fern(int fern_index, const int * counters_of_fern)
+{
+  double * number_of_samples_for_this_leaf = new double[Ferns->number_of_leaves_per_fern];
+  memset(number_of_samples_for_this_leaf,0,sizeof(double)*Ferns->number_of_leaves_per_fern);
+
+  double number_of_samples_for_this_fern = 0.;
+  for(int j = 0; j < Ferns->number_of_leaves_per_fern; j++)
+    for(int k = 0; k < number_of_classes; k++)
+      number_of_samples_for_this_fern +=
+        double(counters_of_fern[j * step1 + k]) / double(number_of_samples_for_class[k]);
+
+  for(int j = 0; j < Ferns->number_of_leaves_per_fern; j++) {
     for(int k = 0; k < number_of_classes; k++) {
+      number_of_samples_for_this_leaf[j] +=
+        double(counters_of_fern[j * step1 + k]) / double(number_of_samples_for_class[k]);
+    }
+  }
+
+  float * distributions_of_fern = leaves_distributions + fern_index * step2;
+  for(int k = 0; k < number_of_classes; k++) {
+    double sum = 0.;
+    for(int j = 0; j < Ferns->number_of_leaves_per_fern; j++)
+      sum += double(counters_of_fern[j * step1 + k]) / double(number_of_samples_for_class[k]);
+
+    for(int j = 0; j < Ferns->number_of_leaves_per_fern; j++)
+      distributions_of_fern[j * step1 + k] =
+        float( log( double(counters_of_fern[j * step1 + k]) / double(number_of_samples_for_class[k])
+                    / sum
+                    / (number_of_samples_for_this_leaf[j] / number_of_samples_for_this_fern) ) );
+  }
+  delete [] number_of_samples_for_this_leaf;
+}
+
+void fern_based_point_classifier::quantize_leaves_distributions(int number_of_bits, bool release_float_distributions)
+{
+  if (leaves_distributions == nullptr) {
+    log_error << "[fern_based_point_classifier::quantize_leaves_distributions]"
+              << "Leaves distributions were released, can not quantize them again." << endl;
+    return;
+  }
+  if (number_of_bits != 8 && number_of_bits != 16) {
+    log_error << "[fern_based_point_classifier::quantize_leaves_distributions]"
+              << "Can only quantize on 8 or 16 bits." << endl;
+    return;
+  }
+
+  const int number_of_ferns = Ferns->number_of_ferns;
+  const int number_of_leaves = Ferns->number_of_leaves_per_fern;
+
+  // Each fern is centered on the middle of its range of (finite) log-posteriors:
+  if (fern_offsets) delete [] fern_offsets;
+  fern_offsets = new float[number_of_ferns];
+  float half_range = 0.f;
+  for(int i = 0; i < number_of_ferns; i++) {
+    float min_value = 0.f, max_value = 0.f;
+    bool first = true;
+    for(int j = 0; j < step2; j++) {
+      float v = leaves_distributions[i * step2 + j];
+      if (!std::isfinite(v)) continue;
+      if (first || v < min_value) min_value = v;
+      if (first || v > max_value) max_value = v;
+      first = false;
+    }
+    fern_offsets[i] = (min_value + max_value) / 2.f;
+    half_range = max(half_range, (max_value - min_value) / 2.f);
+  }
+
+  // The int8 values are accumulated on 16 bits and can not saturate with less than 258 ferns.
+  // The int16 values are scaled so that the sum of all the ferns can not saturate either.
+  const int maximum_value = (number_of_bits == 8) ? 127 : 32767 / number_of_ferns;
+  quantization_scale = half_range > 0.f ? maximum_value / half_range : 1.f;
+
+  quantization_bits = number_of_bits;
+  quantized_step1 = padded_number_of_classes(number_of_classes);
+  quantized_step2 = quantized_step1 * number_of_leaves;
+
+  const int bytes_per_value = number_of_bits / 8;
+  if (quantized_leaves_distributions) delete [] quantized_leaves_distributions;
+  quantized_leaves_distributions = new char[number_of_ferns * quantized_step2 * bytes_per_value];
+  memset(quantized_leaves_distributions, 0, number_of_ferns * quantized_step2 * bytes_per_value);
+
+#pragma omp parallel for
+  for(int i = 0; i < number_of_ferns; i++)
+    for(int j = 0; j < number_of_leaves; j++)
+      for(int k = 0; k < number_of_classes; k++) {
+        float v = (leaves_distributions[i * step2 + j * step1 + k] - fern_offsets[i]) * quantization_scale;
+        int q = std::isnan(v) ? -maximum_value : int(lrintf(max(-float(maximum_value), min(float(maximum_value), v))));
+        int index = i * quantized_step2 + j * quantized_step1 + k;
+        if (number_of_bits == 8)
+          ((signed char *)quantized_leaves_distributions)[index] = (signed char)q;
+        else
+          ((short *)quantized_leaves_distributions)[index] = short(q);
+      }
+
+  log_info << "[fern_based_point_classifier::quantize_leaves_distributions]"
+           << "Leaves distributions quantized on " << number_of_bits << " bits, scale = " << quantization_scale << endl;
+
+  if (release_float_distributions)
+    release_leaves_distributions();
+}
+
+void fern_based_point_classifier::sparsify_leaves_distributions(int top_k, bool release_float_distributions)
+{
+  if (leaves_distributions == nullptr) {
+    log_error << "[fern_based_point_classifier::sparsify_leaves_distributions]"
+              << "Leaves distributions were released, can not sparsify them again." << endl;
+    return;
+  }
+  if (top_k < 1) {
+    log_error << "[fern_based_point_classifier::sparsify_leaves_distributions]"
+              << "top_k must be at least 1." << endl;
+    return;
+  }
+
+  sparse_top_k = min(top_k, number_of_classes);
+
+  const int number_of_leaves = Ferns->number_of_ferns * Ferns->number_of_leaves_per_fern;
+  if (sparse_classes) delete [] sparse_classes;
+  if (sparse_values) delete [] sparse_values;
+  if (sparse_defaults) delete [] sparse_defaults;
+  sparse_classes = new int[number_of_leaves * sparse_top_k];
+  sparse_values = new float[number_of_leaves * sparse_top_k];
+  sparse_defaults = new float[number_of_leaves];
+
+#pragma omp parallel
+  {
+    int * classes = new int[number_of_classes];
+
+#pragma omp for
+    for(int l = 0; l < number_of_leaves; l++) {
+      // Leaves are contiguous in leaves_distributions, step1 apart:
+      const float * ld = leaves_distributions + l * step1;
+
+      for(int k = 0; k < number_of_classes; k++)
+        classes[k] = k;
+      nth_element(classes, classes + sparse_top_k - 1, classes + number_of_classes,
+                  [ld](int a, int b) { return ld[a] > ld[b] || (ld[a] == ld[b] && a < b); });
+
       double sum = 0.;
-      for(int j = 0; j < Ferns->number_of_leaves_per_fern; j++)
-        sum += double(leaves_counters[i * step2 + j * step1 + k]) / double(number_of_samples_for_class[k]);
-
-      for(int j = 0; j < Ferns->number_of_leaves_per_fern; j++)
-        leaves_distributions[i * step2 + j * step1 + k] =
-          float( log( double(leaves_counters[i * step2 + j * step1 + k]) / double(number_of_samples_for_class[k])
-                      / sum
-                      / (number_of_samples_for_this_leaf[j] / number_of_samples_for_this_fern) ) );
+      for(int k = sparse_top_k; k < number_of_classes; k++)
+        sum += ld[classes[k]];
+      const float default_value = (sparse_top_k < number_of_classes) ?
+        float(sum / (number_of_classes - sparse_top_k)) : 0.f;
+
+      sparse_defaults[l] = default_value;
+      for(int k = 0; k < sparse_top_k; k++) {
+        sparse_classes[l * sparse_top_k + k] = classes[k];
+        sparse_values[l * sparse_top_k + k] = ld[classes[k]] - default_value;
+      }
     }
-    delete [] number_of_samples_for_this_leaf;
+
+    delete [] classes;
   }
 
+  log_info << "[fern_based_point_classifier::sparsify_leaves_distributions]"
+           << "Leaves distributions reduced to the top " << sparse_top_k << " classes." << endl;
+
+  if (release_float_distributions)
+    release_leaves_distributions();
+}
+
+void fern_based_point_classifier::release_leaves_distributions(void)
+{
+  if (leaves_distributions && !leaves_distributions_are_mapped) delete [] leaves_distributions;
+  leaves_distributions_are_mapped = false;
+  if (leaves_counters) delete [] leaves_counters;
+  leaves_distributions = nullptr;
+  leaves_counters = nullptr;
+  release_incremental_training();
 }
 
 float fern_based_point_classifier::test(keypoint * keypoints, int number_of_keypoints,
                                         int number_of_octaves, int yape_radius,
                                         int number_of_generated_images,
-                                        affine_image_generator06 * image_generator)
+                                        affine_image_generator06 * image_generator,
+                                        float early_termination_loss_rate)
 {
+  const bool calibrate = (early_termination_loss_rate >= 0.f && leaves_distributions != nullptr);
+  const bool early_termination_was_used = use_early_termination;
+  if (calibrate) use_early_termination = false;
+
+  // For the calibration of the early termination, for each sample and after each fern:
+  const int nb_ferns = Ferns->number_of_ferns;
+  vector<float> partial_best_scores, partial_margins;
+  vector<int> partial_classes, final_classes;
+  vector<char> correct;
+  float * partial_distribution = calibrate ? new float[number_of_classes] : nullptr;
+
   int * seen = new int[number_of_classes];
   int * recognized = new int[number_of_classes];
 
@@ -335,6 +1260,31 @@ float fern_based_point_classifier::test(keypoint * keypoints, int number_of_keyp
       log_verb << "[fern_based_point_classifier::test]"
                << "Guess: " << guessed_class_index << ", True: " << K->class_index << endl;
 
+      if (calibrate && guessed_class_index >= 0) {
+        const int * leaves_index = default_context->drop_context->leaves_index;
+        for(int c = 0; c < number_of_classes; c++)
+          partial_distribution[c] = 0.f;
+        for(int f = 0; f < nb_ferns; f++) {
+          const float * ld = leaves_distributions + f * step2 + leaves_index[f] * step1;
+          float best = -1e30f, second = -1e30f;
+          int best_class = 0;
+          for(int c = 0; c < number_of_classes; c++) {
+            partial_distribution[c] += ld[c];
+            if (partial_distribution[c] > best) {
+              second = best;
+              best = partial_distribution[c];
+              best_class = c;
+            } else if (partial_distribution[c] > second)
+              second = partial_distribution[c];
+          }
+          partial_best_scores.push_back(best);
+          partial_margins.push_back(best - second);
+          partial_classes.push_back(best_class);
+        }
+        final_classes.push_back(partial_classes.back());
+        correct.push_back(partial_classes.back() == K->class_index);
+      }
+
       if (guessed_class_index >= 0) {
         seen[K->class_index]++;
         if (guessed_class_index == K->class_index)
@@ -347,12 +1297,15 @@ float fern_based_point_classifier::test(keypoint * keypoints, int number_of_keyp
            << "Generated" << number_of_generated_images << " images." << endl
            << "Results of test:" << endl;
 
-  for(int i = 0; i < number_of_classes; i++)
+  // The keypoints may cover only some of the classes (see multi_planar_pattern_detector):
+  for(int j = 0; j < number_of_keypoints; j++) {
+    const int i = keypoints[j].class_index;
     log_verb << "[fern_based_point_classifier::test]"
              << "   - class " << i << " seen " << seen[i]
              << " times, recognized " << recognized[i]
              << " times (" << (100. * recognized[i]) / seen[i] << "%)."
-             << " (scale = " << keypoints[i].scale << ")" << endl;
+             << " (scale = " << keypoints[j].scale << ")" << endl;
+  }
 
   float mean_recognition_rate = 0.;
   int n = 0;
@@ -366,6 +1319,14 @@ float fern_based_point_classifier::test(keypoint * keypoints, int number_of_keyp
   log_verb << "[fern_based_point_classifier::test]"
            << "  - Mean recognition rate: " << mean_recognition_rate << "%" << endl;
 
+  if (calibrate) {
+    calibrate_early_termination(partial_best_scores.data(), partial_margins.data(),
+                                partial_classes.data(), final_classes.data(), correct.data(),
+                                int(final_classes.size()), early_termination_loss_rate);
+    delete [] partial_distribution;
+  }
+  use_early_termination = calibrate || early_termination_was_used;
+
   delete pyramid;
   delete [] seen;
   delete [] recognized;
@@ -373,46 +1334,388 @@ float fern_based_point_classifier::test(keypoint * keypoints, int number_of_keyp
   return mean_recognition_rate;
 }
 
+void fern_based_point_classifier::calibrate_early_termination(const float * partial_best_scores, const float * partial_margins,
+                                                              const int * partial_classes, const int * final_classes,
+                                                              const char * correct, int number_of_samples, float loss_rate)
+{
+  const int nb_ferns = Ferns->number_of_ferns;
+
+  if (early_accept_margins) delete [] early_accept_margins;
+  if (early_reject_scores) delete [] early_reject_scores;
+  early_termination_steps = nb_ferns;
+  early_accept_margins = new float[nb_ferns];
+  early_reject_scores = new float[nb_ferns];
+
+  // Number of samples each bound is allowed to change:
+  const int allowed_losses = int(loss_rate / (2 * nb_ferns) * number_of_samples);
+
+  vector<float> margins, scores;
+  for(int f = 0; f < nb_ferns; f++) {
+    // Margins of the samples whose best class after f ferns is not the final one, in decreasing order:
+    margins.clear();
+    scores.clear();
+    for(int i = 0; i < number_of_samples; i++) {
+      if (partial_classes[i * nb_ferns + f] != final_classes[i])
+        margins.push_back(partial_margins[i * nb_ferns + f]);
+      if (correct[i])
+        scores.push_back(partial_best_scores[i * nb_ferns + f]);
+    }
+    sort(margins.begin(), margins.end(), greater<float>());
+    sort(scores.begin(), scores.end());
+
+    if (int(margins.size()) > allowed_losses)
+      early_accept_margins[f] = nextafterf(margins[allowed_losses], 1e30f);
+    else
+      early_accept_margins[f] = 0.f;
+
+    if (int(scores.size()) > allowed_losses)
+      early_reject_scores[f] = scores[allowed_losses];
+    else
+      early_reject_scores[f] = -1e30f;
+  }
+
+  // The last fern gives the final result:
+  early_accept_margins[nb_ferns - 1] = 0.f;
+  early_reject_scores[nb_ferns - 1] = -1e30f;
+
+  log_info << "[fern_based_point_classifier::calibrate_early_termination]"
+           << "Early termination calibrated on " << number_of_samples << " samples." << endl;
+}
+
+void fern_based_point_classifier::set_early_termination(bool _use_early_termination)
+{
+  if (_use_early_termination && early_termination_steps == 0) {
+    log_error << "[fern_based_point_classifier::set_early_termination]"
+              << "Early termination is not calibrated, call test() first." << endl;
+    return;
+  }
+  use_early_termination = _use_early_termination;
+}
+
+fern_based_point_classifier::recognition_context::recognition_context(const fern_based_point_classifier * classifier)
+{
+  drop_context = new ferns::drop_context(classifier->Ferns);
+  number_of_ferns = classifier->Ferns->number_of_ferns;
+
+  distribution = new float[classifier->number_of_classes];
+  quantized_distribution = new short[padded_number_of_classes(classifier->number_of_classes)];
+
+  sparse_distribution = new float[classifier->number_of_classes];
+  touched_classes = new int[classifier->number_of_classes];
+  class_is_touched = new bool[classifier->number_of_classes];
+  for(int i = 0; i < classifier->number_of_classes; i++) {
+    sparse_distribution[i] = 0.f;
+    class_is_touched[i] = false;
+  }
+
+  batch_size = 0;
+  batch_keypoint_index = batch_level = batch_x = batch_y = batch_leaves_index = nullptr;
+  batch_dropped = nullptr;
+
+  // About 64 KB of scores per tile:
+  tile_size = max(1, 16384 / max(1, classifier->number_of_classes));
+  tile_distributions = new float[tile_size * classifier->number_of_classes];
+}
+
+fern_based_point_classifier::recognition_context::~recognition_context()
+{
+  delete drop_context;
+  delete [] distribution;
+  delete [] quantized_distribution;
+  delete [] sparse_distribution;
+  delete [] touched_classes;
+  delete [] class_is_touched;
+  delete [] tile_distributions;
+  manage_batch_buffers(0);
+}
+
+void fern_based_point_classifier::recognition_context::manage_batch_buffers(int number_of_keypoints)
+{
+  if (number_of_keypoints > 0 && number_of_keypoints <= batch_size) return;
+
+  if (batch_keypoint_index) delete [] batch_keypoint_index;
+  if (batch_level) delete [] batch_level;
+  if (batch_x) delete [] batch_x;
+  if (batch_y) delete [] batch_y;
+  if (batch_leaves_index) delete [] batch_leaves_index;
+  if (batch_dropped) delete [] batch_dropped;
+  batch_keypoint_index = batch_level = batch_x = batch_y = batch_leaves_index = nullptr;
+  batch_dropped = nullptr;
+
+  batch_size = number_of_keypoints;
+  if (batch_size == 0) return;
+
+  batch_keypoint_index = new int[batch_size];
+  batch_level = new int[batch_size];
+  batch_x = new int[batch_size];
+  batch_y = new int[batch_size];
+  batch_leaves_index = new int[batch_size * number_of_ferns];
+  batch_dropped = new bool[batch_size];
+}
+
+void fern_based_point_classifier::drop(recognition_context * context,
+                                       fine_gaussian_pyramid * pyramid, keypoint * keypoints, int number_of_keypoints) const
+{
+  context->manage_batch_buffers(number_of_keypoints);
+
+  int * batch_keypoint_index = context->batch_keypoint_index;
+  int * batch_level = context->batch_level;
+  int * batch_x = context->batch_x, * batch_y = context->batch_y;
+
+  // Counting sort of the keypoints by level:
+  const int number_of_levels = 4 * ferns::maximum_number_of_octaves;
+  int first_of_level[number_of_levels + 1];
+  for(int l = 0; l <= number_of_levels; l++)
+    first_of_level[l] = 0;
+
+  for(int i = 0; i < number_of_keypoints; i++) {
+    batch_level[i] = pyramid->level_from_scale(keypoints[i].scale);
+    first_of_level[batch_level[i] + 1]++;
+  }
+  for(int l = 0; l < number_of_levels; l++)
+    first_of_level[l + 1] += first_of_level[l];
+
+  int next_of_level[number_of_levels];
+  for(int l = 0; l < number_of_levels; l++)
+    next_of_level[l] = first_of_level[l];
+
+  for(int i = 0; i < number_of_keypoints; i++) {
+    int b = next_of_level[batch_level[i]]++;
+    batch_keypoint_index[b] = i;
+    batch_x[b] = int(keypoints[i].u + 0.5);
+    batch_y[b] = int(keypoints[i].v + 0.5);
+  }
+
+  for(int l = 0; l < number_of_levels; l++) {
+    const int b = first_of_level[l];
+    const int n = first_of_level[l + 1] - b;
+    if (n > 0)
+      Ferns->drop(context->drop_context, pyramid, batch_x + b, batch_y + b, n, l,
+                  context->batch_leaves_index + b * Ferns->number_of_ferns, context->batch_dropped + b);
+  }
+}
+
 void fern_based_point_classifier::recognize(fine_gaussian_pyramid * pyramid,
                                             keypoint * keypoints, int number_of_keypoints)
 {
-  for(int i = 0; i < number_of_keypoints; i++)
-    recognize(pyramid, keypoints + i);
+  recognize(default_context, pyramid, keypoints, number_of_keypoints);
 }
 
 void fern_based_point_classifier::recognize(fine_gaussian_pyramid * pyramid,
                                             keypoint * keypoints, int number_of_keypoints,
                                             float * distributions)
 {
-  for(int i = 0; i < number_of_keypoints; i++)
-    recognize(pyramid, keypoints + i, distributions + i * number_of_classes);
+  recognize(default_context, pyramid, keypoints, number_of_keypoints, distributions);
 }
 
 void fern_based_point_classifier::recognize(fine_gaussian_pyramid * pyramid, keypoint * K)
 {
-  recognize(pyramid, K, preallocated_distribution_for_a_keypoint);
+  recognize(default_context, pyramid, K, default_context->distribution);
 }
 
 float * fern_based_point_classifier::recognize_with_distribution(fine_gaussian_pyramid * pyramid, keypoint * K)
 {
-  recognize(pyramid, K, preallocated_distribution_for_a_keypoint);
+  recognize(default_context, pyramid, K, default_context->distribution);
 
-  return preallocated_distribution_for_a_keypoint;
+  return default_context->distribution;
 }
 
 void fern_based_point_classifier::recognize(fine_gaussian_pyramid * pyramid, keypoint * K, float * distribution)
 {
-  for(int i = 0; i < number_of_classes; i++)
-    distribution[i] = 0.f;
+  recognize(default_context, pyramid, K, distribution);
+}
+
+int fern_based_point_classifier::recognize(fine_gaussian_pyramid * pyramid, int u, int v, int level)
+{
+  return recognize(default_context, pyramid, u, v, level);
+}
+
+void fern_based_point_classifier::recognize(recognition_context * context, fine_gaussian_pyramid * pyramid,
+                                            keypoint * keypoints, int number_of_keypoints) const
+{
+  drop(context, pyramid, keypoints, number_of_keypoints);
+
+  if (sparse_top_k == 0 && quantization_bits == 0 && !use_early_termination) {
+    recognize_fern_major(context, keypoints, number_of_keypoints, nullptr);
+    return;
+  }
+
+  for(int b = 0; b < number_of_keypoints; b++)
+    recognize_from_leaves(context, context->batch_dropped[b] ? context->batch_leaves_index + b * Ferns->number_of_ferns : nullptr,
+                          keypoints + context->batch_keypoint_index[b], nullptr);
+}
+
+void fern_based_point_classifier::recognize(recognition_context * context, fine_gaussian_pyramid * pyramid,
+                                            keypoint * keypoints, int number_of_keypoints,
+                                            float * distributions) const
+{
+  drop(context, pyramid, keypoints, number_of_keypoints);
+
+  if (sparse_top_k == 0 && quantization_bits == 0 && !use_early_termination) {
+    recognize_fern_major(context, keypoints, number_of_keypoints, distributions);
+    return;
+  }
+
+  for(int b = 0; b < number_of_keypoints; b++) {
+    const int i = context->batch_keypoint_index[b];
+    recognize_from_leaves(context, context->batch_dropped[b] ? context->batch_leaves_index + b * Ferns->number_of_ferns : nullptr,
+                          keypoints + i, distributions + i * number_of_classes);
+  }
+}
+
+void fern_based_point_classifier::recognize_fern_major(recognition_context * context,
+                                                       keypoint * keypoints, int number_of_keypoints,
+                                                       float * distributions) const
+{
+  const int nb_ferns = get_number_of_ferns_to_use();
+  const int number_of_ferns = Ferns->number_of_ferns;
+  const int * batch_keypoint_index = context->batch_keypoint_index;
+  const bool * batch_dropped = context->batch_dropped;
+  const int row_size = number_of_classes * sizeof(float);
+
+  for(int first = 0; first < number_of_keypoints; first += context->tile_size) {
+    const int last = min(number_of_keypoints, first + context->tile_size);
+
+    // Row of the scores of the keypoint at position b of the batch:
+    auto row = [&](int b) {
+      return distributions ? distributions + batch_keypoint_index[b] * number_of_classes :
+                             context->tile_distributions + (b - first) * number_of_classes;
+    };
+
+    for(int b = first; b < last; b++) {
+      float * distribution = row(b);
+      for(int j = 0; j < number_of_classes; j++)
+        distribution[j] = 0.f;
+    }
+
+    for(int i = 0; i < nb_ferns; i++) {
+      const float * fern_distributions = leaves_distributions + i * step2;
+      for(int b = first; b < last; b++) {
+        if (!batch_dropped[b]) continue;
+
+        // Prefetch the row of the next keypoint, or of the first keypoint for the next fern:
+        const float * next_ld = nullptr;
+        if (b + 1 < last)
+          next_ld = fern_distributions + context->batch_leaves_index[(b + 1) * number_of_ferns + i] * step1;
+        else if (i + 1 < nb_ferns)
+          next_ld = fern_distributions + step2 + context->batch_leaves_index[first * number_of_ferns + i + 1] * step1;
+        if (next_ld != nullptr)
+          for(int k = 0; k < row_size; k += 64)
+            __builtin_prefetch((const char *)next_ld + k);
+
+        const float * ld = fern_distributions + context->batch_leaves_index[b * number_of_ferns + i] * step1;
+        float * distrib = row(b);
+        for(int j = 0; j < number_of_classes; j++)
+          distrib[j] += ld[j];
+      }
+    }
+
+    for(int b = first; b < last; b++) {
+      keypoint * K = keypoints + batch_keypoint_index[b];
+      const float * distribution = row(b);
+
+      if (!batch_dropped[b]) {
+        K->class_index = -1;
+        K->class_score = -100000.f;
+        continue;
+      }
+
+      K->class_index = 0;
+      K->class_score = distribution[0];
+      for(int j = 0; j < number_of_classes; j++)
+        if (distribution[j] > K->class_score) {
+          K->class_index = j;
+          K->class_score = distribution[j];
+        }
+    }
+  }
+}
+
+void fern_based_point_classifier::recognize(recognition_context * context, fine_gaussian_pyramid * pyramid,
+                                            keypoint * K, float * distribution) const
+{
+  int * leaves_index = Ferns->drop(context->drop_context, pyramid,
+                                   int(K->u + 0.5), int(K->v + 0.5), pyramid->level_from_scale(K->scale) );
+
+  recognize_from_leaves(context, leaves_index, K, distribution);
+}
+
+// Saturated addition of a quantized row of n (multiple of 16) values to the distribution:
+static void add_quantized_row(short * distribution, const signed char * row, int n)
+{
+  int k = 0;
+#if defined(__AVX2__)
+  for(; k < n; k += 16) {
+    __m256i d = _mm256_loadu_si256((const __m256i *)(distribution + k));
+    __m256i r = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(row + k)));
+    _mm256_storeu_si256((__m256i *)(distribution + k), _mm256_adds_epi16(d, r));
+  }
+#elif defined(__SSE2__)
+  for(; k < n; k += 16) {
+    __m128i r = _mm_loadu_si128((const __m128i *)(row + k));
+    __m128i r0 = _mm_srai_epi16(_mm_unpacklo_epi8(r, r), 8);
+    __m128i r1 = _mm_srai_epi16(_mm_unpackhi_epi8(r, r), 8);
+    __m128i d0 = _mm_loadu_si128((const __m128i *)(distribution + k));
+    __m128i d1 = _mm_loadu_si128((const __m128i *)(distribution + k + 8));
+    _mm_storeu_si128((__m128i *)(distribution + k),     _mm_adds_epi16(d0, r0));
+    _mm_storeu_si128((__m128i *)(distribution + k + 8), _mm_adds_epi16(d1, r1));
+  }
+#endif
+  for(; k < n; k++)
+    distribution[k] = short(max(-32768, min(32767, distribution[k] + row[k])));
+}
+
+static void add_quantized_row(short * distribution, const short * row, int n)
+{
+  int k = 0;
+#if defined(__AVX2__)
+  for(; k < n; k += 16) {
+    __m256i d = _mm256_loadu_si256((const __m256i *)(distribution + k));
+    __m256i r = _mm256_loadu_si256((const __m256i *)(row + k));
+    _mm256_storeu_si256((__m256i *)(distribution + k), _mm256_adds_epi16(d, r));
+  }
+#elif defined(__SSE2__)
+  for(; k < n; k += 8) {
+    __m128i d = _mm_loadu_si128((const __m128i *)(distribution + k));
+    __m128i r = _mm_loadu_si128((const __m128i *)(row + k));
+    _mm_storeu_si128((__m128i *)(distribution + k), _mm_adds_epi16(d, r));
+  }
+#endif
+  for(; k < n; k++)
+    distribution[k] = short(max(-32768, min(32767, distribution[k] + row[k])));
+}
 
-  int * leaves_index = Ferns->drop(pyramid, int(K->u + 0.5), int(K->v + 0.5), pyramid->level_from_scale(K->scale) );
+void fern_based_point_classifier::recognize_from_leaves(recognition_context * context, const int * leaves_index,
+                                                        keypoint * K, float * distribution) const
+{
   if (leaves_index == 0) {
+    if (distribution != nullptr)
+      for(int i = 0; i < number_of_classes; i++)
+        distribution[i] = 0.f;
     K->class_index = -1;
     K->class_score = -100000.f;
     return;
   }
 
+  if (sparse_top_k != 0) {
+    recognize_from_sparse_leaves(context, leaves_index, K, distribution);
+    return;
+  }
+  if (quantization_bits != 0) {
+    recognize_from_quantized_leaves(context, leaves_index, K, distribution);
+    return;
+  }
+  if (use_early_termination) {
+    recognize_from_leaves_with_early_termination(context, leaves_index, K, distribution);
+    return;
+  }
+
   const int nb_ferns = get_number_of_ferns_to_use();
+
+  if (distribution == nullptr) distribution = context->distribution;
+  for(int i = 0; i < number_of_classes; i++)
+    distribution[i] = 0.f;
+
   for(int i = 0; i < nb_ferns; i++) {
     float * ld = leaves_distributions + i * step2 + leaves_index[i] * step1;
     float * distrib = distribution;
@@ -432,33 +1735,140 @@ void fern_based_point_classifier::recognize(fine_gaussian_pyramid * pyramid, key
     }
 }
 
-int fern_based_point_classifier::recognize(fine_gaussian_pyramid * pyramid, int u, int v, int level)
+void fern_based_point_classifier::recognize_from_leaves_with_early_termination(recognition_context * context,
+                                                                               const int * leaves_index,
+                                                                               keypoint * K, float * distribution) const
 {
-  int * leaves_index = Ferns->drop(pyramid, u, v, level);
-
-  if (leaves_index == 0) return -1;
-
-  float * distribution = preallocated_distribution_for_a_keypoint;
+  const int nb_ferns = get_number_of_ferns_to_use();
 
+  if (distribution == nullptr) distribution = context->distribution;
   for(int i = 0; i < number_of_classes; i++)
     distribution[i] = 0.f;
 
-  const int nb_ferns = get_number_of_ferns_to_use();
   for(int i = 0; i < nb_ferns; i++) {
-    float * ld = leaves_distributions + i * step2 + leaves_index[i] * step1;
-    for(int j = 0; j < number_of_classes; j++)
+    const float * ld = leaves_distributions + i * step2 + leaves_index[i] * step1;
+    float best = distribution[0] + ld[0], second = -1e30f;
+    int best_class = 0;
+    distribution[0] = best;
+    for(int j = 1; j < number_of_classes; j++) {
       distribution[j] += ld[j];
+      if (distribution[j] > best) {
+        second = best;
+        best = distribution[j];
+        best_class = j;
+      } else if (distribution[j] > second)
+        second = distribution[j];
+    }
+
+    if (best < early_reject_scores[i]) {
+      K->class_index = -1;
+      K->class_score = -100000.f;
+      return;
+    }
+    if (i == nb_ferns - 1 || best - second >= early_accept_margins[i]) {
+      K->class_index = best_class;
+      K->class_score = best;
+      return;
+    }
+  }
+}
+
+void fern_based_point_classifier::recognize_from_quantized_leaves(recognition_context * context, const int * leaves_index,
+                                                                  keypoint * K, float * distribution) const
+{
+  const int nb_ferns = get_number_of_ferns_to_use();
+  short * qdistribution = context->quantized_distribution;
+  memset(qdistribution, 0, quantized_step1 * sizeof(short));
+
+  float offset = 0.f;
+  for(int i = 0; i < nb_ferns; i++) {
+    const int index = i * quantized_step2 + leaves_index[i] * quantized_step1;
+    if (quantization_bits == 8)
+      add_quantized_row(qdistribution, (const signed char *)quantized_leaves_distributions + index, quantized_step1);
+    else
+      add_quantized_row(qdistribution, (const short *)quantized_leaves_distributions + index, quantized_step1);
+    offset += fern_offsets[i];
   }
 
   int class_index = 0;
-  float class_score = distribution[0];
-  for(int i = 0; i < number_of_classes; i++)
-    if (distribution[i] > class_score) {
+  for(int i = 1; i < number_of_classes; i++)
+    if (qdistribution[i] > qdistribution[class_index])
       class_index = i;
-      class_score = distribution[i];
+
+  K->class_index = class_index;
+  K->class_score = qdistribution[class_index] / quantization_scale + offset;
+  if (distribution != nullptr)
+    for(int i = 0; i < number_of_classes; i++)
+      distribution[i] = qdistribution[i] / quantization_scale + offset;
+}
+
+void fern_based_point_classifier::recognize_from_sparse_leaves(recognition_context * context, const int * leaves_index,
+                                                               keypoint * K, float * distribution) const
+{
+  const int nb_ferns = get_number_of_ferns_to_use();
+  float * sdistribution = context->sparse_distribution;
+  int * touched_classes = context->touched_classes;
+  bool * class_is_touched = context->class_is_touched;
+  int number_of_touched_classes = 0;
+
+  // The defaults are common to all the classes, the top-k entries are scattered:
+  float base = 0.f;
+  for(int i = 0; i < nb_ferns; i++) {
+    const int leaf = i * Ferns->number_of_leaves_per_fern + leaves_index[i];
+    const int * classes = sparse_classes + leaf * sparse_top_k;
+    const float * values = sparse_values + leaf * sparse_top_k;
+
+    base += sparse_defaults[leaf];
+    for(int k = 0; k < sparse_top_k; k++) {
+      const int c = classes[k];
+      if (!class_is_touched[c]) {
+        class_is_touched[c] = true;
+        touched_classes[number_of_touched_classes++] = c;
+      }
+      sdistribution[c] += values[k];
     }
+  }
+
+  // An untouched class scores base, it wins if all the touched classes are below it:
+  int class_index = -1;
+  float best_value = 0.f;
+  for(int t = 0; t < number_of_touched_classes; t++) {
+    const int c = touched_classes[t];
+    if (class_index < 0 || sdistribution[c] > best_value || (sdistribution[c] == best_value && c < class_index)) {
+      class_index = c;
+      best_value = sdistribution[c];
+    }
+  }
+  if (best_value < 0.f && number_of_touched_classes < number_of_classes) {
+    class_index = 0;
+    while (class_is_touched[class_index]) class_index++;
+    best_value = 0.f;
+  }
+
+  K->class_index = class_index;
+  K->class_score = base + best_value;
+
+  if (distribution != nullptr)
+    for(int i = 0; i < number_of_classes; i++)
+      distribution[i] = base + sdistribution[i];
+
+  for(int t = 0; t < number_of_touched_classes; t++) {
+    sdistribution[touched_classes[t]] = 0.f;
+    class_is_touched[touched_classes[t]] = false;
+  }
+}
+
+int fern_based_point_classifier::recognize(recognition_context * context,
+                                           fine_gaussian_pyramid * pyramid, int u, int v, int level) const
+{
+  int * leaves_index = Ferns->drop(context->drop_context, pyramid, u, v, level);
+
+  if (leaves_index == 0) return -1;
+
+  keypoint K;
+  recognize_from_leaves(context, leaves_index, &K, context->distribution);
 
-  return class_index;
+  return K.class_index;
 }
 
 void fern_based_point_classifier::set_number_of_ferns_to_use(int _number_of_ferns_to_use)
@@ -466,7 +1876,7 @@ void fern_based_point_classifier::set_number_of_ferns_to_use(int _number_of_fern
   number_of_ferns_to_use = _number_of_ferns_to_use;
 }
 
-int  fern_based_point_classifier::get_number_of_ferns_to_use(void)
+int  fern_based_point_classifier::get_number_of_ferns_to_use(void) const
 {
   if (number_of_ferns_to_use < 1)
     return Ferns->number_of_ferns;
@@ -33,8 +33,14 @@ using namespace std;
 class fern_based_point_classifier
 {
  public:
-  fern_based_point_classifier(char * filename);
-  fern_based_point_classifier(istream & f);
+  //! If inference_only is true, the leaves counters are never kept in memory: they are
+  //! decompressed and converted to distributions fern by fern. The classifier can then
+  //! recognize points but can no longer be trained or saved (except in the frozen format).
+  //! Files saved in the frozen format contain the distributions only and are always loaded that way.
+  fern_based_point_classifier(char * filename, bool inference_only = false);
+  fern_based_point_classifier(istream & f, bool inference_only = false);
+  //! Mapped format: see map().
+  fern_based_point_classifier(const char * mapped_data, size_t mapped_size);
   bool correctly_read;
 
   fern_based_point_classifier(int number_of_classes,
@@ -47,26 +53,82 @@ class fern_based_point_classifier
 
   bool save(char * filename);
   bool save(ostream & f);
+  //! Frozen format: stores the final leaves distributions instead of the counters.
+  bool save_frozen(char * filename);
+  bool save_frozen(ostream & f);
+  //! Mapped format: a binary section, versioned and aligned on mapped_alignment bytes, with the
+  //! final leaves distributions. map() uses the distributions in place, without parsing nor copy,
+  //! so that processes mapping the same file share its pages: the data must stay mapped as long
+  //! as the classifier is used, and the classifier can only recognize points (or be quantized or
+  //! sparsified). The file must be read on a machine with the same endianness.
+  //! The section must start at an offset multiple of mapped_alignment in the file.
+  static const int mapped_alignment = 64;
+  bool save_mapped(ostream & f);
+  bool map(const char * mapped_data, size_t mapped_size);
 
   //! Call this function BEFORE CALLING the train function.
   void reset_leaves_distributions(int prior_number = 1);
 
   //! You can call this function with different images.
   //! The KEYPOINT CLASSES must be given by the class_index field of the keypoint class.
+  //! If number_of_threads != 1 (0 for one thread per core), the images are generated in parallel,
+  //! each thread with its own copy of image_generator and its own pyramid. Image i is generated
+  //! from the random seed seed + i: the result only depends on seed, not on the number of threads.
+  //! With number_of_threads = 1, the images are generated with rand(), in sequence.
   void train(keypoint * keypoints, int number_of_keypoints,
              int number_of_octaves, int yape_radius,
              int number_of_generated_images,
-             affine_image_generator06 * image_generator);
+             affine_image_generator06 * image_generator,
+             int number_of_threads = 1, unsigned int seed = 0);
 
   //! YOU MUST CALL finalize_training() AFTER CALLING train().
   //! IT COMPUTES THE POSTERIOR PROBAS FROM THE NUMBER OF SAMPLES:
   void finalize_training(void);
 
+  //! Incremental training, after finalize_training() or load(): the samples are added to the
+  //! counters and only the touched leaves and the classes of the samples are marked as dirty.
+  //! refresh_leaves_distributions() then recomputes the dirty leaves (all their classes) and the
+  //! dirty classes (in all the leaves). The part of a distribution that depends on the class is
+  //! then exact; the normalization of a leaf, shared by all its classes, is only updated when the
+  //! leaf is touched (finalize_training() updates everything).
+  //! The keypoints must be given in pyramid coordinates, with their class_index.
+  void add_samples(fine_gaussian_pyramid * pyramid, keypoint * keypoints, int number_of_keypoints);
+  void add_sample(const int * leaves_index, int class_index);
+  //! Refreshes about maximum_number_of_entries entries of leaves_distributions (-1: no limit;
+  //! at least one leaf or class is refreshed at each call), and returns the number of dirty leaves
+  //! and classes left. leaves_distributions is modified in place: call it between two recognitions,
+  //! not at the same time as recognize() or add_samples().
+  //! The quantized and sparse tables are not updated.
+  int refresh_leaves_distributions(int maximum_number_of_entries = -1);
+  //! Same as refresh_leaves_distributions(), but in a second buffer that recognize() does not read,
+  //! so that it can run in a background thread while points are recognized (but not at the same
+  //! time as add_samples()). publish_leaves_distributions() then makes this buffer the current one:
+  //! call it from the recognition thread, between two recognitions, once the refresh is done.
+  //! The first refresh after a publication copies the whole table into the second buffer.
+  int refresh_leaves_distributions_in_background(int maximum_number_of_entries = -1);
+  void publish_leaves_distributions(void);
+
+  //! If early_termination_loss_rate >= 0, the bounds of the early termination are also
+  //! calibrated on the test samples (see set_early_termination()).
   float test(keypoint * keypoints, int number_of_keypoints,
              int number_of_octaves, int yape_radius,
              int number_of_generated_images,
-             affine_image_generator06 * image_generator);
+             affine_image_generator06 * image_generator,
+             float early_termination_loss_rate = -1.f);
+
+  //! Early termination: the ferns are summed in order, and the recognition stops after
+  //! fern i if the margin between the two best classes reaches early_accept_margins[i]
+  //! (the best class is returned with its partial score and distribution), or if the best partial
+  //! score is below early_reject_scores[i] (the point is rejected, class_index = -1).
+  //! The bounds are calibrated by test() so that each bound changes the final result of at most
+  //! a fraction loss_rate / (2 * number of ferns) of the test samples.
+  //! Only used by the dense float recognition, and saved with the classifier.
+  void set_early_termination(bool use_early_termination);
+  void calibrate_early_termination(const float * partial_best_scores, const float * partial_margins,
+                                   const int * partial_classes, const int * final_classes, const char * correct,
+                                   int number_of_samples, float loss_rate);
 
+  //! The recognize functions without context use default_context and are NOT reentrant.
   int recognize(fine_gaussian_pyramid * pyramid, int u, int v, int level);
   void recognize(fine_gaussian_pyramid * pyramid, keypoint * keypoints, int number_of_keypoints);
   void recognize(fine_gaussian_pyramid * pyramid, keypoint * keypoints, int number_of_keypoints, float * distributions);
@@ -74,24 +136,136 @@ class fern_based_point_classifier
   float * recognize_with_distribution(fine_gaussian_pyramid * pyramid, keypoint * K);
   void recognize(fine_gaussian_pyramid * pyramid, keypoint * K, float * distribution);
 
+  //! Scratch state of the recognize functions. The recognize functions taking a context do not
+  //! modify the classifier: several threads can share the same classifier, each thread with its
+  //! own context (create it with new recognition_context(classifier)).
+  class recognition_context;
+
+  int recognize(recognition_context * context, fine_gaussian_pyramid * pyramid, int u, int v, int level) const;
+  void recognize(recognition_context * context, fine_gaussian_pyramid * pyramid, keypoint * keypoints, int number_of_keypoints) const;
+  void recognize(recognition_context * context, fine_gaussian_pyramid * pyramid,
+                 keypoint * keypoints, int number_of_keypoints, float * distributions) const;
+  void recognize(recognition_context * context, fine_gaussian_pyramid * pyramid, keypoint * K, float * distribution) const;
+  //! distribution can be null if it is not needed by the caller.
+  void recognize_from_leaves(recognition_context * context, const int * leaves_index, keypoint * K, float * distribution) const;
+
+  //! Quantized recognition: the log-posteriors of each fern are shifted by fern_offsets[fern] and
+  //! scaled by quantization_scale, the same for all the ferns so that they can be summed directly,
+  //! then stored as 8 or 16 bit integers and accumulated with saturated 16 bit additions.
+  //! The score of the recognized class (and the distribution) is dequantized.
+  //! If release_float_distributions is true, leaves_distributions AND leaves_counters are freed:
+  //! the classifier can then no longer be trained or saved.
+  void quantize_leaves_distributions(int number_of_bits, bool release_float_distributions = false);
+
+  //! Sparse recognition: each leaf keeps only its top_k classes, the log-posterior of the other
+  //! classes is replaced by their mean (the default of the leaf). Recognition then costs O(top_k)
+  //! per fern instead of O(number of classes). release_float_distributions: as above.
+  void sparsify_leaves_distributions(int top_k, bool release_float_distributions = false);
+
   //! Used for graph generations:
   void set_number_of_ferns_to_use(int number_of_ferns_to_use);
-  int  get_number_of_ferns_to_use(void);
+  int  get_number_of_ferns_to_use(void) const;
 
   //private:
-  void load(istream & f);
+  void train_in_parallel(keypoint * keypoints, int number_of_keypoints,
+                         int number_of_octaves, int yape_radius,
+                         int number_of_generated_images,
+                         affine_image_generator06 * image_generator,
+                         int number_of_threads, unsigned int seed);
+  void recognize_from_quantized_leaves(recognition_context * context, const int * leaves_index,
+                                       keypoint * K, float * distribution) const;
+  void recognize_from_sparse_leaves(recognition_context * context, const int * leaves_index,
+                                    keypoint * K, float * distribution) const;
+  void release_leaves_distributions(void);
+  //! Dense recognition of the dropped keypoints of the context, fern by fern over tiles of
+  //! keypoints so that the rows of a fern are reused while they are in cache.
+  //! distributions can be null. Same results as recognize_from_leaves().
+  void recognize_fern_major(recognition_context * context, keypoint * keypoints, int number_of_keypoints,
+                            float * distributions) const;
+  void recognize_from_leaves_with_early_termination(recognition_context * context, const int * leaves_index,
+                                                    keypoint * K, float * distribution) const;
+  void load_early_termination(istream & f);
+  void save_early_termination(ostream & f);
+  void load(istream & f, bool inference_only = false);
+  bool load_counters_by_fern(istream & f, int size_of_compressed_buffer, bool int_counters);
+  void finalize_fern(int fern_index, const int * counters_of_fern);
+  void init_incremental_training(void);
+  void release_incremental_training(void);
+  int refresh_leaves_distributions(float * distributions, int maximum_number_of_entries);
+  void refresh_leaf(float * distributions, int fern_index, int leaf_index);
+  void refresh_class(float * distributions, int class_index);
+
+  //! Drops the keypoints in the ferns, level by level with the batched drop of the ferns.
+  //! Results are stored in the batch_* buffers of the context, in order of level.
+  void drop(recognition_context * context, fine_gaussian_pyramid * pyramid, keypoint * keypoints, int number_of_keypoints) const;
 
   ferns * Ferns;
 
   int number_of_classes;
-  short * leaves_counters;
+  int * leaves_counters;
   float * leaves_distributions;
+  bool leaves_distributions_are_mapped; // then leaves_distributions is not owned by the classifier.
   int step1, step2;
   int * number_of_samples_for_class;
   int prior_number;
   int number_of_ferns_to_use;
 
-  float * preallocated_distribution_for_a_keypoint;
+  int quantization_bits; // 0 if the leaves distributions are not quantized, 8 or 16 otherwise.
+  char * quantized_leaves_distributions;
+  int quantized_step1, quantized_step2;
+  float quantization_scale;
+  float * fern_offsets;
+
+  int sparse_top_k; // 0 if the leaves distributions are not sparse.
+  int * sparse_classes;       // [fern][leaf][top_k]
+  float * sparse_values;      // [fern][leaf][top_k], log-posterior minus the default of the leaf.
+  float * sparse_defaults;    // [fern][leaf]
+
+  // Incremental training, allocated by the first add_sample():
+  int * class_counters_for_fern;  // [fern][class], sum of the counters of the class over the leaves of the fern
+  float * leaf_normalizations;    // [fern][leaf], log(samples of the leaf / samples of the fern)
+  bool * leaf_is_dirty, * fern_is_dirty, * class_is_dirty;
+  int * dirty_leaves, * dirty_classes;
+  int number_of_dirty_leaves, number_of_dirty_classes;
+  // Second buffer of refresh_leaves_distributions_in_background(). It is stale when it does not hold
+  // the current distributions, and ready when it holds refreshes that are not published yet:
+  float * background_leaves_distributions;
+  bool background_leaves_distributions_are_stale, background_leaves_distributions_are_ready;
+
+  bool use_early_termination;
+  int early_termination_steps; // 0 if not calibrated, the number of ferns otherwise.
+  float * early_accept_margins, * early_reject_scores;
+
+  recognition_context * default_context;
+};
+
+class fern_based_point_classifier::recognition_context
+{
+ public:
+  recognition_context(const fern_based_point_classifier * classifier);
+  ~recognition_context();
+
+  void manage_batch_buffers(int number_of_keypoints);
+
+  ferns::drop_context * drop_context;
+  int number_of_ferns;
+
+  float * distribution;
+  short * quantized_distribution;
+
+  // For the sparse recognition: the classes touched by the top-k entries of the ferns
+  // and the sums of their entries. sparse_distribution is null for the other classes.
+  float * sparse_distribution;
+  int * touched_classes;
+  bool * class_is_touched;
+
+  int batch_size;
+  int * batch_keypoint_index, * batch_level, * batch_x, * batch_y, * batch_leaves_index;
+  bool * batch_dropped;
+
+  // Scores of a tile of keypoints for recognize_fern_major(), [keypoint][class]:
+  int tile_size;
+  float * tile_distributions;
 };
 
 #endif
@@ -22,6 +22,11 @@
 */
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <cstring>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #include "logger.h"
 #include "ferns.h"
@@ -35,10 +40,6 @@ ferns::ferns(int number_of_ferns, int number_of_tests_per_fern,
 {
   alloc(number_of_ferns, number_of_tests_per_fern);
   pick_random_tests(dx_min, dx_max, dy_min, dy_max, ds_min, ds_max);
-
-  width_full_images = height_full_images = -1;
-  for(int i = 0; i < maximum_number_of_octaves; i++)
-    width_aztec_pyramid[i] = height_aztec_pyramid[i] = -1;
 }
 
 ferns::ferns(char * filename)
@@ -61,6 +62,20 @@ ferns::ferns(istream & f)
   load(f);
 }
 
+ferns::ferns(int number_of_ferns, int number_of_tests_per_fern, const int * tests)
+{
+  alloc(number_of_ferns, number_of_tests_per_fern);
+
+  const int nb_tests = number_of_ferns * number_of_tests_per_fern;
+  memcpy(DX1, tests,                nb_tests * sizeof(int));
+  memcpy(DY1, tests + nb_tests,     nb_tests * sizeof(int));
+  memcpy(DX2, tests + 2 * nb_tests, nb_tests * sizeof(int));
+  memcpy(DY2, tests + 3 * nb_tests, nb_tests * sizeof(int));
+
+  compute_max_d();
+  correctly_read = true;
+}
+
 void ferns::load(istream & f)
 {
   int nf, nt;
@@ -75,18 +90,14 @@ void ferns::load(istream & f)
 
   f.read((char*)DX1, number_of_ferns * number_of_tests_per_fern * sizeof(int));
   f.read((char*)DY1, number_of_ferns * number_of_tests_per_fern * sizeof(int));
-  f.read((char*)DS1, number_of_ferns * number_of_tests_per_fern * sizeof(int));
+  f.ignore(number_of_ferns * number_of_tests_per_fern * sizeof(int)); // DS1
 
   f.read((char*)DX2, number_of_ferns * number_of_tests_per_fern * sizeof(int));
   f.read((char*)DY2, number_of_ferns * number_of_tests_per_fern * sizeof(int));
-  f.read((char*)DS2, number_of_ferns * number_of_tests_per_fern * sizeof(int));
+  f.ignore(number_of_ferns * number_of_tests_per_fern * sizeof(int)); // DS2
 
   compute_max_d();
   correctly_read = true;
-
-  width_full_images = height_full_images = -1;
-  for(int i = 0; i < maximum_number_of_octaves; i++)
-    width_aztec_pyramid[i] = height_aztec_pyramid[i] = -1;
 }
 
 bool ferns::save(char * filename)
@@ -112,35 +123,56 @@ bool ferns::save(ostream & f)
 
   char dot('.'); f.write(&dot, 1);
 
+  int * DS = new int[number_of_ferns * number_of_tests_per_fern];
+  memset(DS, 0, number_of_ferns * number_of_tests_per_fern * sizeof(int));
+
   f.write((char*)DX1, number_of_ferns * number_of_tests_per_fern * sizeof(int));
   f.write((char*)DY1, number_of_ferns * number_of_tests_per_fern * sizeof(int));
-  f.write((char*)DS1, number_of_ferns * number_of_tests_per_fern * sizeof(int));
+  f.write((char*)DS,  number_of_ferns * number_of_tests_per_fern * sizeof(int));
 
   f.write((char*)DX2, number_of_ferns * number_of_tests_per_fern * sizeof(int));
   f.write((char*)DY2, number_of_ferns * number_of_tests_per_fern * sizeof(int));
-  f.write((char*)DS2, number_of_ferns * number_of_tests_per_fern * sizeof(int));
+  f.write((char*)DS,  number_of_ferns * number_of_tests_per_fern * sizeof(int));
+
+  delete [] DS;
 
   return true;
 }
 
 bool ferns::drop(fine_gaussian_pyramid * pyramid, int x, int y, int level, int * leaves_index)
+{
+  return drop(default_context, pyramid, x, y, level, leaves_index);
+}
+
+int * ferns::drop(fine_gaussian_pyramid * pyramid, int x, int y, int level)
+{
+  return drop(default_context, pyramid, x, y, level);
+}
+
+int ferns::drop(fine_gaussian_pyramid * pyramid, const int * x, const int * y, int number_of_points, int level,
+                int * leaves_index, bool * dropped)
+{
+  return drop(default_context, pyramid, x, y, number_of_points, level, leaves_index, dropped);
+}
+
+bool ferns::drop(drop_context * context, fine_gaussian_pyramid * pyramid, int x, int y, int level, int * leaves_index) const
 {
 #if pyr_debug
   if (pyramid->type == fine_gaussian_pyramid::full_pyramid_357)
-    return drop_full_images(pyramid, x, y, level, leaves_index);
+    return drop_full_images(context, pyramid, x, y, level, leaves_index);
   else
 #endif
-    return drop_aztec_pyramid(pyramid, x, y, level, leaves_index);
+    return drop_aztec_pyramid(context, pyramid, x, y, level, leaves_index);
 }
 
 #if pyr_debug
-bool ferns::drop_full_images(fine_gaussian_pyramid * pyramid, int x, int y, int level, int * leaves_index)
+bool ferns::drop_full_images(drop_context * context, fine_gaussian_pyramid * pyramid, int x, int y, int level, int * leaves_index) const
 {
-  if (pyramid->full_images[level]->width  != width_full_images ||
-      pyramid->full_images[level]->height != height_full_images) {
-    precompute_D_array(D_full_images, pyramid->full_images[level]);
-    width_full_images  = pyramid->full_images[level]->width;
-    height_full_images = pyramid->full_images[level]->height;
+  if (pyramid->full_images[level]->width  != context->width_full_images ||
+      pyramid->full_images[level]->height != context->height_full_images) {
+    precompute_D_array(context->D_full_images, pyramid->full_images[level]);
+    context->width_full_images  = pyramid->full_images[level]->width;
+    context->height_full_images = pyramid->full_images[level]->height;
   }
 
   IplImage * smoothed_image = pyramid->full_images[level];
@@ -156,7 +188,7 @@ bool ferns::drop_full_images(fine_gaussian_pyramid * pyramid, int x, int y, int
 
   for(int i = 0; i < number_of_ferns; i++) {
     int index = 0;
-    int * D_ptr = D_full_images + i * 2 * number_of_tests_per_fern;
+    int * D_ptr = context->D_full_images + i * 2 * number_of_tests_per_fern;
     for(int j = 0; j < number_of_tests_per_fern; j++) {
       if (*(C + *D_ptr) < *(C + D_ptr[1])) index++;
       D_ptr += 2;
@@ -169,45 +201,246 @@ bool ferns::drop_full_images(fine_gaussian_pyramid * pyramid, int x, int y, int
 }
 #endif
 
-bool ferns::drop_aztec_pyramid(fine_gaussian_pyramid * pyramid, int x, int y, int level, int * leaves_index)
+const void * ferns::update_packed_tests(drop_context * context, int octave, int widthStep) const
 {
-  int octave = level / 4; // 4 -> should not be hardcoded -> should be static const in fine_gaussian_pyramid !!!
-  if (pyramid->aztec_pyramid[level]->width  != width_aztec_pyramid[octave] ||
-      pyramid->aztec_pyramid[level]->height != height_aztec_pyramid[octave]) {
-    precompute_D_array(D_aztec_pyramid[octave], pyramid->aztec_pyramid[level]);
-    width_aztec_pyramid[octave]  = pyramid->aztec_pyramid[level]->width;
-    height_aztec_pyramid[octave] = pyramid->aztec_pyramid[level]->height;
+  if (widthStep != context->widthStep_of_packed_tests[octave]) {
+    context->packed_tests_are_shorts[octave] = (max_d * (widthStep + 1) <= 32767);
+    pack_tests(context->packed_tests[octave], context->packed_tests_are_shorts[octave], widthStep);
+    context->widthStep_of_packed_tests[octave] = widthStep;
+  }
+
+  return context->packed_tests[octave];
+}
+
+// Drop kernels.
+// Batched kernels evaluate the tests for several points at once, one SIMD lane per point.
+// For each test, the two pixels are gathered for all the lanes and compared, the comparison
+// mask (-1 or 0) is then shifted into the leaf indices: index = 2 * index - mask.
+//
+// TESTS > 0: kernel specialized for ferns with TESTS tests, the loop on the tests is fully unrolled.
+// TESTS = 0: generic kernel, the number of tests per fern is read at runtime.
+// T: type of the packed tests offsets (short or int).
+//
+// The AVX2 kernels are compiled with the target attribute and only called if the CPU supports AVX2:
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define FERNS_RUNTIME_AVX2 1
+#define FERNS_AVX2 __attribute__((target("avx2")))
+#endif
+
+#if FERNS_RUNTIME_AVX2
+template <int TESTS, typename T>
+FERNS_AVX2
+static void drop_8_points(const unsigned char * image, const int * offsets, const void * packed_tests,
+                          int number_of_ferns, int number_of_tests_per_fern, int * leaves_index)
+{
+  const int nt = TESTS > 0 ? TESTS : number_of_tests_per_fern;
+  const T * D = (const T *)packed_tests;
+  const __m256i C = _mm256_loadu_si256((const __m256i *)offsets);
+  const __m256i mask_ff = _mm256_set1_epi32(0xff);
+  alignas(32) int index[8];
+
+  for(int i = 0; i < number_of_ferns; i++) {
+    __m256i I = _mm256_setzero_si256();
+#pragma GCC unroll 16
+    for(int j = 0; j < nt; j++) {
+      __m256i p1 = _mm256_i32gather_epi32((const int *)image, _mm256_add_epi32(C, _mm256_set1_epi32(D[2 * j])), 1);
+      __m256i p2 = _mm256_i32gather_epi32((const int *)image, _mm256_add_epi32(C, _mm256_set1_epi32(D[2 * j + 1])), 1);
+      __m256i lt = _mm256_cmpgt_epi32(_mm256_and_si256(p2, mask_ff), _mm256_and_si256(p1, mask_ff));
+      I = _mm256_sub_epi32(_mm256_slli_epi32(I, 1), lt);
+    }
+    D += 2 * nt;
+    _mm256_store_si256((__m256i *)index, I);
+    for(int k = 0; k < 8; k++)
+      leaves_index[k * number_of_ferns + i] = index[k];
+  }
+}
+#endif
+
+#if defined(__SSE2__)
+template <int TESTS, typename T>
+static void drop_4_points(const unsigned char * image, const int * offsets, const void * packed_tests,
+                          int number_of_ferns, int number_of_tests_per_fern, int * leaves_index)
+{
+  const int nt = TESTS > 0 ? TESTS : number_of_tests_per_fern;
+  const T * D = (const T *)packed_tests;
+  const unsigned char * C0 = image + offsets[0], * C1 = image + offsets[1];
+  const unsigned char * C2 = image + offsets[2], * C3 = image + offsets[3];
+  alignas(16) int index[4];
+
+  for(int i = 0; i < number_of_ferns; i++) {
+    __m128i I = _mm_setzero_si128();
+#pragma GCC unroll 16
+    for(int j = 0; j < nt; j++) {
+      const int d1 = D[2 * j], d2 = D[2 * j + 1];
+      __m128i p1 = _mm_setr_epi32(C0[d1], C1[d1], C2[d1], C3[d1]);
+      __m128i p2 = _mm_setr_epi32(C0[d2], C1[d2], C2[d2], C3[d2]);
+      I = _mm_sub_epi32(_mm_slli_epi32(I, 1), _mm_cmplt_epi32(p1, p2));
+    }
+    D += 2 * nt;
+    _mm_store_si128((__m128i *)index, I);
+    for(int k = 0; k < 4; k++)
+      leaves_index[k * number_of_ferns + i] = index[k];
+  }
+}
+#endif
+
+template <int TESTS, typename T>
+static void drop_1_point(const unsigned char * image, const int * offsets, const void * packed_tests,
+                         int number_of_ferns, int number_of_tests_per_fern, int * leaves_index)
+{
+  const int nt = TESTS > 0 ? TESTS : number_of_tests_per_fern;
+  const T * D = (const T *)packed_tests;
+  const unsigned char * C = image + offsets[0];
+
+  for(int i = 0; i < number_of_ferns; i++) {
+    int index = 0;
+#pragma GCC unroll 16
+    for(int j = 0; j < nt; j++)
+      index = (index << 1) | int(C[D[2 * j]] < C[D[2 * j + 1]]);
+    D += 2 * nt;
+    leaves_index[i] = index;
+  }
+}
+
+template <int TESTS, typename T>
+static void set_drop_kernels(ferns::drop_kernels & kernels)
+{
+  kernels.drop_1_point  = drop_1_point<TESTS, T>;
+  kernels.drop_4_points = nullptr;
+  kernels.drop_8_points = nullptr;
+#if defined(__SSE2__)
+  kernels.drop_4_points = drop_4_points<TESTS, T>;
+#endif
+#if FERNS_RUNTIME_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    kernels.drop_8_points = drop_8_points<TESTS, T>;
+#endif
+}
+
+template <int TESTS>
+static void set_drop_kernels(ferns * F)
+{
+  set_drop_kernels<TESTS, short>(F->short_tests_kernels);
+  set_drop_kernels<TESTS, int>(F->int_tests_kernels);
+}
+
+void ferns::select_drop_kernels(void)
+{
+  switch(number_of_tests_per_fern) {
+  case  8: set_drop_kernels< 8>(this); break;
+  case  9: set_drop_kernels< 9>(this); break;
+  case 10: set_drop_kernels<10>(this); break;
+  case 11: set_drop_kernels<11>(this); break;
+  case 12: set_drop_kernels<12>(this); break;
+  case 13: set_drop_kernels<13>(this); break;
+  case 14: set_drop_kernels<14>(this); break;
+  default:
+    log_verb << "[ferns::select_drop_kernels]"
+             << "no kernel specialized for " << number_of_tests_per_fern << " tests per fern." << endl;
+    set_drop_kernels<0>(this);
   }
+}
 
+bool ferns::drop_aztec_pyramid(drop_context * context, fine_gaussian_pyramid * pyramid, int x, int y, int level, int * leaves_index) const
+{
+  int octave = level / 4; // 4 -> should not be hardcoded -> should be static const in fine_gaussian_pyramid !!!
   IplImage * smoothed_image = pyramid->aztec_pyramid[level];
+  const void * tests = update_packed_tests(context, octave, smoothed_image->widthStep);
+  const drop_kernels & kernels = context->packed_tests_are_shorts[octave] ? short_tests_kernels : int_tests_kernels;
+
   int shift_x = x + (pyramid->border_size >> octave);
   int shift_y = y + (pyramid->border_size >> octave);
 
   if (shift_x < max_d || shift_y < max_d || shift_x >= smoothed_image->width - max_d  || shift_y >= smoothed_image->height - max_d)
     return false;
 
-  unsigned char * C = (unsigned char *)(smoothed_image->imageData +
-                                        shift_y * smoothed_image->widthStep +
-                                        shift_x);
+  const int offset = shift_y * smoothed_image->widthStep + shift_x;
+  kernels.drop_1_point((const unsigned char *)smoothed_image->imageData, &offset, tests,
+                       number_of_ferns, number_of_tests_per_fern, leaves_index);
 
-  for(int i = 0; i < number_of_ferns; i++) {
-    int index = 0;
-    int * D_ptr = D_aztec_pyramid[octave] + i * 2 * number_of_tests_per_fern;
-    for(int j = 0; j < number_of_tests_per_fern; j++) {
-      index <<= 1;
-      if (*(C + *D_ptr) < *(C + D_ptr[1])) index++;
-      D_ptr += 2;
+  return true;
+}
+
+int ferns::drop_aztec_pyramid(drop_context * context, fine_gaussian_pyramid * pyramid, const int * x, const int * y, int number_of_points, int level,
+                              int * leaves_index, bool * dropped) const
+{
+  int octave = level / 4;
+  IplImage * smoothed_image = pyramid->aztec_pyramid[level];
+  const void * tests = update_packed_tests(context, octave, smoothed_image->widthStep);
+  const drop_kernels & kernels = context->packed_tests_are_shorts[octave] ? short_tests_kernels : int_tests_kernels;
+
+  const unsigned char * image = (const unsigned char *)smoothed_image->imageData;
+  const int border = pyramid->border_size >> octave;
+
+  if (context->offsets_size < number_of_points) {
+    if (context->offsets) delete [] context->offsets;
+    context->offsets = new int[number_of_points];
+    context->offsets_size = number_of_points;
+  }
+  int * offsets = context->offsets;
+
+  int number_of_dropped_points = 0;
+  for(int k = 0; k < number_of_points; k++) {
+    int shift_x = x[k] + border;
+    int shift_y = y[k] + border;
+
+    dropped[k] = !(shift_x < max_d || shift_y < max_d ||
+                   shift_x >= smoothed_image->width - max_d  || shift_y >= smoothed_image->height - max_d);
+    if (!dropped[k]) continue;
+
+    offsets[number_of_dropped_points++] = shift_y * smoothed_image->widthStep + shift_x;
+  }
+
+  // The dropped points are packed in offsets, their leaves indices are computed at the
+  // end of leaves_index, then moved at their place:
+  int * L = leaves_index + (number_of_points - number_of_dropped_points) * number_of_ferns;
+  int k = 0;
+  // The gathers read 4 bytes per pixel: blocks with a point whose tests could read past the end
+  // of the image are left to the SSE2 code.
+  if (kernels.drop_8_points) {
+    const int last_gather_offset = smoothed_image->imageSize - 4 - max_d * (smoothed_image->widthStep + 1);
+    for(; k + 8 <= number_of_dropped_points; k += 8) {
+      if (*max_element(offsets + k, offsets + k + 8) > last_gather_offset) break;
+      kernels.drop_8_points(image, offsets + k, tests, number_of_ferns, number_of_tests_per_fern, L + k * number_of_ferns);
     }
-    leaves_index[i] = index;
   }
+#if defined(__SSE2__)
+  for(; k + 4 <= number_of_dropped_points; k += 4)
+    kernels.drop_4_points(image, offsets + k, tests, number_of_ferns, number_of_tests_per_fern, L + k * number_of_ferns);
+#endif
+  for(; k < number_of_dropped_points; k++)
+    kernels.drop_1_point(image, offsets + k, tests, number_of_ferns, number_of_tests_per_fern, L + k * number_of_ferns);
+
+  int * dest = leaves_index;
+  for(int i = 0; i < number_of_points; i++, dest += number_of_ferns)
+    if (dropped[i]) {
+      if (dest != L) memmove(dest, L, number_of_ferns * sizeof(int));
+      L += number_of_ferns;
+    }
 
-  return true;
+  return number_of_dropped_points;
 }
 
-int * ferns::drop(fine_gaussian_pyramid * pyramid, int x, int y, int level)
+int ferns::drop(drop_context * context, fine_gaussian_pyramid * pyramid, const int * x, const int * y, int number_of_points, int level,
+                int * leaves_index, bool * dropped) const
 {
-  if (drop(pyramid, x, y, level, preallocated_leaves_index))
-    return preallocated_leaves_index;
+#if pyr_debug
+  if (pyramid->type == fine_gaussian_pyramid::full_pyramid_357) {
+    int number_of_dropped_points = 0;
+    for(int k = 0; k < number_of_points; k++) {
+      dropped[k] = drop_full_images(context, pyramid, x[k], y[k], level, leaves_index + k * number_of_ferns);
+      if (dropped[k]) number_of_dropped_points++;
+    }
+    return number_of_dropped_points;
+  } else
+#endif
+    return drop_aztec_pyramid(context, pyramid, x, y, number_of_points, level, leaves_index, dropped);
+}
+
+int * ferns::drop(drop_context * context, fine_gaussian_pyramid * pyramid, int x, int y, int level) const
+{
+  if (drop(context, pyramid, x, y, level, context->leaves_index))
+    return context->leaves_index;
   else
     return nullptr;
 }
@@ -218,37 +451,59 @@ void ferns::alloc(int number_of_ferns, int number_of_tests_per_fern)
   this->number_of_ferns = number_of_ferns;
   this->number_of_tests_per_fern = number_of_tests_per_fern;
   number_of_leaves_per_fern = 1 << number_of_tests_per_fern;
-  preallocated_leaves_index = new int [number_of_ferns];
+
+  select_drop_kernels();
 
   int nb_tests = number_of_ferns * number_of_tests_per_fern;
   DX1 = new int[nb_tests];
   DY1 = new int[nb_tests];
-  DS1 = new int[nb_tests];
 
   DX2 = new int[nb_tests];
   DY2 = new int[nb_tests];
-  DS2 = new int[nb_tests];
 
-  D_full_images = new int[2 * nb_tests];
-  for(int i = 0; i < maximum_number_of_octaves; i++)
-    D_aztec_pyramid[i] = new int[2 * nb_tests];
+  default_context = new drop_context(this);
 }
 
 ferns::~ferns(void)
 {
-  if (preallocated_leaves_index) delete [] preallocated_leaves_index;
+  if (default_context) delete default_context;
 
   if (DX1) delete [] DX1;
   if (DY1) delete [] DY1;
-  if (DS1) delete [] DS1;
 
   if (DX2) delete [] DX2;
   if (DY2) delete [] DY2;
-  if (DS2) delete [] DS2;
+}
+
+ferns::drop_context::drop_context(const ferns * Ferns)
+{
+  const int nb_tests = Ferns->number_of_ferns * Ferns->number_of_tests_per_fern;
+
+  leaves_index = new int[Ferns->number_of_ferns];
 
-  if (D_full_images) delete [] D_full_images;
-  for(int i = 0; i < maximum_number_of_octaves; i++)
-    if (D_aztec_pyramid[i]) delete [] D_aztec_pyramid[i];
+  offsets = nullptr;
+  offsets_size = 0;
+
+  // Room for the tests as ints, rounded to keep each table aligned:
+  packed_tests_size = (2 * nb_tests * sizeof(int) + packed_tests_alignment - 1) / packed_tests_alignment * packed_tests_alignment;
+  packed_tests_buffer = new char[maximum_number_of_octaves * packed_tests_size + packed_tests_alignment - 1];
+  char * aligned_buffer = packed_tests_buffer + (packed_tests_alignment - size_t(packed_tests_buffer) % packed_tests_alignment) % packed_tests_alignment;
+  for(int i = 0; i < maximum_number_of_octaves; i++) {
+    packed_tests[i] = aligned_buffer + i * packed_tests_size;
+    packed_tests_are_shorts[i] = false;
+    widthStep_of_packed_tests[i] = -1;
+  }
+
+  D_full_images = new int[2 * nb_tests];
+  width_full_images = height_full_images = -1;
+}
+
+ferns::drop_context::~drop_context()
+{
+  delete [] leaves_index;
+  if (offsets) delete [] offsets;
+  delete [] packed_tests_buffer;
+  delete [] D_full_images;
 }
 
 void ferns::pick_random_tests(int dx_min, int dx_max, int dy_min, int dy_max, int /*ds_min*/, int /*ds_max*/)
@@ -261,13 +516,12 @@ void ferns::pick_random_tests(int dx_min, int dx_max, int dy_min, int dy_max, in
       DY1[k] = dy_min + rand() % (dy_max - dy_min + 1);
       DX2[k] = dx_min + rand() % (dx_max - dx_min + 1);
       DY2[k] = dy_min + rand() % (dy_max - dy_min + 1);
-      DS1[k] = DS2[k] = 0;
     }
 
   compute_max_d();
 }
 
-void ferns::precompute_D_array(int * D, IplImage * image)
+void ferns::precompute_D_array(int * D, IplImage * image) const
 {
   for(int i = 0; i < number_of_ferns; i++)
     for(int j = 0; j < number_of_tests_per_fern; j++) {
@@ -277,6 +531,25 @@ void ferns::precompute_D_array(int * D, IplImage * image)
     }
 }
 
+void ferns::pack_tests(void * packed_tests, bool as_shorts, int widthStep) const
+{
+  const int nb_tests = number_of_ferns * number_of_tests_per_fern;
+
+  if (as_shorts) {
+    short * D = (short *)packed_tests;
+    for(int k = 0; k < nb_tests; k++) {
+      D[2 * k]     = short(DX1[k] + widthStep * DY1[k]);
+      D[2 * k + 1] = short(DX2[k] + widthStep * DY2[k]);
+    }
+  } else {
+    int * D = (int *)packed_tests;
+    for(int k = 0; k < nb_tests; k++) {
+      D[2 * k]     = DX1[k] + widthStep * DY1[k];
+      D[2 * k + 1] = DX2[k] + widthStep * DY2[k];
+    }
+  }
+}
+
 void ferns::compute_max_d(void)
 {
   max_d = 0;
@@ -39,6 +39,8 @@ class ferns
 
   ferns(char * filename);
   ferns(istream & f);
+  //! tests: DX1, DY1, DX2 and DY2, one after the other (see fern_based_point_classifier::map()).
+  ferns(int number_of_ferns, int number_of_tests_per_fern, const int * tests);
 
   ~ferns();
 
@@ -56,29 +58,84 @@ class ferns
   // Do NOT delete the returned pointer !!!
   int * drop(fine_gaussian_pyramid * pyramid, int x, int y, int level);
 
+  // Batched drop of number_of_points points (x[i], y[i]) taken on the same pyramid level.
+  // leaves_index must hold number_of_points * number_of_ferns ints and is filled point after point,
+  // dropped[i] tells if point i was far enough from the image border to be dropped.
+  // Returns the number of dropped points.
+  int drop(fine_gaussian_pyramid * pyramid, const int * x, const int * y, int number_of_points, int level,
+           int * leaves_index, bool * dropped);
+
+  // Scratch state of the drop functions (packed tests, work buffers).
+  // The drop functions taking a context do not modify the ferns: several threads can drop points
+  // in the same ferns at the same time, as long as each thread uses its own context.
+  // The drop functions without context use default_context and are NOT reentrant.
+  class drop_context;
+
+  bool drop(drop_context * context, fine_gaussian_pyramid * pyramid, int x, int y, int level, int * leaves_index) const;
+  // Returns context->leaves_index, or 0 if the point is too close to the border:
+  int * drop(drop_context * context, fine_gaussian_pyramid * pyramid, int x, int y, int level) const;
+  int drop(drop_context * context, fine_gaussian_pyramid * pyramid, const int * x, const int * y, int number_of_points, int level,
+           int * leaves_index, bool * dropped) const;
+
   // private:
   void load(istream & f);
   void alloc(int number_of_ferns, int number_of_tests_per_fern);
   void pick_random_tests(int dx_min, int dx_max, int dy_min, int dy_max, int ds_min, int ds_max);
-  void precompute_D_array(int * D, IplImage * image);
+  void precompute_D_array(int * D, IplImage * image) const;
 
 #if pyr_debug
-  bool drop_full_images(fine_gaussian_pyramid * pyramid, int x, int y, int level, int * leaves_index);
+  bool drop_full_images(drop_context * context, fine_gaussian_pyramid * pyramid, int x, int y, int level, int * leaves_index) const;
 #endif
-  bool drop_aztec_pyramid(fine_gaussian_pyramid * pyramid, int x, int y, int level, int * leaves_index);
-
-  int width_full_images, height_full_images;
-  int width_aztec_pyramid[maximum_number_of_octaves], height_aztec_pyramid[maximum_number_of_octaves];
+  bool drop_aztec_pyramid(drop_context * context, fine_gaussian_pyramid * pyramid, int x, int y, int level, int * leaves_index) const;
+  int drop_aztec_pyramid(drop_context * context, fine_gaussian_pyramid * pyramid, const int * x, const int * y, int number_of_points, int level,
+                         int * leaves_index, bool * dropped) const;
+  const void * update_packed_tests(drop_context * context, int octave, int widthStep) const;
+  void pack_tests(void * packed_tests, bool as_shorts, int widthStep) const;
 
+  // The ds of the tests are not kept at runtime, they are always 0 in the files.
   int number_of_ferns, number_of_tests_per_fern, number_of_leaves_per_fern;
-  int * DX1, * DY1, * DS1;
-  int * DX2, * DY2, * DS2;
-  int * D_full_images, * D_aztec_pyramid[maximum_number_of_octaves];
+  int * DX1, * DY1;
+  int * DX2, * DY2;
+
+  static const int packed_tests_alignment = 64;
 
   void compute_max_d(void);
   int max_d;
 
-  int * preallocated_leaves_index;
+  // Drop kernels, specialized for the number of tests per fern when possible (see select_drop_kernels()),
+  // one set for each type of packed tests:
+  typedef void (*drop_kernel)(const unsigned char * image, const int * offsets, const void * packed_tests,
+                              int number_of_ferns, int number_of_tests_per_fern, int * leaves_index);
+  struct drop_kernels { drop_kernel drop_1_point, drop_4_points, drop_8_points; };
+  void select_drop_kernels(void);
+  drop_kernels short_tests_kernels, int_tests_kernels;
+
+  drop_context * default_context;
+};
+
+class ferns::drop_context
+{
+ public:
+  drop_context(const ferns * Ferns);
+  ~drop_context();
+
+  int * leaves_index;
+
+  int * offsets;
+  int offsets_size;
+
+  // Packed tests, one 64-byte aligned table per octave: the pixel offset pairs of the tests of
+  // the first fern, then of the second fern, ... The offsets are relative to the tested point and
+  // are stored as shorts, or as ints when they do not fit (very wide images).
+  // A table is recomputed only when the widthStep of its octave changes.
+  char * packed_tests_buffer;
+  int packed_tests_size;
+  void * packed_tests[maximum_number_of_octaves];
+  bool packed_tests_are_shorts[maximum_number_of_octaves];
+  int widthStep_of_packed_tests[maximum_number_of_octaves];
+
+  int * D_full_images;
+  int width_full_images, height_full_images;
 };
 
 #endif
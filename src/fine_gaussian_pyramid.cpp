@@ -23,16 +23,31 @@
 #include <iostream>
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
 
 #include "logger.h"
 #include "mcv.h"
 #include "mcvGaussianSmoothing.h"
 #include "fine_gaussian_pyramid.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#else
+static int omp_get_max_threads(void) { return 1; }
+#endif
 // #include "linear_filter.h"
 
 using namespace std;
 using namespace plog;
 
+// Enough for the 7x7 smoothing, the pyrDown, the yape06 laplacian and the patches of the classifier:
+const int fine_gaussian_pyramid::Region_margin = 32;
+const int fine_gaussian_pyramid::Arena_alignment = 64;
+const int fine_gaussian_pyramid::Huge_page_size = 2 << 20;
+
 fine_gaussian_pyramid::fine_gaussian_pyramid(int type, int outer_border, int number_of_octaves, int inner_border)
 {
   this->type = type;
@@ -54,6 +69,14 @@ fine_gaussian_pyramid::fine_gaussian_pyramid(int type, int outer_border, int num
   add_a_col = nullptr;
 
   intermediate_int_image = nullptr;
+
+  region_is_set = region_is_used = false;
+  region_views[0] = region_views[1] = region_views[2] = nullptr;
+  level0_image = padded_level0 = nullptr;
+  number_of_threads = 0;
+  arena = arena_buffer = nullptr;
+  arena_size = 0;
+  huge_pages = false;
 }
 
 fine_gaussian_pyramid::fine_gaussian_pyramid(int type, IplImage * image, int outer_border, int number_of_octaves, int inner_border)
@@ -71,6 +94,14 @@ fine_gaussian_pyramid::fine_gaussian_pyramid(int type, IplImage * image, int out
 
   intermediate_int_image = nullptr;
 
+  region_is_set = region_is_used = false;
+  region_views[0] = region_views[1] = region_views[2] = nullptr;
+  level0_image = padded_level0 = nullptr;
+  number_of_threads = 0;
+  arena = arena_buffer = nullptr;
+  arena_size = 0;
+  huge_pages = false;
+
   alloc(image->width - 2 * inner_border, image->height - 2 * inner_border, outer_border, number_of_octaves, inner_border);
   set_image(image);
 }
@@ -90,6 +121,14 @@ fine_gaussian_pyramid::fine_gaussian_pyramid(int type, char * image_name, int ou
 
   intermediate_int_image = nullptr;
 
+  region_is_set = region_is_used = false;
+  region_views[0] = region_views[1] = region_views[2] = nullptr;
+  level0_image = padded_level0 = nullptr;
+  number_of_threads = 0;
+  arena = arena_buffer = nullptr;
+  arena_size = 0;
+  huge_pages = false;
+
   IplImage * image = mcvLoadImage(image_name, 0);
   alloc(image->width - 2 * inner_border, image->height - 2 * inner_border, outer_border, number_of_octaves, inner_border);
   set_image(image);
@@ -99,6 +138,7 @@ fine_gaussian_pyramid::fine_gaussian_pyramid(int type, char * image_name, int ou
 fine_gaussian_pyramid::~fine_gaussian_pyramid()
 {
   free();
+  if (arena_buffer) delete [] arena_buffer;
 }
 
 void fine_gaussian_pyramid::free(void)
@@ -109,9 +149,10 @@ void fine_gaussian_pyramid::free(void)
 #endif
 
   if (aztec_pyramid) {
+    aztec_pyramid[0] = level0_image;
     for(int i = 0; i < 4 * number_of_octaves; i++)
       if (aztec_pyramid[i] != 0)
-        cvReleaseImage(&aztec_pyramid[i]);
+        cvReleaseImageHeader(&aztec_pyramid[i]);
     delete [] aztec_pyramid;
     aztec_pyramid = nullptr;
   }
@@ -133,7 +174,12 @@ void fine_gaussian_pyramid::free(void)
   add_a_row = nullptr;
   add_a_col = nullptr;
 
-  if (intermediate_int_image) cvReleaseImage(&intermediate_int_image);
+  if (intermediate_int_image) cvReleaseImageHeader(&intermediate_int_image);
+
+  for(int i = 0; i < 3; i++)
+    if (region_views[i]) cvReleaseImageHeader(&region_views[i]);
+  if (padded_level0) cvReleaseImageHeader(&padded_level0);
+  level0_image = nullptr;
 }
 
 int fine_gaussian_pyramid::level_from_scale(float scale)
@@ -218,8 +264,10 @@ void fine_gaussian_pyramid::alloc(int width, int height, int outer_border, int n
 #if pyr_debug
   original_image = cvCreateImage(cvSize(width + 2 * inner_border, height + 2 * inner_border), IPL_DEPTH_8U, 1);
 #endif
-  intermediate_int_image = cvCreateImage(cvSize(total_width, total_height), IPL_DEPTH_32S, 1);
-  widthStep_int  = intermediate_int_image->widthStep / sizeof(int);
+  intermediate_int_image = cvCreateImageHeader(cvSize(total_width, total_height), IPL_DEPTH_32S, 1);
+
+  for(int i = 0; i < 3; i++)
+    region_views[i] = cvCreateImageHeader(cvSize(total_width, total_height), IPL_DEPTH_8U, 1);
 
   switch(type) {
   case yape_pyramid_3: {
@@ -237,7 +285,7 @@ void fine_gaussian_pyramid::alloc(int width, int height, int outer_border, int n
       }
 
       if (i % 4 == 1)
-        aztec_pyramid[i] = cvCreateImage(cvSize(octave_total_width, octave_total_height), IPL_DEPTH_8U, 1);
+        aztec_pyramid[i] = cvCreateImageHeader(cvSize(octave_total_width, octave_total_height), IPL_DEPTH_8U, 1);
       else
         aztec_pyramid[i] = nullptr;
       coeffs[i] = c;
@@ -259,7 +307,7 @@ void fine_gaussian_pyramid::alloc(int width, int height, int outer_border, int n
       }
 
       if (i % 4 == 3 || i % 4 == 0)
-        aztec_pyramid[i] = cvCreateImage(cvSize(octave_total_width, octave_total_height), IPL_DEPTH_8U, 1);
+        aztec_pyramid[i] = cvCreateImageHeader(cvSize(octave_total_width, octave_total_height), IPL_DEPTH_8U, 1);
       else
         aztec_pyramid[i] = nullptr;
       coeffs[i] = c;
@@ -284,7 +332,7 @@ void fine_gaussian_pyramid::alloc(int width, int height, int outer_border, int n
         }
 
         full_images[i]   = cvCreateImage(cvSize(total_width,        total_height),        IPL_DEPTH_8U, 1);
-        aztec_pyramid[i] = cvCreateImage(cvSize(octave_total_width, octave_total_height), IPL_DEPTH_8U, 1);
+        aztec_pyramid[i] = cvCreateImageHeader(cvSize(octave_total_width, octave_total_height), IPL_DEPTH_8U, 1);
         coeffs[i] = c;
       }
       break;
@@ -292,6 +340,52 @@ void fine_gaussian_pyramid::alloc(int width, int height, int outer_border, int n
 #endif
   default: ;
   }
+
+  map_images_in_arena();
+  widthStep_int  = intermediate_int_image->widthStep / sizeof(int);
+
+  level0_image = aztec_pyramid[0];
+  padded_level0 = cvCreateImageHeader(cvSize(total_width, total_height), IPL_DEPTH_8U, 1);
+}
+
+static size_t arena_image_size(const IplImage * image, size_t alignment)
+{
+  return (size_t(image->imageSize) + alignment - 1) / alignment * alignment;
+}
+
+// The levels and intermediate_int_image are headers on the arena, one after the other, each one
+// aligned on Arena_alignment bytes. Their widthStep is the one given by cvCreateImageHeader(), as
+// with cvCreateImage(): the laplacian of pyr_yape06 reads a few pixels before the start of the rows.
+// The arena is only reallocated if it is too small, so switching back to a smaller image size
+// does not allocate anything:
+void fine_gaussian_pyramid::map_images_in_arena(void)
+{
+  size_t size = arena_image_size(intermediate_int_image, Arena_alignment);
+  for(int i = 0; i < 4 * number_of_octaves; i++)
+    if (aztec_pyramid[i] != 0)
+      size += arena_image_size(aztec_pyramid[i], Arena_alignment);
+
+  if (size > arena_size) {
+    if (arena_buffer) delete [] arena_buffer;
+
+    const size_t alignment = huge_pages ? Huge_page_size : Arena_alignment;
+    arena_size = (size + alignment - 1) / alignment * alignment;
+    arena_buffer = new unsigned char[arena_size + alignment];
+    arena = (unsigned char *)((size_t(arena_buffer) + alignment - 1) / alignment * alignment);
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (huge_pages && madvise(arena, arena_size, MADV_HUGEPAGE) != 0)
+      log_warn << "[fine_gaussian_pyramid::map_images_in_arena]" << "madvise(MADV_HUGEPAGE) failed." << endl;
+#endif
+  }
+
+  unsigned char * data = arena;
+  cvSetData(intermediate_int_image, data, intermediate_int_image->widthStep);
+  data += arena_image_size(intermediate_int_image, Arena_alignment);
+  for(int i = 0; i < 4 * number_of_octaves; i++)
+    if (aztec_pyramid[i] != 0) {
+      cvSetData(aztec_pyramid[i], data, aztec_pyramid[i]->widthStep);
+      data += arena_image_size(aztec_pyramid[i], Arena_alignment);
+    }
 }
 
 void fine_gaussian_pyramid::set_image(const IplImage * image)
@@ -305,53 +399,100 @@ void fine_gaussian_pyramid::set_image(const IplImage * image)
   cvCopy(image, original_image);
 #endif
 
-  CvRect dest_roi = cvRect(outer_border, outer_border, image->width, image->height);
-  cvSetImageROI(aztec_pyramid[0], dest_roi);
-  CvRect src_roi = cvRect(0, 0, image->width, image->height);
-  IplROI * image_roi = image->roi;
-
-  // An ugly trick to use const on image. I swear the image is actually not modified !!!
-  IplImage * tmp_image = (IplImage *)((int*)image);
-  cvSetImageROI(tmp_image, src_roi);
-  cvCopy(tmp_image, aztec_pyramid[0]);
-  cvFree(&(aztec_pyramid[0]->roi));
-  cvFree(&(tmp_image->roi));
-  tmp_image->roi = image_roi;
-
-  // Create border
-  for(int i = 0; i < outer_border; i++) {
-    unsigned char * border = mcvRow(aztec_pyramid[0], i, unsigned char);
-    unsigned char * first_row = mcvRow(image, 0, unsigned char);
-    for(int j = 0; j < image->width; j++)
-      border[outer_border + j] = first_row[j];
-  }
-  for(int i = outer_border + image->height; i < total_height; i++) {
-    unsigned char * border = mcvRow(aztec_pyramid[0], i, unsigned char);
-    unsigned char * last_row = mcvRow(image, image->height - 1, unsigned char);
-    for(int j = 0; j < width; j++)
-      border[outer_border + j] = last_row[j];
+  aztec_pyramid[0] = level0_image;
+  for(int y = 0; y < image->height; y++)
+    memcpy(mcvRow(level0_image, outer_border + y, unsigned char) + outer_border,
+           mcvRow(image, y, const unsigned char), image->width);
+  fill_level0_border();
+
+  compute_from_level0();
+}
+
+void fine_gaussian_pyramid::set_padded_image(IplImage * padded_image, bool fill_border)
+{
+  if (width + 2 * border_size != padded_image->width || height + 2 * border_size != padded_image->height) {
+    free();
+    alloc(padded_image->width - 2 * border_size, padded_image->height - 2 * border_size, outer_border, number_of_octaves, inner_border);
   }
-  int j_step = aztec_pyramid[0]->widthStep;
-  for(int i = 0; i < outer_border; i++) {
-    unsigned char * border = mcvRow(aztec_pyramid[0], 0, unsigned char) + i;
-    unsigned char * first_row = mcvRow(aztec_pyramid[0], 0, unsigned char) + outer_border;
-    for(int j = 0; j < total_height; j++) {
-      *border = *first_row;
-      border += j_step;
-      first_row += j_step;
-    }
+
+  cvSetData(padded_level0, padded_image->imageData, padded_image->widthStep);
+  aztec_pyramid[0] = padded_level0;
+  if (fill_border) fill_level0_border();
+
+#if pyr_debug
+  for(int y = 0; y < original_image->height; y++)
+    memcpy(mcvRow(original_image, y, unsigned char),
+           mcvRow(padded_level0, outer_border + y, unsigned char) + outer_border, original_image->width);
+#endif
+
+  compute_from_level0();
+}
+
+// Replicates the first and last columns of the image in the left and right borders of level 0,
+// then the first and last rows (borders included) in the top and bottom borders:
+void fine_gaussian_pyramid::fill_level0_border(void)
+{
+  IplImage * level0 = aztec_pyramid[0];
+  const int last_column = total_width - outer_border - 1;
+
+  for(int y = outer_border; y < total_height - outer_border; y++) {
+    unsigned char * row = mcvRow(level0, y, unsigned char);
+    memset(row, row[outer_border], outer_border);
+    memset(row + last_column + 1, row[last_column], outer_border);
   }
-  for(int i = outer_border + image->width; i < total_width; i++) {
-    unsigned char * border = mcvRow(aztec_pyramid[0], 0, unsigned char) + i;
-    unsigned char * first_row = mcvRow(aztec_pyramid[0], 0, unsigned char) + image->width + outer_border - 1;
-    for(int j = 0; j < total_height; j++) {
-      *border = *first_row;
-      border += j_step;
-      first_row += j_step;
-    }
+
+  const unsigned char * first_row = mcvRow(level0, outer_border, unsigned char);
+  const unsigned char * last_row  = mcvRow(level0, total_height - outer_border - 1, unsigned char);
+  for(int y = 0; y < outer_border; y++) {
+    memcpy(mcvRow(level0, y, unsigned char), first_row, total_width);
+    memcpy(mcvRow(level0, total_height - 1 - y, unsigned char), last_row, total_width);
   }
+}
 
-  compute_from_level0();
+void fine_gaussian_pyramid::set_region(int x_min, int y_min, int x_max, int y_max)
+{
+  region_is_set = true;
+  region_x_min = x_min;
+  region_y_min = y_min;
+  region_x_max = x_max;
+  region_y_max = y_max;
+}
+
+void fine_gaussian_pyramid::reset_region(void)
+{
+  region_is_set = false;
+}
+
+// The region in the level of the octave, with the margin. The region of octave 0 is aligned
+// on 2^(number_of_octaves - 1) pixels so that the region of octave i is exactly the region
+// of octave 0 divided by 2^i:
+CvRect fine_gaussian_pyramid::region_at_octave(int octave)
+{
+  const int alignment = 1 << (number_of_octaves - 1);
+  const int margin = Region_margin * alignment;
+  const int x0 = max(0, region_x_min + border_size - margin) / alignment * alignment;
+  const int y0 = max(0, region_y_min + border_size - margin) / alignment * alignment;
+  const int x1 = (min(total_width,  region_x_max + border_size + margin) + alignment - 1) / alignment * alignment;
+  const int y1 = (min(total_height, region_y_max + border_size + margin) + alignment - 1) / alignment * alignment;
+
+  IplImage * level = aztec_pyramid[4 * octave];
+  const int ox0 = x0 >> octave, oy0 = y0 >> octave;
+  return cvRect(ox0, oy0, min(x1 >> octave, level->width) - ox0, min(y1 >> octave, level->height) - oy0);
+}
+
+// aztec_pyramid[level], or a header on its region:
+IplImage * fine_gaussian_pyramid::region_view(int level, int view_index)
+{
+  if (!region_is_used) return aztec_pyramid[level];
+
+  IplImage * image = aztec_pyramid[level];
+  IplImage * view = region_views[view_index];
+  CvRect r = region_at_octave(level / 4);
+  view->width = r.width;
+  view->height = r.height;
+  cvSetData(view, image->imageData + r.y * image->widthStep + r.x, image->widthStep);
+
+  return view;
 }
 
 bool fine_gaussian_pyramid::load_image(char * image_name, int i)
@@ -375,8 +516,8 @@ bool fine_gaussian_pyramid::load_image(char * image_name)
 
 void fine_gaussian_pyramid::compute_from_level0(void)
 {
-  // Could save time here yape_pyramid_3, yape_pyramid_3, and yape_pyramid_7
-  // cvPyrDown and cvSmooth should be done in one pass. Does it really save time ?? ??????
+  // Could save time here for yape_pyramid_3 and yape_pyramid_5 too:
+  // cvPyrDown and cvSmooth should be done in one pass as for yape_pyramid_7.
 
   switch(type) {
   case yape_pyramid_3:
@@ -391,12 +532,21 @@ void fine_gaussian_pyramid::compute_from_level0(void)
       if (i < number_of_octaves - 1) cvPyrDown(aztec_pyramid[4 * i], aztec_pyramid[4 * i + 4]);
     }
     break;
-  case yape_pyramid_7:
-    for(int i = 0; i < number_of_octaves; i++) {
-      mcvGaussianSmoothing_7x7(aztec_pyramid[4 * i], aztec_pyramid[4 * i + 3], intermediate_int_image);
-      if (i < number_of_octaves - 1) cvPyrDown(aztec_pyramid[4 * i], aztec_pyramid[4 * i + 4]);
+  case yape_pyramid_7: {
+    // The region is not used if it is too small for the 7x7 smoothing in the last octave:
+    region_is_used = false;
+    if (region_is_set) {
+      CvRect r = region_at_octave(number_of_octaves - 1);
+      region_is_used = r.width >= 8 && r.height >= 8;
     }
+
+    const int threads = number_of_threads > 0 ? number_of_threads : omp_get_max_threads();
+    for(int i = 0; i < number_of_octaves; i++)
+      mcvGaussianSmoothing_7x7_and_pyrDown(region_view(4 * i, 0), region_view(4 * i + 3, 1),
+                                           i < number_of_octaves - 1 ? region_view(4 * i + 4, 2) : nullptr,
+                                           intermediate_int_image, threads);
     break;
+  }
 #if pyr_debug
   case full_pyramid_333: {
     // Build aztec pyramid:
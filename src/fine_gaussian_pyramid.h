@@ -77,6 +77,25 @@ class fine_gaussian_pyramid
   bool load_image(char * image_name);
   bool load_image(char * image_name, int i);
   void set_image(const IplImage * image);
+  //! Uses padded_image directly as level 0, without copy. padded_image is the image with
+  //! outer_border pixels of padding on each side (total_width x total_height). If fill_border is
+  //! false, the padding must already replicate the image borders. padded_image must not be
+  //! released before the next call to set_image() or set_padded_image().
+  void set_padded_image(IplImage * padded_image, bool fill_border = true);
+
+  //! Restricts the computation of the levels by set_image() to a region of the image
+  //! [x_min, x_max) x [y_min, y_max), expanded by Region_margin pixels of the last octave.
+  //! The other pixels of the levels are left as they are. Only for yape_pyramid_7.
+  void set_region(int x_min, int y_min, int x_max, int y_max);
+  void reset_region(void);
+
+  //! Number of threads used to compute the levels of yape_pyramid_7, in horizontal bands.
+  //! 0 (default) means omp_get_max_threads().
+  void set_number_of_threads(int number_of_threads) { this->number_of_threads = number_of_threads; }
+
+  //! All the levels are stored in a single arena, kept when the image size changes if it is large
+  //! enough. If enabled, the next arena is aligned on huge pages and advised to use them (Linux).
+  void set_huge_pages(bool enabled) { huge_pages = enabled; }
 
   int level_from_scale(float scale);
   //! Convert a coordinate from one level to another.
@@ -112,10 +131,30 @@ class fine_gaussian_pyramid
   //private:
   int type;
 
+  void fill_level0_border(void);
   void compute_from_level0(void);
+  CvRect region_at_octave(int octave);
+  IplImage * region_view(int level, int view_index);
+
+  static const int Region_margin;
+  bool region_is_set, region_is_used;
+  int region_x_min, region_y_min, region_x_max, region_y_max;
+  int number_of_threads;
+  //! Headers on the region of a level, for the source and the destinations of a filter.
+  IplImage * region_views[3];
+  //! aztec_pyramid[0] is level0_image after set_image(), padded_level0 (a header on the image
+  //! given by the caller) after set_padded_image().
+  IplImage * level0_image, * padded_level0;
   void alloc(int width, int height, int outer_border, int nb_levels, int inner_border);
   void free(void);
 
+  static const int Arena_alignment, Huge_page_size;
+  void map_images_in_arena(void);
+  //! arena is arena_buffer aligned on Arena_alignment bytes (Huge_page_size with huge_pages).
+  unsigned char * arena, * arena_buffer;
+  size_t arena_size;
+  bool huge_pages;
+
 #if pyr_debug
   void rawReduce(IplImage * original_image, IplImage * halfsize_image);
   void expand(IplImage * original_image, IplImage * dblesize_image);
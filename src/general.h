@@ -29,6 +29,12 @@ float rand_01(void);
 float rand_m1p1(void);
 float rand(float min, float max);
 
+// Same functions with their own random state (see rand_r()), for threads.
+// A null state falls back to rand():
+int rand(unsigned int * state);
+float rand_01(unsigned int * state);
+float rand(float min, float max, unsigned int * state);
+
 #ifndef M_PI
 #define M_PI 3.141592653589793238462643383279
 #endif
@@ -55,6 +61,21 @@ inline float rand(float min, float max)
   return min + rand_01() * (max - min);
 }
 
+inline int rand(unsigned int * state)
+{
+  return state ? rand_r(state) : rand();
+}
+
+inline float rand_01(unsigned int * state)
+{
+  return (rand(state) % RAND_MAX) / (float)RAND_MAX;
+}
+
+inline float rand(float min, float max, unsigned int * state)
+{
+  return min + rand_01(state) * (max - min);
+}
+
 inline int gf_sqr(const int x)
 {
   return x * x;
@@ -21,10 +21,15 @@
   Street, Fifth Floor, Boston, MA 02110-1301, USA
 */
 #include <iostream>
+#include <algorithm>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #include "logger.h"
 #include "buffer_management.h"
 #include "mcvGaussianSmoothing.h"
+#include "size_specializations.h"
 
 using namespace std;
 using namespace plog;
@@ -106,8 +111,8 @@ inline void mcvGaussianSmoothing_3x3(IplImage * im_src, IplImage * im_dst, const
 {
   // First pass: make use of intermediate_int_image
   for(int y = 0; y < h; y++) {
-    unsigned char * src = mcvRow(im_src, y,  unsigned char);
-    int * ints = mcvRow(im_int_buffer, y, int);
+    const unsigned char * __restrict src = mcvRow(im_src, y,  unsigned char);
+    int * __restrict ints = mcvRow(im_int_buffer, y, int);
 
     for(int x = 1; x < w - 1; x++)
       ints[x] = W0 * int(src[x]) + W1 * (int(src[x - 1]) + int(src[x + 1]));
@@ -119,11 +124,11 @@ inline void mcvGaussianSmoothing_3x3(IplImage * im_src, IplImage * im_dst, const
   // Second pass:
   const int delta = 1 << (shift - 1);
   for(int y = 1; y < h - 1; y++) {
-    int * row0 = mcvRow(im_int_buffer, y - 1, int);
-    int * row1 = (int *)((char*)row0 + im_int_buffer->widthStep);
-    int * row2 = (int *)((char*)row1 + im_int_buffer->widthStep);
+    const int * __restrict row0 = mcvRow(im_int_buffer, y - 1, int);
+    const int * __restrict row1 = (const int *)((const char*)row0 + im_int_buffer->widthStep);
+    const int * __restrict row2 = (const int *)((const char*)row1 + im_int_buffer->widthStep);
 
-    unsigned char * dest = mcvRow(im_dst, y, unsigned char);
+    unsigned char * __restrict dest = mcvRow(im_dst, y, unsigned char);
 
     for(int x = 0; x < w; x++)
       dest[x] = (unsigned char)(( W0 * row1[x] + W1 * (row0[x] + row2[x]) + delta) >> shift);
@@ -145,8 +150,8 @@ inline void mcvGaussianSmoothing_5x5(IplImage * im_src, IplImage * im_dst, const
 {
   // First pass: make use of intermediate_int_image
   for(int y = 0; y < h; y++) {
-    unsigned char * src = mcvRow(im_src, y,  unsigned char);
-    int * ints = mcvRow(im_int_buffer, y, int);
+    const unsigned char * __restrict src = mcvRow(im_src, y,  unsigned char);
+    int * __restrict ints = mcvRow(im_int_buffer, y, int);
 
     for(int x = 2; x < w - 2; x++)
       ints[x] = W0 * int(src[x]) + W1 * (int(src[x - 1]) + int(src[x + 1])) + W2 * (int(src[x - 2]) + int(src[x + 2]));
@@ -158,13 +163,13 @@ inline void mcvGaussianSmoothing_5x5(IplImage * im_src, IplImage * im_dst, const
   // Second pass:
   const int delta = 1 << (shift - 1);
   for(int y = 2; y < h - 2; y++) {
-    int * row0 = mcvRow(im_int_buffer, y - 2, int);
-    int * row1 = (int *)((char*)row0 + im_int_buffer->widthStep);
-    int * row2 = (int *)((char*)row1 + im_int_buffer->widthStep);
-    int * row3 = (int *)((char*)row2 + im_int_buffer->widthStep);
-    int * row4 = (int *)((char*)row3 + im_int_buffer->widthStep);
+    const int * __restrict row0 = mcvRow(im_int_buffer, y - 2, int);
+    const int * __restrict row1 = (const int *)((const char*)row0 + im_int_buffer->widthStep);
+    const int * __restrict row2 = (const int *)((const char*)row1 + im_int_buffer->widthStep);
+    const int * __restrict row3 = (const int *)((const char*)row2 + im_int_buffer->widthStep);
+    const int * __restrict row4 = (const int *)((const char*)row3 + im_int_buffer->widthStep);
 
-    unsigned char * dest = mcvRow(im_dst, y, unsigned char);
+    unsigned char * __restrict dest = mcvRow(im_dst, y, unsigned char);
 
     for(int x = 0; x < w; x++)
       dest[x] = (unsigned char)(( W0 * row2[x] + W1 * (row1[x] + row3[x]) + W2 * (row0[x] + row4[x]) + delta) >> shift);
@@ -192,8 +197,8 @@ inline void mcvGaussianSmoothing_7x7_standard_weights(IplImage * im_src, IplImag
   // First pass: make use of intermediate_int_image
 
   for(int y = 0; y < h; y++) {
-    unsigned char * src = mcvRow(im_src, y,  unsigned char);
-    int * ints = mcvRow(im_int_buffer, y, int);
+    const unsigned char * __restrict src = mcvRow(im_src, y,  unsigned char);
+    int * __restrict ints = mcvRow(im_int_buffer, y, int);
 
     for(int x = 3; x < w - 3; x++)
       ints[x] =
@@ -208,8 +213,8 @@ inline void mcvGaussianSmoothing_7x7_standard_weights(IplImage * im_src, IplImag
   const int delta = 1 << (12 - 1);
   const int D = width_int_buffer;
   for(int y = 3; y < h - 3; y++) {
-    int * row0 = mcvRow(im_int_buffer, y - 3, int);
-    unsigned char * dest = mcvRow(im_dst, y, unsigned char);
+    const int * __restrict row0 = mcvRow(im_int_buffer, y - 3, int);
+    unsigned char * __restrict dest = mcvRow(im_dst, y, unsigned char);
 
     for(int x = 0; x < w; x++)
       dest[x] = (unsigned char)((2 * (9 *  (row0 + 3 * D)[x] +
@@ -244,8 +249,8 @@ inline void mcvGaussianSmoothing_7x7(IplImage * im_src, IplImage * im_dst,
   // First pass: make use of intermediate_int_image
 
   for(int y = 0; y < h; y++) {
-    unsigned char * src = mcvRow(im_src, y,  unsigned char);
-    int * ints = mcvRow(im_int_buffer, y, int);
+    const unsigned char * __restrict src = mcvRow(im_src, y,  unsigned char);
+    int * __restrict ints = mcvRow(im_int_buffer, y, int);
 
     for(int x = 3; x < w - 3; x++)
       ints[x] =
@@ -262,8 +267,8 @@ inline void mcvGaussianSmoothing_7x7(IplImage * im_src, IplImage * im_dst,
   const int delta = 1 << (shift - 1);
   const int D = im_int_buffer->widthStep / 4;
   for(int y = 3; y < h - 3; y++) {
-    int * row0 = mcvRow(im_int_buffer, y - 3, int);
-    unsigned char * dest = mcvRow(im_dst, y, unsigned char);
+    const int * __restrict row0 = mcvRow(im_int_buffer, y - 3, int);
+    unsigned char * __restrict dest = mcvRow(im_dst, y, unsigned char);
 
     for(int x = 0; x < w; x++)
       dest[x] = (unsigned char)(( W0 *  (row0 + 3 * D)[x] +
@@ -288,87 +293,274 @@ inline void mcvGaussianSmoothing_7x7(IplImage * im_src, IplImage * im_dst,
   }
 }
 
-void mcvGaussianSmoothing_3x3(IplImage * src, IplImage * dst, IplImage * int_buffer)
+// Size dispatch: the generic kernels handle any image size. Kernels specialized for a given size
+// are registered with MCV_REGISTER_SIZE_SPECIALIZATION below and are picked up by the dispatch.
+
+typedef void (*smoothing_3x3_kernel)(IplImage * src, IplImage * dst, IplImage * int_buffer, const int W0, const int W1, const int shift);
+typedef void (*smoothing_5x5_kernel)(IplImage * src, IplImage * dst, IplImage * int_buffer, const int W0, const int W1, const int W2, const int shift);
+typedef void (*smoothing_7x7_standard_weights_kernel)(IplImage * src, IplImage * dst, IplImage * int_buffer);
+
+static void smoothing_3x3_generic(IplImage * src, IplImage * dst, IplImage * int_buffer, const int W0, const int W1, const int shift)
 {
-  const int w = src->width;
-  const int h = src->height;
+  mcvGaussianSmoothing_3x3(src, dst, src->width, src->height, int_buffer, W0, W1, shift);
+}
 
-  if (w == 640 && h == 480)      mcvGaussianSmoothing_3x3(src, dst, 640, 480, int_buffer, 2, 1, 4);
-  else if (w == 320 && h == 240) mcvGaussianSmoothing_3x3(src, dst, 320, 240, int_buffer, 2, 1, 4);
-  else                           mcvGaussianSmoothing_3x3(src, dst,   w,   h, int_buffer, 2, 1, 4);
+template<int W, int H>
+static void smoothing_3x3_fixed_size(IplImage * src, IplImage * dst, IplImage * int_buffer, const int W0, const int W1, const int shift)
+{
+  mcvGaussianSmoothing_3x3(src, dst, W, H, int_buffer, W0, W1, shift);
 }
 
-void mcvGaussianSmoothing_5x5(IplImage * src, IplImage * dst, IplImage * int_buffer)
+static void smoothing_5x5_generic(IplImage * src, IplImage * dst, IplImage * int_buffer, const int W0, const int W1, const int W2, const int shift)
 {
-  const int w = src->width;
-  const int h = src->height;
+  mcvGaussianSmoothing_5x5(src, dst, src->width, src->height, int_buffer, W0, W1, W2, shift);
+}
 
-  if (w == 640 && h == 480)      mcvGaussianSmoothing_5x5(src, dst, 640, 480, int_buffer, 6, 4, 1, 8);
-  else if (w == 320 && h == 240) mcvGaussianSmoothing_5x5(src, dst, 320, 240, int_buffer, 6, 4, 1, 8);
-  else                           mcvGaussianSmoothing_5x5(src, dst,   w,   h, int_buffer, 6, 4, 1, 8);
+template<int W, int H>
+static void smoothing_5x5_fixed_size(IplImage * src, IplImage * dst, IplImage * int_buffer, const int W0, const int W1, const int W2, const int shift)
+{
+  mcvGaussianSmoothing_5x5(src, dst, W, H, int_buffer, W0, W1, W2, shift);
+}
+
+static void smoothing_7x7_standard_weights_generic(IplImage * src, IplImage * dst, IplImage * int_buffer)
+{
+  mcvGaussianSmoothing_7x7_standard_weights(src, dst, src->width, src->height, int_buffer, int_buffer->widthStep / 4);
+}
+
+template<int W, int H>
+static void smoothing_7x7_standard_weights_fixed_size(IplImage * src, IplImage * dst, IplImage * int_buffer)
+{
+  mcvGaussianSmoothing_7x7_standard_weights(src, dst, W, H, int_buffer, int_buffer->widthStep / 4);
+}
+
+MCV_REGISTER_SIZE_SPECIALIZATION(smoothing_3x3_kernel, smoothing_3x3_fixed_size, 640, 480);
+MCV_REGISTER_SIZE_SPECIALIZATION(smoothing_3x3_kernel, smoothing_3x3_fixed_size, 320, 240);
+
+MCV_REGISTER_SIZE_SPECIALIZATION(smoothing_5x5_kernel, smoothing_5x5_fixed_size, 640, 480);
+MCV_REGISTER_SIZE_SPECIALIZATION(smoothing_5x5_kernel, smoothing_5x5_fixed_size, 320, 240);
+
+MCV_REGISTER_SIZE_SPECIALIZATION(smoothing_7x7_standard_weights_kernel, smoothing_7x7_standard_weights_fixed_size, 784, 640);
+MCV_REGISTER_SIZE_SPECIALIZATION(smoothing_7x7_standard_weights_kernel, smoothing_7x7_standard_weights_fixed_size, 704, 544);
+MCV_REGISTER_SIZE_SPECIALIZATION(smoothing_7x7_standard_weights_kernel, smoothing_7x7_standard_weights_fixed_size, 640, 480);
+MCV_REGISTER_SIZE_SPECIALIZATION(smoothing_7x7_standard_weights_kernel, smoothing_7x7_standard_weights_fixed_size, 392, 320);
+MCV_REGISTER_SIZE_SPECIALIZATION(smoothing_7x7_standard_weights_kernel, smoothing_7x7_standard_weights_fixed_size, 352, 272);
+MCV_REGISTER_SIZE_SPECIALIZATION(smoothing_7x7_standard_weights_kernel, smoothing_7x7_standard_weights_fixed_size, 320, 240);
+MCV_REGISTER_SIZE_SPECIALIZATION(smoothing_7x7_standard_weights_kernel, smoothing_7x7_standard_weights_fixed_size, 196, 160);
+MCV_REGISTER_SIZE_SPECIALIZATION(smoothing_7x7_standard_weights_kernel, smoothing_7x7_standard_weights_fixed_size, 176, 136);
+
+static inline smoothing_3x3_kernel find_smoothing_3x3(IplImage * src)
+{
+  return size_specializations<smoothing_3x3_kernel>::find(src->width, src->height, smoothing_3x3_generic);
+}
+
+static inline smoothing_5x5_kernel find_smoothing_5x5(IplImage * src)
+{
+  return size_specializations<smoothing_5x5_kernel>::find(src->width, src->height, smoothing_5x5_generic);
+}
+
+void mcvGaussianSmoothing_3x3(IplImage * src, IplImage * dst, IplImage * int_buffer)
+{
+  find_smoothing_3x3(src)(src, dst, int_buffer, 2, 1, 4);
+}
+
+void mcvGaussianSmoothing_5x5(IplImage * src, IplImage * dst, IplImage * int_buffer)
+{
+  find_smoothing_5x5(src)(src, dst, int_buffer, 6, 4, 1, 8);
 }
 
 void mcvGaussianSmoothing_7x7(IplImage * src, IplImage * dst, IplImage * int_buffer)
 {
-  const int w = src->width;
-  const int h = src->height;
-  const int bw = int_buffer->widthStep / 4;
-
-  if (bw == 704) {
-    if      (w == 704 && h == 544) mcvGaussianSmoothing_7x7_standard_weights(src, dst, 704, 544, int_buffer, 704);
-    else if (w == 352 && h == 272) mcvGaussianSmoothing_7x7_standard_weights(src, dst, 352, 272, int_buffer, 704);
-    else if (w == 176 && h == 136) mcvGaussianSmoothing_7x7_standard_weights(src, dst, 176, 136, int_buffer, 704);
-    else                           mcvGaussianSmoothing_7x7_standard_weights(src, dst,   w,   h, int_buffer, 704);
-  } else {
-    if      (w == 784 && h == 640) mcvGaussianSmoothing_7x7_standard_weights(src, dst, 784, 640, int_buffer, bw);
-    else if (w == 704 && h == 544) mcvGaussianSmoothing_7x7_standard_weights(src, dst, 352, 272, int_buffer, bw);
-    else if (w == 640 && h == 480) mcvGaussianSmoothing_7x7_standard_weights(src, dst, 640, 480, int_buffer, bw);
-    else if (w == 392 && h == 320) mcvGaussianSmoothing_7x7_standard_weights(src, dst, 392, 320, int_buffer, bw);
-    else if (w == 352 && h == 272) mcvGaussianSmoothing_7x7_standard_weights(src, dst, 352, 272, int_buffer, bw);
-    else if (w == 320 && h == 240) mcvGaussianSmoothing_7x7_standard_weights(src, dst, 320, 240, int_buffer, bw);
-    else if (w == 196 && h == 160) mcvGaussianSmoothing_7x7_standard_weights(src, dst, 196, 160, int_buffer, bw);
-    else if (w == 176 && h == 136) mcvGaussianSmoothing_7x7_standard_weights(src, dst, 176, 136, int_buffer, bw);
-    else                           mcvGaussianSmoothing_7x7_standard_weights(src, dst,   w,   h, int_buffer, bw);
-  }
+  size_specializations<smoothing_7x7_standard_weights_kernel>::find(src->width, src->height,
+                                                                    smoothing_7x7_standard_weights_generic)(src, dst, int_buffer);
 }
 
-void mcvGaussianSmoothing_dsigma_0_sigma_0_Scales_4(IplImage * src, IplImage * dst, IplImage * int_buffer)
+// Fused 7x7 smoothing and pyrDown.
+//
+// Both filters are applied vertically first, directly on the rows of the source image, and then
+// horizontally on a row of 16 bit sums. The sums are exact, so the results are the same as
+// mcvGaussianSmoothing_7x7() followed by cvPyrDown() (reflected borders, rounding to nearest).
+// Row y of the smoothed image and row y / 2 of the half size image are computed while the source
+// rows around y are in the cache, and no intermediate image is written.
+
+#if defined(__SSE2__)
+// Even 16 bit lanes of p[0..15] (the values are positive and < 2^15):
+static inline __m128i even_lanes_epi16(const short * p)
 {
-  const int w = src->width;
-  const int h = src->height;
+  __m128i a = _mm_loadu_si128((const __m128i *)p);
+  __m128i b = _mm_loadu_si128((const __m128i *)(p + 8));
+  a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+  b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+  return _mm_packs_epi32(a, b);
+}
+#endif
 
-  if (w == 640 && h == 480)      mcvGaussianSmoothing_3x3(src, dst, 640, 480, int_buffer, 138, 59, 16);
-  else if (w == 320 && h == 240) mcvGaussianSmoothing_3x3(src, dst, 320, 240, int_buffer, 138, 59, 16);
-  else                          mcvGaussianSmoothing_3x3(src, dst,   w,   h, int_buffer, 138, 59, 16);
+// Weights 2 7 14 18 14 7 2, the sums fit in 16 bits (64 * 255):
+static void smoothing_7x7_row(const unsigned char * const * rows, short * __restrict sums,
+                              unsigned char * __restrict dest, const int w)
+{
+  const unsigned char * r0 = rows[0], * r1 = rows[1], * r2 = rows[2], * r3 = rows[3];
+  const unsigned char * r4 = rows[4], * r5 = rows[5], * r6 = rows[6];
+
+  int x = 0;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i w2 = _mm_set1_epi16(2), w7 = _mm_set1_epi16(7), w14 = _mm_set1_epi16(14), w18 = _mm_set1_epi16(18);
+  for(; x + 8 <= w; x += 8) {
+#define mcv_load_row(r) _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)((r) + x)), zero)
+    __m128i s = _mm_mullo_epi16(w2, _mm_add_epi16(mcv_load_row(r0), mcv_load_row(r6)));
+    s = _mm_add_epi16(s, _mm_mullo_epi16(w7,  _mm_add_epi16(mcv_load_row(r1), mcv_load_row(r5))));
+    s = _mm_add_epi16(s, _mm_mullo_epi16(w14, _mm_add_epi16(mcv_load_row(r2), mcv_load_row(r4))));
+    s = _mm_add_epi16(s, _mm_mullo_epi16(w18, mcv_load_row(r3)));
+#undef mcv_load_row
+    _mm_storeu_si128((__m128i *)(sums + x), s);
+  }
+#endif
+  for(; x < w; x++)
+    sums[x] = short(2 * (int(r0[x]) + int(r6[x])) + 7 * (int(r1[x]) + int(r5[x])) +
+                    14 * (int(r2[x]) + int(r4[x])) + 18 * int(r3[x]));
+
+  // Horizontal pass, the result needs 32 bits:
+  const int delta = 1 << (12 - 1);
+  x = 3;
+#if defined(__SSE2__)
+  const __m128i w2_7 = _mm_setr_epi16(2, 7, 2, 7, 2, 7, 2, 7);
+  const __m128i w14_18 = _mm_setr_epi16(14, 18, 14, 18, 14, 18, 14, 18);
+  const __m128i delta4 = _mm_set1_epi32(delta);
+  for(; x + 8 <= w - 3; x += 8) {
+#define mcv_load_sums(dx) _mm_loadu_si128((const __m128i *)(sums + x + (dx)))
+    __m128i a = _mm_add_epi16(mcv_load_sums(-3), mcv_load_sums(3));
+    __m128i b = _mm_add_epi16(mcv_load_sums(-2), mcv_load_sums(2));
+    __m128i c = _mm_add_epi16(mcv_load_sums(-1), mcv_load_sums(1));
+    __m128i d = mcv_load_sums(0);
+#undef mcv_load_sums
+    __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(a, b), w2_7), _mm_madd_epi16(_mm_unpacklo_epi16(c, d), w14_18));
+    __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(a, b), w2_7), _mm_madd_epi16(_mm_unpackhi_epi16(c, d), w14_18));
+    lo = _mm_srai_epi32(_mm_add_epi32(lo, delta4), 12);
+    hi = _mm_srai_epi32(_mm_add_epi32(hi, delta4), 12);
+    __m128i p = _mm_packs_epi32(lo, hi);
+    _mm_storel_epi64((__m128i *)(dest + x), _mm_packus_epi16(p, p));
+  }
+#endif
+  for(; x < w - 3; x++)
+    dest[x] = (unsigned char)((2 * (int(sums[x - 3]) + int(sums[x + 3])) + 7 * (int(sums[x - 2]) + int(sums[x + 2])) +
+                               14 * (int(sums[x - 1]) + int(sums[x + 1])) + 18 * int(sums[x]) + delta) >> 12);
+
+  dest[0] = dest[1] = dest[2] = dest[3];
+  dest[w - 1] = dest[w - 2] = dest[w - 3] = dest[w - 4];
 }
 
-void mcvGaussianSmoothing_dsigma_1_sigma_0_Scales_4(IplImage * src, IplImage * dst, IplImage * int_buffer)
+// Weights 1 4 6 4 1. sums[x + 2] is the vertical sum of column x, sums[0, 1] and sums[w + 2, w + 3]
+// are the reflected columns. The total fits in 16 bits if unsigned (256 * 255):
+static void pyrDown_row(const unsigned char * const * rows, short * __restrict sums,
+                        unsigned char * __restrict dest, const int w, const int half_w)
 {
-  const int w = src->width;
-  const int h = src->height;
+  const unsigned char * r0 = rows[0], * r1 = rows[1], * r2 = rows[2], * r3 = rows[3], * r4 = rows[4];
+
+  int x = 0;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i w4 = _mm_set1_epi16(4), w6 = _mm_set1_epi16(6);
+  for(; x + 8 <= w; x += 8) {
+#define mcv_load_row(r) _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)((r) + x)), zero)
+    __m128i s = _mm_add_epi16(mcv_load_row(r0), mcv_load_row(r4));
+    s = _mm_add_epi16(s, _mm_mullo_epi16(w4, _mm_add_epi16(mcv_load_row(r1), mcv_load_row(r3))));
+    s = _mm_add_epi16(s, _mm_mullo_epi16(w6, mcv_load_row(r2)));
+#undef mcv_load_row
+    _mm_storeu_si128((__m128i *)(sums + 2 + x), s);
+  }
+#endif
+  for(; x < w; x++)
+    sums[2 + x] = short(int(r0[x]) + int(r4[x]) + 4 * (int(r1[x]) + int(r3[x])) + 6 * int(r2[x]));
+
+  sums[0] = sums[4];
+  sums[1] = sums[3];
+  sums[w + 2] = sums[w];
+  sums[w + 3] = sums[w - 1];
+
+  x = 0;
+#if defined(__SSE2__)
+  const __m128i delta8 = _mm_set1_epi16(1 << 7);
+  for(; 2 * x + 20 <= w + 4; x += 8) {
+    __m128i s = _mm_add_epi16(even_lanes_epi16(sums + 2 * x), even_lanes_epi16(sums + 2 * x + 4));
+    s = _mm_add_epi16(s, _mm_mullo_epi16(w4, _mm_add_epi16(even_lanes_epi16(sums + 2 * x + 1), even_lanes_epi16(sums + 2 * x + 3))));
+    s = _mm_add_epi16(s, _mm_mullo_epi16(w6, even_lanes_epi16(sums + 2 * x + 2)));
+    s = _mm_srli_epi16(_mm_add_epi16(s, delta8), 8);
+    _mm_storel_epi64((__m128i *)(dest + x), _mm_packus_epi16(s, s));
+  }
+#endif
+  for(; x < half_w; x++) {
+    const short * s = sums + 2 * x;
+    dest[x] = (unsigned char)((int(s[0]) + int(s[4]) + 4 * (int(s[1]) + int(s[3])) + 6 * int(s[2]) + (1 << 7)) >> 8);
+  }
+}
 
-  if (w == 640 && h == 480)      mcvGaussianSmoothing_3x3(src, dst, 640, 480, int_buffer, 126, 65, 16);
-  else if (w == 320 && h == 240) mcvGaussianSmoothing_3x3(src, dst, 320, 240, int_buffer, 126, 65, 16);
-  else                           mcvGaussianSmoothing_3x3(src, dst,   w,   h, int_buffer, 126, 65, 16);
+static inline int reflect_101(int y, int h)
+{
+  return y < 0 ? -y : (y >= h ? 2 * h - 2 - y : y);
 }
 
-void mcvGaussianSmoothing_dsigma_2_sigma_0_Scales_4(IplImage * src, IplImage * dst, IplImage * int_buffer)
+void mcvGaussianSmoothing_7x7_and_pyrDown(IplImage * src, IplImage * dst, IplImage * half, IplImage * int_buffer,
+                                          int number_of_threads)
 {
-  const int w = src->width;
-  const int h = src->height;
+  const int w = src->width, h = src->height;
+
+  // The rows are processed in horizontal bands of at least minimum_band_height rows. The filters
+  // read the rows around the band directly in src, and each band has its own two rows of int_buffer:
+  const int minimum_band_height = 32;
+  const int number_of_bands = max(1, min(min(number_of_threads, h / minimum_band_height), int_buffer->height / 2));
+
+#pragma omp parallel for num_threads(number_of_bands)
+  for(int band = 0; band < number_of_bands; band++) {
+    short * smoothing_sums = (short *)mcvRow(int_buffer, 2 * band,     int);
+    short * pyrDown_sums   = (short *)mcvRow(int_buffer, 2 * band + 1, int);
+    const unsigned char * rows[7];
+
+    for(int y = h * band / number_of_bands; y < h * (band + 1) / number_of_bands; y++) {
+      if (y >= 3 && y < h - 3) {
+        for(int k = 0; k < 7; k++)
+          rows[k] = mcvRow(src, y - 3 + k, unsigned char);
+        smoothing_7x7_row(rows, smoothing_sums, mcvRow(dst, y, unsigned char), w);
+      }
+      if (half != nullptr && (y & 1) == 0 && y / 2 < half->height) {
+        for(int k = 0; k < 5; k++)
+          rows[k] = mcvRow(src, reflect_101(y - 2 + k, h), unsigned char);
+        pyrDown_row(rows, pyrDown_sums, mcvRow(half, y / 2, unsigned char), w, half->width);
+      }
+    }
+  }
+
+  // Borders of the smoothed image:
+  unsigned char * dest0 = mcvRow(dst, 0, unsigned char);
+  unsigned char * dest1 = dest0 + dst->widthStep;
+  unsigned char * dest2 = dest1 + dst->widthStep;
+  unsigned char * dest3 = dest2 + dst->widthStep;
+  unsigned char * destw1 = mcvRow(dst, h - 1, unsigned char);
+  unsigned char * destw2 = destw1 - dst->widthStep;
+  unsigned char * destw3 = destw2 - dst->widthStep;
+  unsigned char * destw4 = destw3 - dst->widthStep;
 
-  if (w == 640 && h == 480)      mcvGaussianSmoothing_3x3(src, dst, 640, 480, int_buffer, 116, 70, 16);
-  else if (w == 320 && h == 240) mcvGaussianSmoothing_3x3(src, dst, 320, 240, int_buffer, 116, 70, 16);
-  else                           mcvGaussianSmoothing_3x3(src, dst,   w,   h, int_buffer, 116, 70, 16);
+  for(int x = 0; x < w; x++) {
+    dest0[x] = dest1[x] = dest2[x] = dest3[x];
+    destw1[x] = destw2[x] = destw3[x] = destw4[x];
+  }
 }
 
-void mcvGaussianSmoothing_dsigma_2_sigma_0_Scales_4_5x5(IplImage * src, IplImage * dst, IplImage * int_buffer)
+void mcvGaussianSmoothing_dsigma_0_sigma_0_Scales_4(IplImage * src, IplImage * dst, IplImage * int_buffer)
+{
+  find_smoothing_3x3(src)(src, dst, int_buffer, 138, 59, 16);
+}
+
+void mcvGaussianSmoothing_dsigma_1_sigma_0_Scales_4(IplImage * src, IplImage * dst, IplImage * int_buffer)
 {
-  const int w = src->width;
-  const int h = src->height;
+  find_smoothing_3x3(src)(src, dst, int_buffer, 126, 65, 16);
+}
 
-  if (w == 640 && h == 480)      mcvGaussianSmoothing_5x5(src, dst, 640, 480, int_buffer, 102, 63, 14, 16);
-  else if (w == 320 && h == 240) mcvGaussianSmoothing_5x5(src, dst, 320, 240, int_buffer, 102, 63, 14, 16);
-  else                           mcvGaussianSmoothing_5x5(src, dst,   w,   h, int_buffer, 102, 63, 14, 16);
+void mcvGaussianSmoothing_dsigma_2_sigma_0_Scales_4(IplImage * src, IplImage * dst, IplImage * int_buffer)
+{
+  find_smoothing_3x3(src)(src, dst, int_buffer, 116, 70, 16);
 }
 
+void mcvGaussianSmoothing_dsigma_2_sigma_0_Scales_4_5x5(IplImage * src, IplImage * dst, IplImage * int_buffer)
+{
+  find_smoothing_5x5(src)(src, dst, int_buffer, 102, 63, 14, 16);
+}
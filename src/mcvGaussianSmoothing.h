@@ -38,6 +38,13 @@ void mcvGaussianSmoothing_3x3(IplImage * src, IplImage * dst, IplImage * int_buf
 void mcvGaussianSmoothing_5x5(IplImage * src, IplImage * dst, IplImage * int_buffer);
 void mcvGaussianSmoothing_7x7(IplImage * src, IplImage * dst, IplImage * int_buffer);
 
+// 7x7 smoothing of src into dst and cvPyrDown of src into half, in a single pass over src.
+// half is (src->width + 1) / 2 x (src->height + 1) / 2, or null for the smoothing only.
+// The rows are split in up to number_of_threads bands processed in parallel, int_buffer needs
+// two rows per band.
+void mcvGaussianSmoothing_7x7_and_pyrDown(IplImage * src, IplImage * dst, IplImage * half, IplImage * int_buffer,
+                                          int number_of_threads = 1);
+
 // Functions to compute a pyramid a la lowe:
 // Assuming the original image corresponds to the "true image" smoothed by sigma0 = 1.0
 // and using 4 "Scales" (Lowe takes 3):
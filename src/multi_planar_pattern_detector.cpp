@@ -0,0 +1,314 @@
+/*
+  Copyright 2007 Computer Vision Lab,
+  Ecole Polytechnique Federale de Lausanne (EPFL), Switzerland.
+  All rights reserved.
+
+  Author: Vincent Lepetit (http://cvlab.epfl.ch/~lepetit)
+
+  This file is part of the ferns_demo software.
+
+  ferns_demo is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 2 of the License, or (at your option) any later
+  version.
+
+  ferns_demo is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+  PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  ferns_demo; if not, write to the Free Software Foundation, Inc., 51 Franklin
+  Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+#include <algorithm>
+#include <fstream>
+
+#include "logger.h"
+#include "multi_planar_pattern_detector.h"
+#include "buffer_management.h"
+
+using namespace std;
+using namespace plog;
+
+multi_planar_pattern_detector::multi_planar_pattern_detector(void)
+{
+  class_model = class_point = nullptr;
+  number_of_classes = 0;
+
+  detected_points = nullptr;
+  number_of_detected_points = 0;
+  maximum_number_of_points_to_detect = 500;
+
+  point_detector = new pyr_yape06();
+  classifier = nullptr;
+  pyramid = nullptr;
+}
+
+multi_planar_pattern_detector::~multi_planar_pattern_detector(void)
+{
+  release_models();
+
+  if (detected_points) delete_managed_buffer(detected_points);
+
+  if (point_detector) delete point_detector;
+}
+
+void multi_planar_pattern_detector::release_models(void)
+{
+  for(size_t i = 0; i < models.size(); i++)
+    delete models[i];
+  models.clear();
+
+  if (class_model) delete [] class_model;
+  if (class_point) delete [] class_point;
+  class_model = class_point = nullptr;
+  number_of_classes = 0;
+
+  if (classifier) delete classifier;
+  if (pyramid) delete pyramid;
+  classifier = nullptr;
+  pyramid = nullptr;
+}
+
+bool multi_planar_pattern_detector::add_model(planar_pattern_detector * model)
+{
+  if (!models.empty() &&
+      (model->patch_size != models[0]->patch_size ||
+       model->yape_radius != models[0]->yape_radius ||
+       model->number_of_octaves != models[0]->number_of_octaves)) {
+    log_error << "[multi_planar_pattern_detector::add_model]"
+              << "Model " << model->image_name << " does not have the parameters of "
+              << models[0]->image_name << "." << endl;
+    return false;
+  }
+
+  if (models.empty())
+    pyramid = new fine_gaussian_pyramid(model->yape_radius, model->patch_size, model->number_of_octaves);
+
+  models.push_back(model);
+  update_class_map();
+
+  return true;
+}
+
+void multi_planar_pattern_detector::update_class_map(void)
+{
+  number_of_classes = 0;
+  for(size_t m = 0; m < models.size(); m++)
+    number_of_classes += models[m]->number_of_model_points;
+
+  if (class_model) delete [] class_model;
+  if (class_point) delete [] class_point;
+  class_model = new int[number_of_classes];
+  class_point = new int[number_of_classes];
+
+  int c = 0;
+  for(size_t m = 0; m < models.size(); m++)
+    for(int i = 0; i < models[m]->number_of_model_points; i++, c++) {
+      class_model[c] = int(m);
+      class_point[c] = i;
+    }
+}
+
+void multi_planar_pattern_detector::train(int number_of_ferns, int number_of_tests_per_fern,
+                                          int number_of_samples_for_refinement, int number_of_samples_for_test,
+                                          int number_of_threads)
+{
+  if (models.empty()) {
+    log_error << "[multi_planar_pattern_detector::train]" << "No model." << endl;
+    return;
+  }
+
+  const int patch_size = models[0]->patch_size;
+  const int yape_radius = models[0]->yape_radius;
+  const int number_of_octaves = models[0]->number_of_octaves;
+
+  log_info << "[multi_planar_pattern_detector::train]"
+           << number_of_classes << " classes for " << models.size() << " models." << endl;
+
+  if (classifier) delete classifier;
+  classifier = new fern_based_point_classifier(number_of_classes,
+                                               number_of_ferns, number_of_tests_per_fern,
+                                               -patch_size / 2, patch_size / 2, -patch_size / 2, patch_size / 2, 0, 0);
+  classifier->reset_leaves_distributions();
+
+  // The model points, with the class indices of the shared classifier:
+  keypoint * keypoints = new keypoint[number_of_classes];
+  int first_class = 0;
+  for(size_t m = 0; m < models.size(); m++) {
+    planar_pattern_detector * model = models[m];
+    for(int i = 0; i < model->number_of_model_points; i++) {
+      keypoints[first_class + i] = model->model_points[i];
+      keypoints[first_class + i].class_index = first_class + i;
+    }
+
+    classifier->train(keypoints + first_class, model->number_of_model_points,
+                      number_of_octaves, yape_radius, number_of_samples_for_refinement,
+                      model->image_generator, number_of_threads, (unsigned int)rand());
+
+    first_class += model->number_of_model_points;
+  }
+
+  classifier->finalize_training();
+  log_verb << "[multi_planar_pattern_detector::train]" << "   - posterior probabilities computed." << endl;
+
+  // No loss rate is given to test(): it would calibrate the early termination of the shared
+  // classifier on the points of one model, each call overwriting the bounds of the previous one.
+  first_class = 0;
+  for(size_t m = 0; m < models.size(); m++) {
+    planar_pattern_detector * model = models[m];
+    model->mean_recognition_rate = classifier->test(keypoints + first_class, model->number_of_model_points,
+                                                    number_of_octaves, yape_radius, number_of_samples_for_test,
+                                                    model->image_generator);
+    first_class += model->number_of_model_points;
+  }
+
+  delete [] keypoints;
+}
+
+bool multi_planar_pattern_detector::load(const char * filename, bool inference_only)
+{
+  ifstream f(filename, ios::binary);
+
+  if (!f.is_open()) return false;
+
+  log_info << "[multi_planar_pattern_detector::load]" << "Loading detector file " << filename << " ... " << endl;
+
+  bool result = load(f, inference_only);
+
+  f.close();
+
+  return result;
+}
+
+bool multi_planar_pattern_detector::save(const char * filename, bool frozen)
+{
+  ofstream f(filename, ios::binary);
+
+  if (!f.is_open()) {
+    log_error << "[multi_planar_pattern_detector::save]" << "Error saving file " << filename << "." << endl;
+    return false;
+  }
+
+  log_info << "[multi_planar_pattern_detector::save]" << "Saving detector file " << filename << " ... " << endl;
+
+  bool result = save(f, frozen);
+
+  f.close();
+
+  return result;
+}
+
+// The models loaded before are replaced. The detector is left empty if the file can not be read.
+bool multi_planar_pattern_detector::load(istream & f, bool inference_only)
+{
+  release_models();
+
+  int n = 0;
+  f >> n;
+  if (f.fail() || n <= 0) return false;
+
+  for(int m = 0; m < n; m++) {
+    planar_pattern_detector * model = new planar_pattern_detector();
+    if (!model->load_model(f) || !add_model(model)) {
+      delete model;
+      release_models();
+      return false;
+    }
+  }
+
+  classifier = new fern_based_point_classifier(f, inference_only);
+
+  if (!classifier->correctly_read) {
+    release_models();
+    return false;
+  }
+
+  if (classifier->number_of_classes != number_of_classes) {
+    log_error << "[multi_planar_pattern_detector::load]"
+              << "The classifier has " << classifier->number_of_classes << " classes, "
+              << number_of_classes << " expected." << endl;
+    release_models();
+    return false;
+  }
+
+  return true;
+}
+
+bool multi_planar_pattern_detector::save(ostream & f, bool frozen)
+{
+  f << models.size() << endl;
+
+  for(size_t m = 0; m < models.size(); m++)
+    if (!models[m]->save_model(f)) return false;
+
+  if (frozen)
+    return classifier->save_frozen(f);
+  else
+    return classifier->save(f);
+}
+
+void multi_planar_pattern_detector::set_maximum_number_of_points_to_detect(int max)
+{
+  maximum_number_of_points_to_detect = max;
+}
+
+int multi_planar_pattern_detector::detect(const IplImage * input_image)
+{
+  if (input_image->nChannels != 1 || input_image->depth != IPL_DEPTH_8U) {
+    log_error << "[multi_planar_pattern_detector::detect]"
+              << "Wrong image format "
+              << "nChannels = " << input_image->nChannels
+              << ", depth = " << input_image->depth << "." << endl;
+
+    return 0;
+  }
+
+  pyramid->set_image(input_image);
+  detect_points(pyramid);
+  return detect(pyramid);
+}
+
+int multi_planar_pattern_detector::detect(fine_gaussian_pyramid * pyramid)
+{
+  match_points(pyramid);
+
+  int number_of_detected_models = 0;
+  for(size_t m = 0; m < models.size(); m++)
+    if (models[m]->detect_from_matches())
+      number_of_detected_models++;
+
+  return number_of_detected_models;
+}
+
+void multi_planar_pattern_detector::detect_points(fine_gaussian_pyramid * pyramid)
+{
+  manage_buffer(detected_points, maximum_number_of_points_to_detect);
+  number_of_detected_points = point_detector->detect(pyramid, detected_points, maximum_number_of_points_to_detect);
+}
+
+void multi_planar_pattern_detector::match_points(fine_gaussian_pyramid * pyramid)
+{
+  for(size_t m = 0; m < models.size(); m++)
+    for(int i = 0; i < models[m]->number_of_model_points; i++) {
+      models[m]->model_points[i].potential_correspondent = 0;
+      models[m]->model_points[i].class_score = 0;
+    }
+
+  // One drop in the ferns per keypoint for all the models:
+  classifier->recognize(pyramid, detected_points, number_of_detected_points);
+
+  for(int i = 0; i < number_of_detected_points; i++) {
+    keypoint * k = detected_points + i;
+
+    if (k->class_index >= 0) {
+      keypoint * model_point = models[class_model[k->class_index]]->model_points + class_point[k->class_index];
+      float true_score = exp(k->class_score);
+
+      if (model_point->class_score < true_score) {
+        model_point->potential_correspondent = k;
+        model_point->class_score = true_score;
+      }
+    }
+  }
+}
@@ -0,0 +1,95 @@
+/*
+  Copyright 2007 Computer Vision Lab,
+  Ecole Polytechnique Federale de Lausanne (EPFL), Switzerland.
+  All rights reserved.
+
+  Author: Vincent Lepetit (http://cvlab.epfl.ch/~lepetit)
+
+  This file is part of the ferns_demo software.
+
+  ferns_demo is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 2 of the License, or (at your option) any later
+  version.
+
+  ferns_demo is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+  PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  ferns_demo; if not, write to the Free Software Foundation, Inc., 51 Franklin
+  Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+#ifndef multi_planar_pattern_detector_h
+#define multi_planar_pattern_detector_h
+
+#include <fstream>
+#include <vector>
+using namespace std;
+
+#include "cv.h"
+
+#include "keypoint.h"
+
+#include "pyr_yape06.h"
+#include "fine_gaussian_pyramid.h"
+#include "planar_pattern_detector.h"
+#include "fern_based_point_classifier.h"
+
+//! Several planar patterns recognized by one classifier: the classes are the model points of
+//! all the models, model after model, so that each detected keypoint is dropped once in the
+//! ferns for all the models. The classifiers of the models themselves are not used.
+class multi_planar_pattern_detector
+{
+ public:
+  multi_planar_pattern_detector(void);
+  ~multi_planar_pattern_detector(void);
+
+  //! The model becomes owned by the multi detector. All the models must have the same patch size,
+  //! Yape radius and number of octaves.
+  bool add_model(planar_pattern_detector * model);
+
+  //! Trains the shared classifier from the model points and image generators of the models.
+  //! The recognition rate of each model is measured on its own points only, so the early
+  //! termination of the shared classifier is not calibrated here (see fern_based_point_classifier::test()).
+  void train(int number_of_ferns, int number_of_tests_per_fern,
+             int number_of_samples_for_refinement, int number_of_samples_for_test,
+             int number_of_threads = 0);
+
+  bool load(const char * detector_data_filename, bool inference_only = false);
+  bool save(const char * detector_data_filename, bool frozen = false);
+  bool load(istream & f, bool inference_only = false);
+  bool save(ostream & f, bool frozen = false);
+
+  void set_maximum_number_of_points_to_detect(int max);
+
+  //! \return the number of detected models, see models[i]->pattern_is_detected.
+  int detect(const IplImage * input_image);
+  int detect(fine_gaussian_pyramid * pyramid);
+
+  int number_of_models(void) const { return int(models.size()); }
+
+  vector<planar_pattern_detector *> models;
+
+  //! For each class of the classifier, the model and the index of the model point:
+  int * class_model, * class_point;
+  int number_of_classes;
+
+  keypoint * detected_points;
+  int number_of_detected_points;
+  int maximum_number_of_points_to_detect;
+
+  void detect_points(fine_gaussian_pyramid * pyramid);
+  void match_points(fine_gaussian_pyramid * pyramid);
+
+  pyr_yape06 * point_detector;
+  fern_based_point_classifier * classifier;
+  fine_gaussian_pyramid * pyramid;
+
+  //private:
+  void update_class_map(void);
+  //! Deletes the models, the classifier and the pyramid, and empties the class map.
+  void release_models(void);
+};
+
+#endif
@@ -22,6 +22,13 @@
 */
 #include <algorithm>
 #include <fstream>
+#include <sstream>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "logger.h"
 #include "mcv.h"
@@ -37,6 +44,11 @@ planar_pattern_detector::planar_pattern_detector(void)
   pyramid = nullptr;
   model_points = detected_points = nullptr;
   maximum_number_of_points_to_detect = 500;
+  pattern_is_detected = false;
+  tracking_is_enabled = false;
+  tracking_margin = 0;
+  mapped_data = nullptr;
+  mapped_size = 0;
 
   classifier = new fern_based_point_classifier(0, 0, 0, 0, 0, 0, 0, 0, 0);
   image_generator = new affine_image_generator06();
@@ -46,6 +58,8 @@ planar_pattern_detector::planar_pattern_detector(void)
 
 planar_pattern_detector::~planar_pattern_detector(void)
 {
+  release_mapped_data();
+
   if (model_image) cvReleaseImage(&model_image);
   if (pyramid) delete pyramid;
   if (classifier) delete classifier;
@@ -59,15 +73,68 @@ planar_pattern_detector::~planar_pattern_detector(void)
   if (H_estimator) delete H_estimator;
 }
 
-bool planar_pattern_detector::load(const char * filename)
+// The model image and the classifier of a mapped detector point into the mapped data: they are
+// released before it is unmapped, and the model image is only a header.
+void planar_pattern_detector::release_mapped_data(void)
+{
+  if (mapped_data == nullptr) return;
+
+  if (model_image) cvReleaseImageHeader(&model_image);
+  if (classifier) delete classifier;
+  classifier = nullptr;
+
+  munmap(mapped_data, mapped_size);
+  mapped_data = nullptr;
+  mapped_size = 0;
+}
+
+// Mapped format: the header, then the model points (u, v, scale), the model image (rows of
+// widthStep bytes) and the mapped section of the classifier, each one aligned on
+// fern_based_point_classifier::mapped_alignment bytes.
+struct mapped_detector_header
+{
+  char magic[8];
+  int version;
+  int byte_order; // mapped_detector_byte_order, as written by the machine that saved the file.
+  char image_name[1000];
+  int u_corner[4], v_corner[4];
+  int patch_size, yape_radius, number_of_octaves;
+  float mean_recognition_rate;
+  int scaling_method;
+  float min_theta, max_theta, min_phi, max_phi;
+  float min_lambda1, max_lambda1, min_lambda2, max_lambda2, min_l1_l2, max_l1_l2;
+  int number_of_model_points;
+  int model_image_width, model_image_height, model_image_widthStep;
+  long long model_points_offset, model_image_offset, classifier_offset, classifier_size;
+};
+
+static const char mapped_detector_magic[8] = { 'F', 'E', 'R', 'N', 'D', 'E', 'T', 0 };
+static const int mapped_detector_version = 1;
+static const int mapped_detector_byte_order = 0x01020304;
+
+static long long mapped_aligned(long long size)
+{
+  const long long a = fern_based_point_classifier::mapped_alignment;
+  return (size + a - 1) / a * a;
+}
+
+bool planar_pattern_detector::load(const char * filename, bool inference_only)
 {
   ifstream f(filename, ios::binary);
 
   if (!f.is_open()) return false;
 
+  char magic[sizeof(mapped_detector_magic)];
+  if (f.read(magic, sizeof(magic)) && memcmp(magic, mapped_detector_magic, sizeof(magic)) == 0) {
+    f.close();
+    return load_mapped(filename);
+  }
+  f.clear();
+  f.seekg(0);
+
   log_info << "[planar_pattern_detector::load]" << "Loading detector file " << filename << " ... " << endl;
 
-  bool result = load(f);
+  bool result = load(f, inference_only);
 
   f.close();
 
@@ -76,7 +143,7 @@ bool planar_pattern_detector::load(const char * filename)
   return result;
 }
 
-bool planar_pattern_detector::save(const char * filename)
+bool planar_pattern_detector::save(const char * filename, bool frozen)
 {
   ofstream f(filename, ios::binary);
 
@@ -87,7 +154,7 @@ bool planar_pattern_detector::save(const char * filename)
 
   log_info << "[planar_pattern_detector::save]" << "Saving detector file " << filename << " ... " << endl;
 
-  bool result = save(f);
+  bool result = save(f, frozen);
 
   f.close();
 
@@ -96,7 +163,221 @@ bool planar_pattern_detector::save(const char * filename)
   return result;
 }
 
-bool planar_pattern_detector::load(istream & f)
+bool planar_pattern_detector::save_mapped(const char * filename)
+{
+  ofstream f(filename, ios::binary);
+
+  if (!f.is_open()) {
+    log_error << "[planar_pattern_detector::save_mapped]" << "Error saving file " << filename << "." << endl;
+    return false;
+  }
+
+  log_info << "[planar_pattern_detector::save_mapped]" << "Saving detector file " << filename << " ... " << endl;
+
+  bool result = save_mapped(f);
+
+  f.close();
+
+  return result;
+}
+
+bool planar_pattern_detector::save_mapped(ostream & f)
+{
+  mapped_detector_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, mapped_detector_magic, sizeof(header.magic));
+  header.version = mapped_detector_version;
+  header.byte_order = mapped_detector_byte_order;
+  // The header is zeroed, the name stays terminated:
+  memcpy(header.image_name, image_name, min(strlen(image_name), sizeof(header.image_name) - 1));
+  for(int i = 0; i < 4; i++) {
+    header.u_corner[i] = u_corner[i];
+    header.v_corner[i] = v_corner[i];
+  }
+  header.patch_size = patch_size;
+  header.yape_radius = yape_radius;
+  header.number_of_octaves = number_of_octaves;
+  header.mean_recognition_rate = mean_recognition_rate;
+
+  const affine_transformation_range & range = image_generator->transformation_range;
+  header.scaling_method = range.scaling_method;
+  header.min_theta = range.min_theta;     header.max_theta = range.max_theta;
+  header.min_phi = range.min_phi;         header.max_phi = range.max_phi;
+  header.min_lambda1 = range.min_lambda1; header.max_lambda1 = range.max_lambda1;
+  header.min_lambda2 = range.min_lambda2; header.max_lambda2 = range.max_lambda2;
+  header.min_l1_l2 = range.min_l1_l2;     header.max_l1_l2 = range.max_l1_l2;
+
+  header.number_of_model_points = number_of_model_points;
+  header.model_image_width = model_image->width;
+  header.model_image_height = model_image->height;
+  header.model_image_widthStep = model_image->widthStep;
+
+  const long long model_points_size = 3 * number_of_model_points * sizeof(float);
+  const long long model_image_size = (long long)model_image->widthStep * model_image->height;
+  header.model_points_offset = mapped_aligned(sizeof(header));
+  header.model_image_offset = mapped_aligned(header.model_points_offset + model_points_size);
+  header.classifier_offset = mapped_aligned(header.model_image_offset + model_image_size);
+
+  ostringstream classifier_section;
+  if (!classifier->save_mapped(classifier_section)) return false;
+  const string classifier_data = classifier_section.str();
+  header.classifier_size = classifier_data.size();
+
+  long long position = 0;
+  f.write((char *)&header, sizeof(header));
+  position += sizeof(header);
+
+  for(; position < header.model_points_offset; position++) f.put(0);
+  for(int i = 0; i < number_of_model_points; i++) {
+    float p[3] = { model_points[i].u, model_points[i].v, model_points[i].scale };
+    f.write((char *)p, sizeof(p));
+  }
+  position += model_points_size;
+
+  for(; position < header.model_image_offset; position++) f.put(0);
+  f.write(model_image->imageData, model_image_size);
+  position += model_image_size;
+
+  for(; position < header.classifier_offset; position++) f.put(0);
+  f.write(classifier_data.data(), classifier_data.size());
+
+  return !f.fail();
+}
+
+// The sections must be in the file, in order:
+static bool mapped_sections_are_valid(const mapped_detector_header * header, size_t mapped_size)
+{
+  const long long size = (long long)mapped_size;
+  const long long model_points_size = 3LL * header->number_of_model_points * sizeof(float);
+  const long long model_image_size = (long long)header->model_image_widthStep * header->model_image_height;
+
+  return
+    header->number_of_model_points >= 0 &&
+    header->model_points_offset >= (long long)sizeof(mapped_detector_header) &&
+    header->model_points_offset + model_points_size <= size &&
+    header->model_image_width > 0 && header->model_image_height > 0 &&
+    header->model_image_widthStep >= header->model_image_width &&
+    header->model_image_offset >= header->model_points_offset + model_points_size &&
+    header->model_image_offset + model_image_size <= size &&
+    header->classifier_size >= 0 &&
+    header->classifier_offset >= header->model_image_offset + model_image_size &&
+    header->classifier_offset + header->classifier_size <= size;
+}
+
+bool planar_pattern_detector::load_mapped(const char * filename)
+{
+  release_mapped_data();
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat file_status;
+  if (fstat(fd, &file_status) != 0 || size_t(file_status.st_size) < sizeof(mapped_detector_header)) {
+    close(fd);
+    return false;
+  }
+
+  mapped_size = file_status.st_size;
+  void * data = mmap(nullptr, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    log_error << "[planar_pattern_detector::load_mapped]" << "Can not map " << filename << "." << endl;
+    mapped_size = 0;
+    return false;
+  }
+  mapped_data = (char *)data;
+
+  log_info << "[planar_pattern_detector::load_mapped]" << "Mapping detector file " << filename << " ... " << endl;
+
+  const mapped_detector_header * header = (const mapped_detector_header *)mapped_data;
+  if (memcmp(header->magic, mapped_detector_magic, sizeof(header->magic)) != 0 ||
+      header->version != mapped_detector_version ||
+      header->byte_order != mapped_detector_byte_order ||
+      !mapped_sections_are_valid(header, mapped_size)) {
+    log_error << "[planar_pattern_detector::load_mapped]" << "Wrong version, byte order or size." << endl;
+    // The model image and the classifier are left as they were, they do not belong to the mapping:
+    munmap(mapped_data, mapped_size);
+    mapped_data = nullptr;
+    mapped_size = 0;
+    return false;
+  }
+
+  strncpy(image_name, header->image_name, sizeof(image_name) - 1);
+  image_name[sizeof(image_name) - 1] = 0;
+  for(int i = 0; i < 4; i++) {
+    u_corner[i] = header->u_corner[i];
+    v_corner[i] = header->v_corner[i];
+  }
+  patch_size = header->patch_size;
+  yape_radius = header->yape_radius;
+  number_of_octaves = header->number_of_octaves;
+  mean_recognition_rate = header->mean_recognition_rate;
+
+  affine_transformation_range & range = image_generator->transformation_range;
+  range.scaling_method = header->scaling_method;
+  range.min_theta = header->min_theta;     range.max_theta = header->max_theta;
+  range.min_phi = header->min_phi;         range.max_phi = header->max_phi;
+  range.min_lambda1 = header->min_lambda1; range.max_lambda1 = header->max_lambda1;
+  range.min_lambda2 = header->min_lambda2; range.max_lambda2 = header->max_lambda2;
+  range.min_l1_l2 = header->min_l1_l2;     range.max_l1_l2 = header->max_l1_l2;
+
+  if (pyramid) delete pyramid;
+  pyramid = new fine_gaussian_pyramid(yape_radius, patch_size, number_of_octaves);
+
+  number_of_model_points = header->number_of_model_points;
+  if (model_points) delete [] model_points;
+  model_points = new keypoint[number_of_model_points];
+  const float * p = (const float *)(mapped_data + header->model_points_offset);
+  for(int i = 0; i < number_of_model_points; i++) {
+    model_points[i].u = p[3 * i];
+    model_points[i].v = p[3 * i + 1];
+    model_points[i].scale = p[3 * i + 2];
+    model_points[i].class_index = i;
+  }
+
+  // The model image is not copied: it is only read. A model image loaded from a text file is released:
+  if (model_image) cvReleaseImage(&model_image);
+  model_image = cvCreateImageHeader(cvSize(header->model_image_width, header->model_image_height), IPL_DEPTH_8U, 1);
+  cvSetData(model_image, mapped_data + header->model_image_offset, header->model_image_widthStep);
+
+  if (classifier) delete classifier;
+  classifier = new fern_based_point_classifier((const char *)mapped_data + header->classifier_offset,
+                                               size_t(header->classifier_size));
+
+  if (!classifier->correctly_read) {
+    release_mapped_data();
+    return false;
+  }
+
+  log_verb << "[planar_pattern_detector::load_mapped]"
+           << number_of_model_points << " model points, "
+           << classifier->number_of_classes << " classes." << endl;
+
+  return true;
+}
+
+bool planar_pattern_detector::load(istream & f, bool inference_only)
+{
+  release_mapped_data();
+
+  if (!load_model(f)) return false;
+
+  classifier = new fern_based_point_classifier(f, inference_only);
+
+  return classifier->correctly_read;
+}
+
+bool planar_pattern_detector::save(ostream & f, bool frozen)
+{
+  if (!save_model(f)) return false;
+
+  if (frozen)
+    return classifier->save_frozen(f);
+  else
+    return classifier->save(f);
+}
+
+bool planar_pattern_detector::load_model(istream & f)
 {
   f >> image_name;
 
@@ -132,12 +413,10 @@ bool planar_pattern_detector::load(istream & f)
   image_generator->set_original_image(model_image);
   image_generator->set_mask(u_corner[0], v_corner[0], u_corner[2], v_corner[2]);
 
-  classifier = new fern_based_point_classifier(f);
-
-  return true;
+  return !f.fail();
 }
 
-bool planar_pattern_detector::save(ostream & f)
+bool planar_pattern_detector::save_model(ostream & f)
 {
   f << image_name << endl;
 
@@ -155,9 +434,7 @@ bool planar_pattern_detector::save(ostream & f)
   for(int i = 0; i < number_of_model_points; i++)
     f << model_points[i].u << " " << model_points[i].v << " " << model_points[i].scale << endl;
 
-  classifier->save(f);
-
-  return true;
+  return !f.fail();
 }
 
 //! Set the maximum number of points we want to detect
@@ -166,7 +443,26 @@ void planar_pattern_detector::set_maximum_number_of_points_to_detect(int max)
   maximum_number_of_points_to_detect = max;
 }
 
+void planar_pattern_detector::enable_tracking(int margin)
+{
+  tracking_is_enabled = true;
+  tracking_margin = margin;
+}
+
+void planar_pattern_detector::disable_tracking(void)
+{
+  tracking_is_enabled = false;
+}
+
 bool planar_pattern_detector::detect(const IplImage * input_image)
+{
+  if (tracking_is_enabled && pattern_is_detected)
+    return detect(input_image, &H, tracking_margin);
+
+  return detect(input_image, nullptr, 0);
+}
+
+bool planar_pattern_detector::detect(const IplImage * input_image, const homography06 * prior_H, int margin)
 {
   if (input_image->nChannels != 1 || input_image->depth != IPL_DEPTH_8U) {
     log_error << "[planar_pattern_detector::detect]"
@@ -177,6 +473,29 @@ bool planar_pattern_detector::detect(const IplImage * input_image)
     return false;
   }
 
+  bool use_region = false;
+  if (prior_H) {
+    const float width = float(input_image->width), height = float(input_image->height);
+    float u_min = width, v_min = height, u_max = 0, v_max = 0;
+    for(int i = 0; i < 4; i++) {
+      float u, v;
+      prior_H->transform_point(float(u_corner[i]), float(v_corner[i]), u, v);
+      u_min = min(u_min, u); v_min = min(v_min, v);
+      u_max = max(u_max, u); v_max = max(v_max, v);
+    }
+    const int x_min = int(max(0.F, u_min - margin)), y_min = int(max(0.F, v_min - margin));
+    const int x_max = int(min(width, u_max + margin + 1)), y_max = int(min(height, v_max + margin + 1));
+    if (x_min < x_max && y_min < y_max) {
+      pyramid->set_region(x_min, y_min, x_max, y_max);
+      point_detector->set_region_of_interest(x_min, y_min, x_max, y_max);
+      use_region = true;
+    }
+  }
+  if (!use_region) {
+    pyramid->reset_region();
+    point_detector->reset_region_of_interest();
+  }
+
   pyramid->set_image(input_image);
   detect_points(pyramid);
   return detect(pyramid);
@@ -186,6 +505,11 @@ bool planar_pattern_detector::detect(fine_gaussian_pyramid * pyramid)
 {
   match_points(pyramid);
 
+  return detect_from_matches();
+}
+
+bool planar_pattern_detector::detect_from_matches(void)
+{
   pattern_is_detected = estimate_H();
 
   if (pattern_is_detected) {
@@ -240,11 +564,11 @@ void planar_pattern_detector::match_points(fine_gaussian_pyramid * pyramid)
     model_points[i].class_score = 0;
   }
 
+  classifier->recognize(pyramid, detected_points, number_of_detected_points);
+
   for(int i = 0; i < number_of_detected_points; i++) {
     keypoint * k = detected_points + i;
 
-    classifier->recognize(pyramid, k);
-
     if (k->class_index >= 0) {
       float true_score = exp(k->class_score);
 
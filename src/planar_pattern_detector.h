@@ -45,10 +45,22 @@ class planar_pattern_detector
   planar_pattern_detector(void);
   ~planar_pattern_detector(void);
 
-  bool load(const char * detector_data_filename);
-  bool save(const char * detector_data_filename);
-  bool load(istream & f);
-  bool save(ostream & f);
+  //! inference_only: see fern_based_point_classifier. frozen: save the classifier in the frozen format.
+  bool load(const char * detector_data_filename, bool inference_only = false);
+  bool save(const char * detector_data_filename, bool frozen = false);
+  bool load(istream & f, bool inference_only = false);
+  bool save(ostream & f, bool frozen = false);
+  //! Mapped format: a binary file, mapped in memory by load() (recognized by its magic number).
+  //! Nothing is parsed nor decompressed, the leaves distributions and the model image are used
+  //! in place and shared between the processes that map the same file. A mapped detector can
+  //! detect the pattern, but the image generator is not initialized (no test() nor training).
+  bool save_mapped(const char * detector_data_filename);
+  bool save_mapped(ostream & f);
+  bool load_mapped(const char * detector_data_filename);
+
+  //! Everything but the classifier (see multi_planar_pattern_detector):
+  bool load_model(istream & f);
+  bool save_model(ostream & f);
 
   void save_image_of_model_points(const char * filename, int patch_size);
 
@@ -56,8 +68,19 @@ class planar_pattern_detector
   void set_maximum_number_of_points_to_detect(int max);
 
   bool detect(const IplImage * input_image);
+  //! Detection guided by a prior pose: the pyramid and the keypoints are only computed in the
+  //! bounding box of the pattern corners transformed by prior_H, expanded by margin pixels.
+  //! The whole image is processed if prior_H is null.
+  bool detect(const IplImage * input_image, const homography06 * prior_H, int margin);
   bool detect(fine_gaussian_pyramid * pyramid);
 
+  //! Tracking mode: detect(input_image) uses the pose found in the previous frame as prior, with
+  //! the given margin. After a miss, the next frame is processed entirely.
+  void enable_tracking(int margin = 50);
+  void disable_tracking(void);
+  //! Second half of detect(): estimates H from the matches set by match_points().
+  bool detect_from_matches(void);
+
   keypoint * model_points, * detected_points;
   int number_of_model_points, number_of_detected_points;
   int maximum_number_of_points_to_detect;
@@ -87,6 +110,14 @@ class planar_pattern_detector
   IplImage * model_image;
 
   int patch_size, yape_radius, number_of_octaves;
+
+  //private:
+  bool tracking_is_enabled;
+  int tracking_margin;
+
+  void release_mapped_data(void);
+  char * mapped_data;
+  size_t mapped_size;
 };
 
 #endif
@@ -113,13 +113,13 @@ planar_pattern_detector * planar_pattern_detector_builder::force_build(const cha
   return detector;
 }
 
-planar_pattern_detector * planar_pattern_detector_builder::just_load(const char * given_detector_data_filename)
+planar_pattern_detector * planar_pattern_detector_builder::just_load(const char * given_detector_data_filename, bool inference_only)
 {
   planar_pattern_detector * detector = new planar_pattern_detector();
 
   const char * detector_data_filename = given_detector_data_filename;
 
-  if (detector->load(detector_data_filename)) {
+  if (detector->load(detector_data_filename, inference_only)) {
     log_info << "[planar_pattern_detector_builder::just_load]" << detector_data_filename << " file read." << endl;
     return detector;
   } else {
@@ -128,6 +128,55 @@ planar_pattern_detector * planar_pattern_detector_builder::just_load(const char
   }
 }
 
+multi_planar_pattern_detector * planar_pattern_detector_builder::build_multi_with_cache(const char ** image_names, int number_of_models,
+                                                                                        affine_transformation_range * range,
+                                                                                        int maximum_number_of_points_on_model,
+                                                                                        int number_of_generated_images_to_find_stable_points,
+                                                                                        double minimum_number_of_views_rate,
+                                                                                        int patch_size, int yape_radius, int number_of_octaves,
+                                                                                        int number_of_ferns, int number_of_tests_per_fern,
+                                                                                        int number_of_samples_for_refinement, int number_of_samples_for_test,
+                                                                                        const char * detector_data_filename)
+{
+  multi_planar_pattern_detector * detector = new multi_planar_pattern_detector();
+
+  if (detector->load(detector_data_filename)) {
+    log_info << "[planar_pattern_detector_builder::build_multi_with_cache]" << detector_data_filename << " file read." << endl;
+    for(int i = 0; i < detector->number_of_models(); i++)
+      detector->models[i]->image_generator->set_transformation_range(range);
+    return detector;
+  }
+
+  delete detector;
+
+  log_verb << "[planar_pattern_detector_builder::build_multi_with_cache]"
+           << "Can't find file " << detector_data_filename << "." << endl
+           << "Creating one..." << endl;
+
+  detector = new multi_planar_pattern_detector();
+  for(int i = 0; i < number_of_models; i++) {
+    planar_pattern_detector * model = learn_model(image_names[i],
+                                                  range,
+                                                  maximum_number_of_points_on_model,
+                                                  number_of_generated_images_to_find_stable_points,
+                                                  minimum_number_of_views_rate,
+                                                  patch_size, yape_radius, number_of_octaves);
+
+    if (model == nullptr || !detector->add_model(model)) {
+      if (model) delete model;
+      delete detector;
+      return nullptr;
+    }
+  }
+
+  detector->train(number_of_ferns, number_of_tests_per_fern,
+                  number_of_samples_for_refinement, number_of_samples_for_test);
+
+  detector->save(detector_data_filename);
+
+  return detector;
+}
+
 planar_pattern_detector * planar_pattern_detector_builder::learn(const char * image_name,
                                                                  affine_transformation_range * range,
                                                                  int maximum_number_of_points_on_model,
@@ -138,6 +187,54 @@ planar_pattern_detector * planar_pattern_detector_builder::learn(const char * im
                                                                  int number_of_samples_for_refinement, int number_of_samples_for_test,
                                                                  int roi_up_left_u, int roi_up_left_v,
                                                                  int roi_bottom_right_u, int roi_bottom_right_v)
+{
+  planar_pattern_detector * detector = learn_model(image_name,
+                                                   range,
+                                                   maximum_number_of_points_on_model,
+                                                   number_of_generated_images_to_find_stable_points,
+                                                   minimum_number_of_views_rate,
+                                                   patch_size, yape_radius, number_of_octaves,
+                                                   roi_up_left_u, roi_up_left_v,
+                                                   roi_bottom_right_u, roi_bottom_right_v);
+  if (!detector) return nullptr;
+
+  log_verb << "[planar_pattern_detector_builder::learn]" << "Creating classifier: " << endl;
+
+  detector->classifier = new fern_based_point_classifier(maximum_number_of_points_on_model,
+                                                         number_of_ferns, number_of_tests_per_fern,
+                                                         -patch_size / 2, patch_size / 2, -patch_size / 2, patch_size / 2, 0, 0);
+
+  log_verb << "[planar_pattern_detector_builder::learn]" << "Training: " << endl;
+
+  detector->classifier->reset_leaves_distributions();
+  log_verb << "[planar_pattern_detector_builder::learn]"
+              "   - leaves distributions reset ok. " << flush;
+
+  detector->classifier->train(detector->model_points, detector->number_of_model_points,
+                              number_of_octaves, yape_radius, number_of_samples_for_refinement,
+                              detector->image_generator, 0 /* one thread per core */, (unsigned int)rand());
+  log_verb << "[planar_pattern_detector_builder::learn]"
+           << "   - training... " << number_of_samples_for_refinement << " images generated." << endl;
+
+  detector->classifier->finalize_training();
+  log_verb << "[planar_pattern_detector_builder::learn]"
+              "   - posterior probabilities computed." << endl;
+
+  detector->mean_recognition_rate = detector->classifier->test(detector->model_points, detector->number_of_model_points,
+                                                               number_of_octaves, yape_radius, number_of_samples_for_test,
+                                                               detector->image_generator);
+
+  return detector;
+}
+
+planar_pattern_detector * planar_pattern_detector_builder::learn_model(const char * image_name,
+                                                                       affine_transformation_range * range,
+                                                                       int maximum_number_of_points_on_model,
+                                                                       int number_of_generated_images_to_find_stable_points,
+                                                                       double minimum_number_of_views_rate,
+                                                                       int patch_size, int yape_radius, int number_of_octaves,
+                                                                       int roi_up_left_u, int roi_up_left_v,
+                                                                       int roi_bottom_right_u, int roi_bottom_right_v)
 {
   planar_pattern_detector * detector = new planar_pattern_detector();
 
@@ -146,22 +243,22 @@ planar_pattern_detector * planar_pattern_detector_builder::learn(const char * im
   detector->model_image = mcvLoadImage(image_name, 0);
   if (!detector->model_image) return nullptr;
   if (detector->model_image->nChannels != 1) {
-    log_error << "[planar_pattern_detector_builder::learn]" << "Wrong image format" << endl;
+    log_error << "[planar_pattern_detector_builder::learn_model]" << "Wrong image format" << endl;
     return nullptr;
   }
 
-  log_info << "[planar_pattern_detector_builder::learn]" << "start" << endl;
+  log_info << "[planar_pattern_detector_builder::learn_model]" << "start" << endl;
 
   if (roi_up_left_u == -1) {
     string roi_filename = string(image_name) + ".roi";
     ifstream roif(roi_filename);
     if (roif.good()) {
-      log_verb << "[planar_pattern_detector_builder::learn]" << "Reading ROI from file " << roi_filename << ".\n";
+      log_verb << "[planar_pattern_detector_builder::learn_model]" << "Reading ROI from file " << roi_filename << ".\n";
       for(int i = 0; i < 4; i++)
         roif >> detector->u_corner[i] >> detector->v_corner[i];
       roif.close();
     } else {
-      log_verb << "[planar_pattern_detector_builder::learn]" << "No ROI file found. Taking the whole image as object." << endl;
+      log_verb << "[planar_pattern_detector_builder::learn_model]" << "No ROI file found. Taking the whole image as object." << endl;
 
       detector->u_corner[0] = 0;                                detector->v_corner[0] = 0;
       detector->u_corner[1] = detector->model_image->width - 1; detector->v_corner[1] = 0;
@@ -196,32 +293,6 @@ planar_pattern_detector * planar_pattern_detector_builder::learn(const char * im
   string model_points_filename = string(image_name) + ".model_points.bmp";
   detector->save_image_of_model_points(model_points_filename.c_str(), patch_size);
 
-  log_verb << "[planar_pattern_detector_builder::learn]" << "Creating classifier: " << endl;
-
-  detector->classifier = new fern_based_point_classifier(maximum_number_of_points_on_model,
-                                                         number_of_ferns, number_of_tests_per_fern,
-                                                         -patch_size / 2, patch_size / 2, -patch_size / 2, patch_size / 2, 0, 0);
-
-  log_verb << "[planar_pattern_detector_builder::learn]" << "Training: " << endl;
-
-  detector->classifier->reset_leaves_distributions();
-  log_verb << "[planar_pattern_detector_builder::learn]"
-              "   - leaves distributions reset ok. " << flush;
-
-  detector->classifier->train(detector->model_points, detector->number_of_model_points,
-                              number_of_octaves, yape_radius, number_of_samples_for_refinement,
-                              detector->image_generator);
-  log_verb << "[planar_pattern_detector_builder::learn]"
-           << "   - training... " << number_of_samples_for_refinement << " images generated." << endl;
-
-  detector->classifier->finalize_training();
-  log_verb << "[planar_pattern_detector_builder::learn]"
-              "   - posterior probabilities computed." << endl;
-
-  detector->mean_recognition_rate = detector->classifier->test(detector->model_points, detector->number_of_model_points,
-                                                               number_of_octaves, yape_radius, number_of_samples_for_test,
-                                                               detector->image_generator);
-
   return detector;
 }
 
@@ -27,6 +27,7 @@
 using namespace std;
 
 #include "planar_pattern_detector.h"
+#include "multi_planar_pattern_detector.h"
 #include "affine_transformation_range.h"
 
 class planar_pattern_detector_builder
@@ -59,7 +60,20 @@ class planar_pattern_detector_builder
     int roi_up_left_u = -1, int roi_up_left_v = -1,
     int roi_bottom_right_u = -1, int roi_bottom_right_v = -1);
 
-  static planar_pattern_detector * just_load(const char * given_detector_data_filename);
+  static planar_pattern_detector * just_load(const char * given_detector_data_filename, bool inference_only = false);
+
+  //! Several models sharing one classifier; the models are built with the same parameters,
+  //! the ROIs are read from the .roi files.
+  static multi_planar_pattern_detector * build_multi_with_cache(
+    const char ** image_names, int number_of_models,
+    affine_transformation_range * range,
+    int maximum_number_of_points_on_model,
+    int number_of_generated_images_to_find_stable_points,
+    double minimum_number_of_views_rate,
+    int patch_size, int yape_radius, int number_of_octaves,
+    int number_of_ferns, int number_of_tests_per_fern,
+    int number_of_samples_for_refinement, int number_of_samples_for_test,
+    const char * detector_data_filename);
 
   //private:
   static planar_pattern_detector * learn(const char * image_name,
@@ -73,6 +87,15 @@ class planar_pattern_detector_builder
     int roi_up_left_u = -1, int roi_up_left_v = -1,
     int roi_bottom_right_u = -1, int roi_bottom_right_v = -1);
 
+  //! learn() without the classifier.
+  static planar_pattern_detector * learn_model(const char * image_name,
+    affine_transformation_range * range,
+    int maximum_number_of_points_on_model,
+    int number_of_generated_images_to_find_stable_points,
+    double minimum_number_of_views_rate,
+    int patch_size, int yape_radius, int number_of_octaves,
+    int roi_up_left_u = -1, int roi_up_left_v = -1,
+    int roi_bottom_right_u = -1, int roi_bottom_right_v = -1);
 
   static void detect_most_stable_model_points(planar_pattern_detector * detector,
     int maximum_number_of_points_on_model,
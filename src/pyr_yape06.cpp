@@ -23,12 +23,21 @@
 #include <iostream>
 #include <algorithm>
 #include <cmath>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #include "logger.h"
 #include "mcv.h"
 #include "buffer_management.h"
 #include "pyr_yape06.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#else
+static int omp_get_max_threads(void) { return 1; }
+#endif
+
 using namespace std;
 using namespace plog;
 
@@ -42,9 +51,21 @@ const int pyr_yape06::R = 5, pyr_yape06::Rp = 3; // -> 3890 to 1479
 
 pyr_yape06::pyr_yape06(void)
 {
-  all_keypoints = new keypoint[Maximum_number_of_points];
+  all_keypoints = nullptr;
+  all_keypoints_size = 0;
   laplacian = nullptr;
 
+  select_row_kernels();
+
+  grid_cell_size = 0;
+  maximum_number_of_points_per_cell = 0;
+
+  region_of_interest_is_set = false;
+
+  number_of_threads = 0;
+  contexts = nullptr;
+  number_of_contexts = 0;
+
   //   set_laplacian_threshold(10);
   //   set_min_eigenvalue_threshold(10);
   set_laplacian_threshold(30);
@@ -53,20 +74,382 @@ pyr_yape06::pyr_yape06(void)
 
 pyr_yape06::~pyr_yape06(void)
 {
-  delete [] all_keypoints;
+  if (all_keypoints) delete [] all_keypoints;
   release_managed_image(&laplacian);
+
+  for(int i = 0; i < number_of_contexts; i++)
+    delete contexts[i];
+  if (contexts) delete [] contexts;
+}
+
+pyr_yape06::detection_context::detection_context(void)
+{
+  laplacian_rows = nullptr;
+  row_extrema_x = row_extrema_score = nullptr;
+  row_size = 0;
+
+  keypoints = nullptr;
+  number_of_keypoints = maximum_number_of_keypoints = keypoints_size = 0;
+
+  cell_keypoints = nullptr;
+  cell_sizes = nullptr;
+  number_of_cells = grid_columns = maximum_number_of_points_per_cell = cell_keypoints_size = 0;
+}
+
+pyr_yape06::detection_context::~detection_context()
+{
+  if (laplacian_rows) delete [] laplacian_rows;
+  if (row_extrema_x) delete [] row_extrema_x;
+  if (row_extrema_score) delete [] row_extrema_score;
+  if (keypoints) delete [] keypoints;
+  if (cell_keypoints) delete [] cell_keypoints;
+  if (cell_sizes) delete [] cell_sizes;
+}
+
+void pyr_yape06::detection_context::manage_row_buffers(int width)
+{
+  if (row_size < width) {
+    if (laplacian_rows) delete [] laplacian_rows;
+    if (row_extrema_x) delete [] row_extrema_x;
+    if (row_extrema_score) delete [] row_extrema_score;
+    // 3 rows for the ring buffer + 1 null row:
+    laplacian_rows = new short[4 * width];
+    row_extrema_x = new int[width];
+    row_extrema_score = new int[width];
+    row_size = width;
+  }
+  // The laplacian is not computed on the last 2 Dxx - 1 columns:
+  memset(laplacian_rows, 0, 4 * width * sizeof(short));
+}
+
+void pyr_yape06::detection_context::reset(int maximum_number_of_keypoints)
+{
+  if (keypoints_size < maximum_number_of_keypoints) {
+    if (keypoints) delete [] keypoints;
+    keypoints = new keypoint[maximum_number_of_keypoints];
+    keypoints_size = maximum_number_of_keypoints;
+  }
+  this->maximum_number_of_keypoints = maximum_number_of_keypoints;
+  number_of_keypoints = 0;
+}
+
+void pyr_yape06::detection_context::reset_cells(int number_of_cells, int grid_columns, int maximum_number_of_points_per_cell)
+{
+  this->number_of_cells = number_of_cells;
+  this->grid_columns = grid_columns;
+  this->maximum_number_of_points_per_cell = maximum_number_of_points_per_cell;
+
+  if (cell_keypoints_size < number_of_cells * maximum_number_of_points_per_cell) {
+    if (cell_keypoints) delete [] cell_keypoints;
+    if (cell_sizes) delete [] cell_sizes;
+    cell_keypoints = new keypoint[number_of_cells * maximum_number_of_points_per_cell];
+    cell_sizes = new int[number_of_cells];
+    cell_keypoints_size = number_of_cells * maximum_number_of_points_per_cell;
+  }
+  for(int i = 0; i < number_of_cells; i++)
+    cell_sizes[i] = 0;
+}
+
+void pyr_yape06::set_grid_selection(int cell_size, int maximum_number_of_points_per_cell)
+{
+  if (cell_size <= 0 || maximum_number_of_points_per_cell <= 0) {
+    grid_cell_size = 0;
+    return;
+  }
+
+  grid_cell_size = cell_size;
+  this->maximum_number_of_points_per_cell = maximum_number_of_points_per_cell;
+}
+
+void pyr_yape06::set_region_of_interest(int x_min, int y_min, int x_max, int y_max)
+{
+  region_of_interest_is_set = true;
+  roi_x_min = x_min;
+  roi_y_min = y_min;
+  roi_x_max = x_max;
+  roi_y_max = y_max;
+}
+
+void pyr_yape06::region_at_octave(fine_gaussian_pyramid * pyramid, int octave,
+                                  int & x_first, int & y_first, int & x_last, int & y_last) const
+{
+  IplImage * smoothed_image = pyramid->aztec_pyramid[3 + octave * 4];
+  x_first = y_first = 1;
+  x_last = smoothed_image->width - 1;
+  y_last = smoothed_image->height - 1;
+
+  if (region_of_interest_is_set) {
+    x_first = max(x_first, (roi_x_min + pyramid->border_size) >> octave);
+    y_first = max(y_first, (roi_y_min + pyramid->border_size) >> octave);
+    x_last = min(x_last, ((roi_x_max + pyramid->border_size) >> octave) + 1);
+    y_last = min(y_last, ((roi_y_max + pyramid->border_size) >> octave) + 1);
+  }
+}
+
+// Row kernels.
+// The AVX2 kernels are compiled with the target attribute and only called if the CPU supports AVX2:
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define PYR_YAPE06_RUNTIME_AVX2 1
+#define PYR_YAPE06_AVX2 __attribute__((target("avx2")))
+#endif
+
+static inline int min_eigen_value(const unsigned char * image_ptr, const int tr,
+                                  const int Dxx, const int Dyy, const int Dxy, const int Dyx)
+{
+  const int Ixx = -2 * *image_ptr + *(image_ptr + Dxx) + *(image_ptr - Dxx);
+  const int Iyy = -2 * *image_ptr + *(image_ptr + Dyy) + *(image_ptr - Dyy);
+  const int Ixy = *(image_ptr + Dxy) + *(image_ptr - Dxy) - *(image_ptr + Dyx) - *(image_ptr - Dyx);
+  const int sqrt_delta = int( sqrt(double((Ixx - Iyy) * (Ixx - Iyy) + 4 * Ixy * Ixy) ) );
+
+  return min(abs(tr - sqrt_delta), abs(-(tr + sqrt_delta)));
+}
+
+static inline bool is_local_extremum(const short * above, const short * row, const short * below,
+                                     const int x, const int lap_threshold)
+{
+  return
+    (row[x] < -lap_threshold &&
+     row[x] < row[x - 1]     && row[x] < row[x + 1] &&
+     row[x] < above[x]       && row[x] < below[x] &&
+     row[x] < above[x - 1]   && row[x] < below[x - 1] &&
+     row[x] < above[x + 1]   && row[x] < below[x + 1])
+    ||
+    (row[x] > +lap_threshold &&
+     row[x] > row[x - 1]     && row[x] > row[x + 1] &&
+     row[x] > above[x]       && row[x] > below[x] &&
+     row[x] > above[x - 1]   && row[x] > below[x - 1] &&
+     row[x] > above[x + 1]   && row[x] > below[x + 1]);
+}
+
+// The laplacian is in [-1020, 1020] and is stored on 16 bits:
+static void laplacian_row_scalar(const unsigned char * image_row, short * laplacian_row, int n, int Dxx, int Dyy)
+{
+  for(int i = 0; i < n; i++)
+    laplacian_row[i] = short(-4 * image_row[i] +
+                             image_row[i + Dxx] + image_row[i - Dxx] + image_row[i + Dyy] + image_row[i - Dyy]);
+}
+
+// Scalar from x = first_x:
+static int local_extrema_row_scalar_from(int first_x,
+                                         const short * above, const short * row, const short * below, int w,
+                                         const unsigned char * image_row, const int * D,
+                                         int lap_threshold, int min_ev_threshold, int * xs, int * scores)
+{
+  int n = 0;
+  for(int x = first_x; x < w - 1; x++)
+    if (is_local_extremum(above, row, below, x, lap_threshold)) {
+      const int ev = min_eigen_value(image_row + x, row[x], D[0], D[1], D[2], D[3]);
+      if (ev > min_ev_threshold) {
+        xs[n] = x;
+        scores[n] = ev;
+        n++;
+      }
+    }
+  return n;
+}
+
+static int local_extrema_row_scalar(const short * above, const short * row, const short * below, int w,
+                                    const unsigned char * image_row, const int * D,
+                                    int lap_threshold, int min_ev_threshold, int * xs, int * scores)
+{
+  return local_extrema_row_scalar_from(1, above, row, below, w, image_row, D, lap_threshold, min_ev_threshold, xs, scores);
+}
+
+// The comparisons are done on 16 bits, with a threshold saturated to the short range:
+static inline short saturated_threshold(int lap_threshold)
+{
+  return short(max(-32767, min(32767, lap_threshold)));
+}
+
+#if defined(__SSE2__)
+static void laplacian_row_sse2(const unsigned char * image_row, short * laplacian_row, int n, int Dxx, int Dyy)
+{
+  const __m128i zero = _mm_setzero_si128();
+  int i = 0;
+  for(; i + 8 <= n; i += 8) {
+    const unsigned char * p = image_row + i;
+    __m128i c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)p), zero);
+    __m128i l = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p - Dxx)), zero);
+    __m128i r = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p + Dxx)), zero);
+    __m128i u = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p - Dyy)), zero);
+    __m128i d = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p + Dyy)), zero);
+    __m128i v = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(l, r), _mm_add_epi16(u, d)), _mm_slli_epi16(c, 2));
+    _mm_storeu_si128((__m128i *)(laplacian_row + i), v);
+  }
+  laplacian_row_scalar(image_row + i, laplacian_row + i, n - i, Dxx, Dyy);
+}
+
+// The comparisons are vectorized, the eigen values are computed for the extrema only:
+static int local_extrema_row_sse2(const short * above, const short * row, const short * below, int w,
+                                  const unsigned char * image_row, const int * D,
+                                  int lap_threshold, int min_ev_threshold, int * xs, int * scores)
+{
+  const short T = saturated_threshold(lap_threshold);
+  const __m128i minus_threshold = _mm_set1_epi16(short(-T)), plus_threshold = _mm_set1_epi16(T);
+  const __m128i zero = _mm_setzero_si128();
+  int n = 0, x = 1;
+  for(; x + 8 <= w - 1; x += 8) {
+    const __m128i c = _mm_loadu_si128((const __m128i *)(row + x));
+    __m128i is_min = _mm_cmpgt_epi16(minus_threshold, c), is_max = _mm_cmpgt_epi16(c, plus_threshold);
+    const short * neighbours[8] = { row + x - 1, row + x + 1, above + x, below + x,
+                                    above + x - 1, below + x - 1, above + x + 1, below + x + 1 };
+    for(int k = 0; k < 8; k++) {
+      const __m128i neighbour = _mm_loadu_si128((const __m128i *)neighbours[k]);
+      is_min = _mm_and_si128(is_min, _mm_cmpgt_epi16(neighbour, c));
+      is_max = _mm_and_si128(is_max, _mm_cmpgt_epi16(c, neighbour));
+    }
+    int mask = _mm_movemask_epi8(_mm_packs_epi16(_mm_or_si128(is_min, is_max), zero));
+    while (mask) {
+      const int lane = __builtin_ctz(mask);
+      mask &= mask - 1;
+      const int ev = min_eigen_value(image_row + x + lane, row[x + lane], D[0], D[1], D[2], D[3]);
+      if (ev > min_ev_threshold) {
+        xs[n] = x + lane;
+        scores[n] = ev;
+        n++;
+      }
+    }
+  }
+  return n + local_extrema_row_scalar_from(x, above, row, below, w, image_row, D, lap_threshold, min_ev_threshold,
+                                           xs + n, scores + n);
+}
+#endif
+
+#if PYR_YAPE06_RUNTIME_AVX2
+PYR_YAPE06_AVX2
+static void laplacian_row_avx2(const unsigned char * image_row, short * laplacian_row, int n, int Dxx, int Dyy)
+{
+  int i = 0;
+  for(; i + 16 <= n; i += 16) {
+    const unsigned char * p = image_row + i;
+    __m256i c = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)p));
+    __m256i l = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(p - Dxx)));
+    __m256i r = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(p + Dxx)));
+    __m256i u = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(p - Dyy)));
+    __m256i d = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(p + Dyy)));
+    __m256i v = _mm256_sub_epi16(_mm256_add_epi16(_mm256_add_epi16(l, r), _mm256_add_epi16(u, d)), _mm256_slli_epi16(c, 2));
+    _mm256_storeu_si256((__m256i *)(laplacian_row + i), v);
+  }
+  laplacian_row_scalar(image_row + i, laplacian_row + i, n - i, Dxx, Dyy);
+}
+
+// The eigen values are computed for 8 points as soon as one of them is an extremum. The square
+// root is computed in double precision and truncated, as in min_eigen_value():
+#define PYR_YAPE06_LOAD_8_PIXELS(offset) _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(image_row + x8 + (offset))))
+
+PYR_YAPE06_AVX2
+static int local_extrema_row_avx2(const short * above, const short * row, const short * below, int w,
+                                  const unsigned char * image_row, const int * D,
+                                  int lap_threshold, int min_ev_threshold, int * xs, int * scores)
+{
+  const short T = saturated_threshold(lap_threshold);
+  const __m256i minus_threshold = _mm256_set1_epi16(short(-T)), plus_threshold = _mm256_set1_epi16(T);
+  const __m256i ev_threshold = _mm256_set1_epi32(min_ev_threshold);
+  const int Dxx = D[0], Dyy = D[1], Dxy = D[2], Dyx = D[3];
+  int n = 0, x = 1;
+  for(; x + 16 <= w - 1; x += 16) {
+    const __m256i c = _mm256_loadu_si256((const __m256i *)(row + x));
+    __m256i is_min = _mm256_cmpgt_epi16(minus_threshold, c), is_max = _mm256_cmpgt_epi16(c, plus_threshold);
+    const short * neighbours[8] = { row + x - 1, row + x + 1, above + x, below + x,
+                                    above + x - 1, below + x - 1, above + x + 1, below + x + 1 };
+    for(int k = 0; k < 8; k++) {
+      const __m256i neighbour = _mm256_loadu_si256((const __m256i *)neighbours[k]);
+      is_min = _mm256_and_si256(is_min, _mm256_cmpgt_epi16(neighbour, c));
+      is_max = _mm256_and_si256(is_max, _mm256_cmpgt_epi16(c, neighbour));
+    }
+    const __m256i is_extremum = _mm256_or_si256(is_min, is_max);
+    if (_mm256_testz_si256(is_extremum, is_extremum)) continue;
+
+    for(int half = 0; half < 2; half++) {
+      const int x8 = x + 8 * half;
+      const __m128i is_extremum_8 = half == 0 ? _mm256_castsi256_si128(is_extremum) : _mm256_extracti128_si256(is_extremum, 1);
+      int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cvtepi16_epi32(is_extremum_8)));
+      if (mask == 0) continue;
+
+      const __m256i c8 = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(row + x8)));
+      const __m256i I0 = PYR_YAPE06_LOAD_8_PIXELS(0);
+      const __m256i minus_2_I0 = _mm256_sub_epi32(_mm256_setzero_si256(), _mm256_add_epi32(I0, I0));
+      const __m256i Ixx = _mm256_add_epi32(minus_2_I0, _mm256_add_epi32(PYR_YAPE06_LOAD_8_PIXELS(Dxx), PYR_YAPE06_LOAD_8_PIXELS(-Dxx)));
+      const __m256i Iyy = _mm256_add_epi32(minus_2_I0, _mm256_add_epi32(PYR_YAPE06_LOAD_8_PIXELS(Dyy), PYR_YAPE06_LOAD_8_PIXELS(-Dyy)));
+      const __m256i Ixy = _mm256_sub_epi32(_mm256_add_epi32(PYR_YAPE06_LOAD_8_PIXELS(Dxy), PYR_YAPE06_LOAD_8_PIXELS(-Dxy)),
+                                           _mm256_add_epi32(PYR_YAPE06_LOAD_8_PIXELS(Dyx), PYR_YAPE06_LOAD_8_PIXELS(-Dyx)));
+      const __m256i diff = _mm256_sub_epi32(Ixx, Iyy);
+      const __m256i delta = _mm256_add_epi32(_mm256_mullo_epi32(diff, diff),
+                                             _mm256_slli_epi32(_mm256_mullo_epi32(Ixy, Ixy), 2));
+      const __m128i sqrt_delta_lo = _mm256_cvttpd_epi32(_mm256_sqrt_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(delta))));
+      const __m128i sqrt_delta_hi = _mm256_cvttpd_epi32(_mm256_sqrt_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(delta, 1))));
+      const __m256i sqrt_delta = _mm256_inserti128_si256(_mm256_castsi128_si256(sqrt_delta_lo), sqrt_delta_hi, 1);
+      const __m256i ev = _mm256_min_epi32(_mm256_abs_epi32(_mm256_sub_epi32(c8, sqrt_delta)),
+                                          _mm256_abs_epi32(_mm256_add_epi32(c8, sqrt_delta)));
+      mask &= _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(ev, ev_threshold)));
+
+      int evs[8];
+      _mm256_storeu_si256((__m256i *)evs, ev);
+      while (mask) {
+        const int lane = __builtin_ctz(mask);
+        mask &= mask - 1;
+        xs[n] = x8 + lane;
+        scores[n] = evs[lane];
+        n++;
+      }
+    }
+  }
+  return n + local_extrema_row_scalar_from(x, above, row, below, w, image_row, D, lap_threshold, min_ev_threshold,
+                                           xs + n, scores + n);
+}
+#undef PYR_YAPE06_LOAD_8_PIXELS
+#endif
+
+void pyr_yape06::select_row_kernels(void)
+{
+  kernels.laplacian_row = laplacian_row_scalar;
+  kernels.local_extrema_row = local_extrema_row_scalar;
+#if defined(__SSE2__)
+  kernels.laplacian_row = laplacian_row_sse2;
+  kernels.local_extrema_row = local_extrema_row_sse2;
+#endif
+#if PYR_YAPE06_RUNTIME_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.laplacian_row = laplacian_row_avx2;
+    kernels.local_extrema_row = local_extrema_row_avx2;
+  }
+#endif
 }
 
 
 int pyr_yape06::detect(fine_gaussian_pyramid * pyramid, keypoint * keypoints, int max_number_of_keypoints)
 {
   number_of_points = 0;
-  for(int i = 0; i < pyramid->number_of_octaves; i++) {
-    compute_Ds(pyramid->aztec_pyramid[3 + i * 4]);
-    compute_laplacian(pyramid->aztec_pyramid[3 + i * 4]);
-    add_local_extrema(pyramid, pyramid->aztec_pyramid[3 + i * 4], i);
+  maximum_number_of_kept_points = min(max_number_of_keypoints, Maximum_number_of_points);
+  if (all_keypoints_size < maximum_number_of_kept_points) {
+    if (all_keypoints) delete [] all_keypoints;
+    all_keypoints = new keypoint[maximum_number_of_kept_points];
+    all_keypoints_size = maximum_number_of_kept_points;
   }
 
+  // Tasks: the horizontal bands of octave 0, which is the most expensive, then the other octaves.
+  // Each task has its own context, the keypoints are merged before the selection:
+  const int threads = number_of_threads > 0 ? number_of_threads : omp_get_max_threads();
+  const int minimum_band_height = 32;
+  int x_first, y_first, x_last, y_last;
+  region_at_octave(pyramid, 0, x_first, y_first, x_last, y_last);
+  const int rows = max(0, y_last - y_first);
+  const int number_of_bands = max(1, min(threads, rows / minimum_band_height));
+  const int number_of_tasks = number_of_bands + pyramid->number_of_octaves - 1;
+  manage_contexts(number_of_tasks);
+
+#pragma omp parallel for schedule(dynamic) num_threads(threads)
+  for(int t = 0; t < number_of_tasks; t++) {
+    if (t < number_of_bands)
+      detect_in_rows(contexts[t], pyramid, 0, y_first + rows * t / number_of_bands, y_first + rows * (t + 1) / number_of_bands);
+    else {
+      const int octave = t - number_of_bands + 1;
+      detect_in_rows(contexts[t], pyramid, octave, 1, pyramid->aztec_pyramid[3 + octave * 4]->height - 1);
+    }
+  }
+
+  merge_contexts(number_of_bands, number_of_tasks);
+
   sort_keypoints();
 
   return copy_keypoints(keypoints, max_number_of_keypoints);
@@ -79,71 +462,45 @@ void pyr_yape06::compute_Ds(IplImage * smoothed_image)
   DXY = 1  + 1  * smoothed_image->widthStep, DYX = 1  - 1  * smoothed_image->widthStep;
 }
 
-inline void pyr_yape06::compute_laplacian(IplImage * smoothed_image, IplImage * laplacian,
-                                          const int w, const int h,
-                                          const int Dxx, const int Dyy,
-                                          const int /*Dxy*/, const int /*Dyx*/)
+// The row kernels do not depend on the image size, there is no need for size specializations.
+// Full laplacian image, for debugging only: detect() streams the laplacian rows.
+void pyr_yape06::compute_laplacian(IplImage * smoothed_image)
 {
+  compute_Ds(smoothed_image);
+  manage_image(&laplacian, smoothed_image->width, smoothed_image->height, IPL_DEPTH_32S, 1);
+  cvSetZero(laplacian);
+
+  const int w = smoothed_image->width;
+  const int h = smoothed_image->height;
+  short * row = new short[w];
   for(int y = Dxx; y < h - Dxx; y++) {
-    unsigned char * image_row = mcvRow(smoothed_image, y, unsigned char);
+    kernels.laplacian_row(mcvRow(smoothed_image, y, unsigned char), row, w - 2 * Dxx + 1, Dxx, Dyy);
     int * laplacian_row = mcvRow(laplacian, y, int);
-    for(int x = w - Dxx; x >= Dxx; x--) {
-      *laplacian_row = -4 * *image_row +
-        *(image_row + Dxx) + *(image_row - Dxx) + *(image_row + Dyy) + *(image_row - Dyy);
-
-      laplacian_row++;
-      image_row++;
-    }
+    for(int x = 0; x < w - 2 * Dxx + 1; x++)
+      laplacian_row[x] = row[x];
   }
+  delete [] row;
 }
 
-void pyr_yape06::compute_laplacian(IplImage * smoothed_image)
+// The laplacian of columns [first_column, last_column) of row y, in the ring buffer of the context,
+// or the null row outside [Dxx, h - Dxx):
+inline const short * pyr_yape06::laplacian_row(detection_context * context, IplImage * smoothed_image, const int y,
+                                               const int Dxx, const int Dyy,
+                                               const int first_column, const int last_column) const
 {
-  manage_image(&laplacian, smoothed_image->width, smoothed_image->height, IPL_DEPTH_32S, 1);
-  cvSetZero(laplacian);
-
   const int w = smoothed_image->width;
-  const int h = smoothed_image->height;
-  if (w == 784 && h == 640)
-    compute_laplacian(smoothed_image, laplacian, 784, 640, R, R * 784, Rp + Rp * 784, Rp - Rp * 784);
-  else if (w == 768 && h == 640)
-    compute_laplacian(smoothed_image, laplacian, 768, 640, R, R * 768, Rp + Rp * 768, Rp - Rp * 768);
-  else if (w == 704 && h == 544)
-    compute_laplacian(smoothed_image, laplacian, 704, 544, R, R * 704, Rp + Rp * 704, Rp - Rp * 704);
-  else if (w == 392 && h == 320)
-    compute_laplacian(smoothed_image, laplacian, 392, 320, R, R * 392, Rp + Rp * 392, Rp - Rp * 392);
-  else if (w == 384 && h == 320)
-    compute_laplacian(smoothed_image, laplacian, 384, 320, R, R * 384, Rp + Rp * 384, Rp - Rp * 384);
-  else if (w == 352 && h == 272)
-    compute_laplacian(smoothed_image, laplacian, 352, 272, R, R * 352, Rp + Rp * 352, Rp - Rp * 352);
-  else if (w == 196 && h == 160)
-    compute_laplacian(smoothed_image, laplacian, 196, 160, R, R * 196, Rp + Rp * 196, Rp - Rp * 196);
-  else if (w == 192 && h == 160)
-    compute_laplacian(smoothed_image, laplacian, 192, 160, R, R * 192, Rp + Rp * 192, Rp - Rp * 192);
-  else if (w == 176 && h == 136)
-    compute_laplacian(smoothed_image, laplacian, 176, 136, R, R * 176, Rp + Rp * 176, Rp - Rp * 176);
-  else {
-    static bool warned = false;
-    if (!warned) {
-      log_warn << "[pyr_yape06::compute_laplacian]"
-               << "not optimized for " << w << " x " << h << " images." << endl
-               << "You may want add this size for more efficiency." << endl;
-      warned = true;
-    }
+  if (y < Dxx || y >= smoothed_image->height - Dxx)
+    return context->laplacian_rows + 3 * w;
 
-    compute_laplacian(smoothed_image, laplacian, w, h, Dxx, Dyy, Dxy, Dyx);
-  }
+  short * row = context->laplacian_rows + (y % 3) * w;
+  kernels.laplacian_row(mcvRow(smoothed_image, y, unsigned char) + first_column, row + first_column,
+                        last_column - first_column, Dxx, Dyy);
+  return row;
 }
 
 inline int pyr_yape06::hessian_min_eigen_value(IplImage * smoothed_image, const int tr, const int x, const int y)
 {
-  unsigned char * image_ptr = mcvRow(smoothed_image, y, unsigned char) + x;
-  const int Ixx = -2 * *image_ptr + *(image_ptr + Dxx) + *(image_ptr - Dxx);
-  const int Iyy = -2 * *image_ptr + *(image_ptr + Dyy) + *(image_ptr - Dyy);
-  const int Ixy = *(image_ptr + Dxy) + *(image_ptr - Dxy) - *(image_ptr + Dyx) - *(image_ptr - Dyx);
-  const int sqrt_delta = int( sqrt(double((Ixx - Iyy) * (Ixx - Iyy) + 4 * Ixy * Ixy) ) );
-
-  return min(abs(tr - sqrt_delta), abs(-(tr + sqrt_delta)));
+  return min_eigen_value(mcvRow(smoothed_image, y, unsigned char) + x, tr, Dxx, Dyy, Dxy, Dyx);
 }
 
 inline bool pyr_yape06::laplacian_hessian_criteria(IplImage * laplacian,
@@ -164,57 +521,147 @@ inline bool pyr_yape06::laplacian_hessian_criteria(IplImage * laplacian,
   return float(det) > k * float(trace * trace);
 }
 
-void pyr_yape06::add_local_extrema(fine_gaussian_pyramid * pyramid, IplImage * smoothed_image, int scale)
+// Higher score first. Ties are broken by the detection order (scale, then v, then u), so that
+// the selection does not depend on the order the candidates are found in:
+static bool is_better(const keypoint & k1, const keypoint & k2)
 {
-  const int w = laplacian->width;
-  const int dy = laplacian->widthStep / sizeof(int);
+  if (k1.score != k2.score) return k1.score > k2.score;
+  if (k1.scale != k2.scale) return k1.scale < k2.scale;
+  if (k1.v != k2.v) return k1.v < k2.v;
+  return k1.u < k2.u;
+}
 
-  //   mcvSaveImage("lap.bmp", laplacian);
-  //   save_eigen_value1(smoothed_image, laplacian);
-  //   save_eigen_value2(smoothed_image, laplacian);
-  //   exit(0);
+// Heap of the best capacity keypoints, with the worst one on top:
+static inline void add_to_bounded_heap(keypoint * heap, int & size, const int capacity, const keypoint & k)
+{
+  if (size < capacity) {
+    heap[size++] = k;
+    push_heap(heap, heap + size, is_better);
+  } else if (size > 0 && is_better(k, heap[0])) {
+    pop_heap(heap, heap + size, is_better);
+    heap[size - 1] = k;
+    push_heap(heap, heap + size, is_better);
+  }
+}
 
-  for(int y = 1; y < laplacian->height - 1; y++) {
-    int * lap_row = mcvRow(laplacian, y, int);
-    for(int x = 1; x < w - 1; x++) {
-      if ((lap_row[x] < -lap_threshold &&
-           lap_row[x] < lap_row[x - 1]      && lap_row[x] < lap_row[x + 1] &&
-           lap_row[x] < lap_row[x - dy]     && lap_row[x] < lap_row[x + dy] &&
-           lap_row[x] < lap_row[x - dy - 1] && lap_row[x] < lap_row[x + dy - 1] &&
-           lap_row[x] < lap_row[x - dy + 1] && lap_row[x] < lap_row[x + dy + 1])
-          ||
-          (lap_row[x] > +lap_threshold &&
-           lap_row[x] > lap_row[x - 1]      && lap_row[x] > lap_row[x + 1] &&
-           lap_row[x] > lap_row[x - dy]     && lap_row[x] > lap_row[x + dy] &&
-           lap_row[x] > lap_row[x - dy - 1] && lap_row[x] > lap_row[x + dy - 1] &&
-           lap_row[x] > lap_row[x - dy + 1] && lap_row[x] > lap_row[x + dy + 1])
-          )
-        {
-          const int min_eigen_value = hessian_min_eigen_value(smoothed_image, lap_row[x], x, y);
-          //          log_info << x << "x" << y << " -> " << lap_row[x] << "; " << min_eigen_value << endl;
-          if (min_eigen_value > min_ev_threshold) {
-            //if (laplacian_hessian_criteria(laplacian, x, y)) {
-            all_keypoints[number_of_points].u = float(x - (pyramid->border_size >> scale));
-            all_keypoints[number_of_points].v = float(y - (pyramid->border_size >> scale));
-            all_keypoints[number_of_points].scale = float(scale);
-            all_keypoints[number_of_points].score = float(min_eigen_value);
-
-            number_of_points++;
-            if (number_of_points >= Maximum_number_of_points) return;
-          }
-        }
+// all_keypoints is a heap of the best maximum_number_of_kept_points keypoints:
+inline void pyr_yape06::add_keypoint(const keypoint & k)
+{
+  add_to_bounded_heap(all_keypoints, number_of_points, maximum_number_of_kept_points, k);
+}
+
+inline void pyr_yape06::detection_context::add_keypoint(const keypoint & k)
+{
+  add_to_bounded_heap(keypoints, number_of_keypoints, maximum_number_of_keypoints, k);
+}
+
+inline void pyr_yape06::detection_context::add_keypoint_to_cell(int cell, const keypoint & k)
+{
+  add_to_bounded_heap(cell_keypoints + cell * maximum_number_of_points_per_cell, cell_sizes[cell],
+                      maximum_number_of_points_per_cell, k);
+}
+
+void pyr_yape06::detection_context::add_cells(const detection_context * context)
+{
+  for(int i = 0; i < number_of_cells; i++)
+    for(int j = 0; j < context->cell_sizes[i]; j++)
+      add_keypoint_to_cell(i, context->cell_keypoints[i * maximum_number_of_points_per_cell + j]);
+}
+
+// The laplacian is computed row by row in a ring buffer of 3 rows, and the extrema of row y are
+// detected as soon as row y + 1 is available:
+void pyr_yape06::detect_in_rows(detection_context * context, fine_gaussian_pyramid * pyramid, int octave,
+                                int first_row, int last_row) const
+{
+  IplImage * smoothed_image = pyramid->aztec_pyramid[3 + octave * 4];
+  const int w = smoothed_image->width;
+  const int h = smoothed_image->height;
+  const int Dxx = R, Dyy = R * smoothed_image->widthStep;
+  const int Dxy = Rp + Rp * smoothed_image->widthStep, Dyx = Rp - Rp * smoothed_image->widthStep;
+
+  context->manage_row_buffers(w);
+  context->reset(maximum_number_of_kept_points);
+
+  // The cells are grid_cell_size x grid_cell_size pixels of the level 0 image:
+  if (grid_cell_size > 0) {
+    const int grid_columns = ((w << octave) + grid_cell_size - 1) / grid_cell_size;
+    const int grid_rows = ((h << octave) + grid_cell_size - 1) / grid_cell_size;
+    context->reset_cells(grid_columns * grid_rows, grid_columns, maximum_number_of_points_per_cell);
+  }
+
+  // The laplacian is computed on the tested columns and their neighbours, as far as column w - 2 Dxx:
+  int x_first, y_first, x_last, y_last;
+  region_at_octave(pyramid, octave, x_first, y_first, x_last, y_last);
+  first_row = max(first_row, y_first);
+  last_row = min(last_row, y_last);
+  if (first_row >= last_row || x_first >= x_last) return;
+  const int first_column = x_first - 1;
+  const int last_column = min(x_last + 1, w - 2 * Dxx + 1);
+  if (first_column >= last_column) return;
+
+  const short * rows[3];
+  rows[(first_row - 1) % 3] = laplacian_row(context, smoothed_image, first_row - 1, Dxx, Dyy, first_column, last_column);
+  rows[first_row % 3] = laplacian_row(context, smoothed_image, first_row, Dxx, Dyy, first_column, last_column);
+
+  // The extrema kernel tests columns [1, width - 2] of the rows it is given:
+  const int D[4] = { Dxx, Dyy, Dxy, Dyx };
+  const int tested_width = x_last - x_first + 2;
+  for(int y = first_row; y < last_row; y++) {
+    rows[(y + 1) % 3] = laplacian_row(context, smoothed_image, y + 1, Dxx, Dyy, first_column, last_column);
+    const int n = kernels.local_extrema_row(rows[(y - 1) % 3] + first_column, rows[y % 3] + first_column, rows[(y + 1) % 3] + first_column,
+                                            tested_width, mcvRow(smoothed_image, y, unsigned char) + first_column, D,
+                                            lap_threshold, min_ev_threshold, context->row_extrema_x, context->row_extrema_score);
+    for(int i = 0; i < n; i++) {
+      const int x = first_column + context->row_extrema_x[i];
+      keypoint k;
+      k.u = float(x - (pyramid->border_size >> octave));
+      k.v = float(y - (pyramid->border_size >> octave));
+      k.scale = float(octave);
+      k.score = float(context->row_extrema_score[i]);
+      if (grid_cell_size > 0)
+        context->add_keypoint_to_cell(((y << octave) / grid_cell_size) * context->grid_columns + (x << octave) / grid_cell_size, k);
+      else
+        context->add_keypoint(k);
     }
   }
 }
 
-static bool cmp_keypoints(const keypoint & k1, const keypoint & k2)
+void pyr_yape06::manage_contexts(int number_of_contexts)
 {
-  return k1.score > k2.score;
+  if (this->number_of_contexts >= number_of_contexts) return;
+
+  detection_context ** new_contexts = new detection_context*[number_of_contexts];
+  for(int i = 0; i < number_of_contexts; i++)
+    new_contexts[i] = i < this->number_of_contexts ? contexts[i] : new detection_context();
+  if (contexts) delete [] contexts;
+  contexts = new_contexts;
+  this->number_of_contexts = number_of_contexts;
+}
+
+// Contexts [0, number_of_bands) are the bands of octave 0, the next ones the other octaves.
+// The selection does not depend on the merge order, since is_better() is a total order:
+void pyr_yape06::merge_contexts(int number_of_bands, int number_of_tasks)
+{
+  if (grid_cell_size > 0) {
+    for(int t = 1; t < number_of_bands; t++)
+      contexts[0]->add_cells(contexts[t]);
+
+    for(int t = 0; t < number_of_tasks; t++) {
+      if (t > 0 && t < number_of_bands) continue;
+      const detection_context * context = contexts[t];
+      for(int i = 0; i < context->number_of_cells; i++)
+        for(int j = 0; j < context->cell_sizes[i]; j++)
+          add_keypoint(context->cell_keypoints[i * context->maximum_number_of_points_per_cell + j]);
+    }
+  } else
+    for(int t = 0; t < number_of_tasks; t++)
+      for(int j = 0; j < contexts[t]->number_of_keypoints; j++)
+        add_keypoint(contexts[t]->keypoints[j]);
 }
 
 void pyr_yape06::sort_keypoints(void)
 {
-  sort(all_keypoints, all_keypoints + number_of_points, cmp_keypoints);
+  sort_heap(all_keypoints, all_keypoints + number_of_points, is_better);
 }
 
 int pyr_yape06::copy_keypoints(keypoint * keypoints, int max_number_of_keypoints)
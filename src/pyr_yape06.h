@@ -39,32 +39,111 @@ class pyr_yape06
   void set_laplacian_threshold(int T) { lap_threshold = T; }
   void set_min_eigenvalue_threshold(int T) { min_ev_threshold = T; }
 
+  //! Spatially balanced selection: only the best maximum_number_of_points_per_cell points of each
+  //! cell_size x cell_size cell (in level 0 pixels) of each octave are kept, before the global selection
+  //! of the best points. A null cell_size disables it (default).
+  void set_grid_selection(int cell_size, int maximum_number_of_points_per_cell);
+
+  //! Number of threads used by detect(): the bands of octave 0 and the other octaves are
+  //! detected in parallel. 0 (default) means omp_get_max_threads().
+  void set_number_of_threads(int number_of_threads) { this->number_of_threads = number_of_threads; }
+
+  //! Restricts the detection to the points of [x_min, x_max) x [y_min, y_max), in pixels of the image
+  //! given to the pyramid. The laplacian is only computed there.
+  void set_region_of_interest(int x_min, int y_min, int x_max, int y_max);
+  void reset_region_of_interest(void) { region_of_interest_is_set = false; }
+
   //private:
+  class detection_context;
+
   void compute_Ds(IplImage * smoothed_image);
-  void compute_laplacian(IplImage * smoothed_image, IplImage * laplacian,
-                         const int w, const int h,
-                         const int Dxx, const int Dyy,
-                         const int Dxy, const int Dyx);
   void compute_laplacian(IplImage * smoothed_image);
-  void add_local_extrema(fine_gaussian_pyramid * pyramid, IplImage * smoothed_image, int scale);
+  const short * laplacian_row(detection_context * context, IplImage * smoothed_image, const int y,
+                              const int Dxx, const int Dyy, const int first_column, const int last_column) const;
+  //! The points of an octave where the keypoints are detected: [x_first, x_last) x [y_first, y_last).
+  void region_at_octave(fine_gaussian_pyramid * pyramid, int octave,
+                        int & x_first, int & y_first, int & x_last, int & y_last) const;
+  //! Detects the keypoints of rows [first_row, last_row) of an octave into the context.
+  void detect_in_rows(detection_context * context, fine_gaussian_pyramid * pyramid, int octave,
+                      int first_row, int last_row) const;
+  void manage_contexts(int number_of_contexts);
+  void merge_contexts(int number_of_bands, int number_of_tasks);
   int hessian_min_eigen_value(IplImage * smoothed_image, const int tr, const int x, const int y);
   bool laplacian_hessian_criteria(IplImage * laplacian, const int x, const int y);
+  void add_keypoint(const keypoint & k);
   void sort_keypoints(void);
   int copy_keypoints(keypoint * keypoints, int max_number_of_keypoints);
 
   static const int Maximum_number_of_points;
+  //! The best keypoints found so far, at most maximum_number_of_kept_points of them.
   keypoint * all_keypoints;
+  int all_keypoints_size, maximum_number_of_kept_points;
   int number_of_points;
 
+  int grid_cell_size, maximum_number_of_points_per_cell;
+
+  bool region_of_interest_is_set;
+  int roi_x_min, roi_y_min, roi_x_max, roi_y_max;
+
   int lap_threshold, min_ev_threshold;
 
   IplImage * laplacian;
   static const int R, Rp;
   int Dxx, Dyy, Dxy, Dyx, DXY, DYX;
 
+  //! Row kernels, selected at run time for the CPU (scalar, SSE2 or AVX2), all with the same results.
+  //! laplacian_row: the laplacian of pixels 0 to n - 1 of the row, with the neighbours at +/-Dxx and +/-Dyy.
+  //! local_extrema_row: the columns x in [1, w - 2] where the laplacian of row (between rows above and below)
+  //! is a local extremum above lap_threshold and the min eigen value of the hessian (D = {Dxx, Dyy, Dxy, Dyx})
+  //! is above min_ev_threshold, in increasing x, with their eigen value. Returns their number.
+  //! The laplacian is in [-1020, 1020] and is stored on 16 bits.
+  typedef void (*laplacian_row_kernel)(const unsigned char * image_row, short * laplacian_row, int n, int Dxx, int Dyy);
+  typedef int (*local_extrema_row_kernel)(const short * above, const short * row, const short * below, int w,
+                                          const unsigned char * image_row, const int * D,
+                                          int lap_threshold, int min_ev_threshold, int * xs, int * scores);
+  struct row_kernels { laplacian_row_kernel laplacian_row; local_extrema_row_kernel local_extrema_row; };
+  void select_row_kernels(void);
+  row_kernels kernels;
+
+  int number_of_threads;
+  //! One context per detection task, kept from one frame to the next.
+  detection_context ** contexts;
+  int number_of_contexts;
+
   // For debugging:
   void save_eigen_value1(IplImage * smoothed_image, IplImage * laplacian);
   void save_eigen_value2(IplImage * smoothed_image, IplImage * laplacian);
 };
 
+//! Buffers and keypoints of a detection task (a band of octave 0 or another octave), so that
+//! the tasks can run concurrently.
+class pyr_yape06::detection_context
+{
+ public:
+  detection_context(void);
+  ~detection_context();
+
+  void manage_row_buffers(int width);
+  void reset(int maximum_number_of_keypoints);
+  void reset_cells(int number_of_cells, int grid_columns, int maximum_number_of_points_per_cell);
+  void add_keypoint(const keypoint & k);
+  void add_keypoint_to_cell(int cell, const keypoint & k);
+  //! Merges the cells of another context of the same octave into the cells of this one.
+  void add_cells(const detection_context * context);
+
+  //! Ring buffer of 3 laplacian rows, followed by a null row.
+  short * laplacian_rows;
+  int * row_extrema_x, * row_extrema_score;
+  int row_size;
+
+  //! Heap of the best keypoints found by the task.
+  keypoint * keypoints;
+  int number_of_keypoints, maximum_number_of_keypoints, keypoints_size;
+
+  //! Grid selection: heaps of the best keypoints of each cell of the octave, and their sizes.
+  keypoint * cell_keypoints;
+  int * cell_sizes;
+  int number_of_cells, grid_columns, maximum_number_of_points_per_cell, cell_keypoints_size;
+};
+
 #endif
@@ -0,0 +1,73 @@
+/*
+  Copyright 2007 Computer Vision Lab,
+  Ecole Polytechnique Federale de Lausanne (EPFL), Switzerland.
+  All rights reserved.
+
+  Author: Vincent Lepetit (http://cvlab.epfl.ch/~lepetit)
+
+  This file is part of the ferns_demo software.
+
+  ferns_demo is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 2 of the License, or (at your option) any later
+  version.
+
+  ferns_demo is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+  PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  ferns_demo; if not, write to the Free Software Foundation, Inc., 51 Franklin
+  Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+#ifndef size_specializations_h
+#define size_specializations_h
+
+#include <vector>
+
+using namespace std;
+
+//! Run time lookup of kernels specialized at compile time for an image size.
+//! The generic kernel handles any size, a specialization is added with
+//!   MCV_REGISTER_SIZE_SPECIALIZATION(kernel_type, kernel_template, 640, 480)
+//! where kernel_template<640, 480> has the kernel_type signature, without editing the callers.
+template<typename Kernel>
+class size_specializations
+{
+ public:
+  static bool add(int width, int height, Kernel kernel)
+  {
+    entries().push_back(entry(width, height, kernel));
+    return true;
+  }
+
+  //! The kernel specialized for width x height if any, generic_kernel otherwise.
+  static Kernel find(int width, int height, Kernel generic_kernel)
+  {
+    const vector<entry> & e = entries();
+    for(size_t i = 0; i < e.size(); i++)
+      if (e[i].width == width && e[i].height == height)
+        return e[i].kernel;
+    return generic_kernel;
+  }
+
+  //private:
+  struct entry {
+    entry(int w, int h, Kernel k) : width(w), height(h), kernel(k) {}
+    int width, height;
+    Kernel kernel;
+  };
+
+  // Function static, so the registrations do not depend on the initialization order of the translation units:
+  static vector<entry> & entries(void)
+  {
+    static vector<entry> registered_entries;
+    return registered_entries;
+  }
+};
+
+#define MCV_REGISTER_SIZE_SPECIALIZATION(kernel_type, kernel_template, W, H)                  \
+  static const bool kernel_template##_##W##x##H##_is_registered =                             \
+    size_specializations<kernel_type>::add(W, H, kernel_template<W, H>)
+
+#endif
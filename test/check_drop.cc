@@ -0,0 +1,107 @@
+/*
+  Copyright 2007 Computer Vision Lab,
+  Ecole Polytechnique Federale de Lausanne (EPFL), Switzerland.
+  All rights reserved.
+
+  Author: Vincent Lepetit (http://cvlab.epfl.ch/~lepetit)
+
+  This file is part of the ferns_demo software.
+
+  ferns_demo is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 2 of the License, or (at your option) any later
+  version.
+
+  ferns_demo is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+  PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  ferns_demo; if not, write to the Free Software Foundation, Inc., 51 Franklin
+  Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+// The batched drop (8 points with AVX2, 4 with SSE2) gives the leaves of the one point drop,
+// which uses the scalar kernel.
+
+#include "checks.h"
+#include "ferns.h"
+
+// Number of points whose batched leaves or dropped flag differ from the one point drop:
+static int batched_drop_errors(ferns * F, fine_gaussian_pyramid * pyramid, const int * x, const int * y,
+                               int number_of_points, int level)
+{
+  int * leaves_index = new int[number_of_points * F->number_of_ferns];
+  bool * dropped = new bool[number_of_points];
+  int errors = 0;
+
+  int number_of_dropped_points = F->drop(pyramid, x, y, number_of_points, level, leaves_index, dropped);
+  for(int i = 0; i < number_of_points; i++) {
+    const int * L = F->drop(pyramid, x[i], y[i], level);
+    if ((L != nullptr) != dropped[i]) errors++;
+    else if (L != nullptr)
+      for(int j = 0; j < F->number_of_ferns; j++)
+        if (L[j] != leaves_index[i * F->number_of_ferns + j]) {
+          errors++;
+          break;
+        }
+    if (dropped[i]) number_of_dropped_points--;
+  }
+  if (number_of_dropped_points != 0) errors++;
+
+  delete [] leaves_index;
+  delete [] dropped;
+
+  return errors;
+}
+
+static void check_drop(int width, int height, int number_of_tests_per_fern, unsigned int seed)
+{
+  IplImage * image = make_check_image(width, height, seed);
+  fine_gaussian_pyramid * pyramid = new fine_gaussian_pyramid(7, 32, 3);
+  pyramid->set_image(image);
+
+  srand(seed);
+  ferns * F = new ferns(20, number_of_tests_per_fern, -16, 16, -16, 16);
+
+  // Points on the image and around it, so that some of them are too close to the border:
+  const int number_of_points = 1001;
+  int * x = new int[number_of_points], * y = new int[number_of_points];
+  for(int level = 3; level < 12; level += 4) {
+    const int octave = level / 4;
+    for(int i = 0; i < number_of_points; i++) {
+      x[i] = int(check_random(seed) % ((width >> octave) + 40)) - 20;
+      y[i] = int(check_random(seed) % ((height >> octave) + 40)) - 20;
+    }
+
+    CHECK(batched_drop_errors(F, pyramid, x, y, number_of_points, level) == 0);
+    CHECK(batched_drop_errors(F, pyramid, x, y, 13, level) == 0);
+
+    // Without the 8 points kernel, the points go through the 4 points kernel:
+    ferns::drop_kernel short_drop_8_points = F->short_tests_kernels.drop_8_points;
+    ferns::drop_kernel int_drop_8_points = F->int_tests_kernels.drop_8_points;
+    F->short_tests_kernels.drop_8_points = F->int_tests_kernels.drop_8_points = nullptr;
+    CHECK(batched_drop_errors(F, pyramid, x, y, number_of_points, level) == 0);
+    F->short_tests_kernels.drop_8_points = short_drop_8_points;
+    F->int_tests_kernels.drop_8_points = int_drop_8_points;
+  }
+
+  delete [] x;
+  delete [] y;
+  delete F;
+  delete pyramid;
+  cvReleaseImage(&image);
+}
+
+int main(void)
+{
+  // Specialized kernels, generic kernels (5 and 17 tests per fern):
+  for(int number_of_tests_per_fern = 8; number_of_tests_per_fern <= 14; number_of_tests_per_fern++)
+    check_drop(320, 240, number_of_tests_per_fern, 100 + number_of_tests_per_fern);
+  check_drop(333, 251, 5, 1);
+  check_drop(333, 251, 17, 2);
+
+  // Wide images: the offsets of the packed tests no longer fit in shorts.
+  check_drop(2200, 96, 11, 3);
+
+  return checks_result();
+}
@@ -0,0 +1,123 @@
+/*
+  Copyright 2007 Computer Vision Lab,
+  Ecole Polytechnique Federale de Lausanne (EPFL), Switzerland.
+  All rights reserved.
+
+  Author: Vincent Lepetit (http://cvlab.epfl.ch/~lepetit)
+
+  This file is part of the ferns_demo software.
+
+  ferns_demo is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 2 of the License, or (at your option) any later
+  version.
+
+  ferns_demo is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+  PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  ferns_demo; if not, write to the Free Software Foundation, Inc., 51 Franklin
+  Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+// Early termination: with bounds that never stop the recognition, it is the dense recognition.
+// Calibrated on a set of samples with a loss rate, it loses at most that rate of the samples
+// recognized correctly by the dense recognition, and none with a null loss rate.
+
+#include "checks.h"
+
+int main(void)
+{
+  const int number_of_classes = 40, number_of_ferns = 20, number_of_samples = 3000;
+  fern_based_point_classifier * classifier = make_check_classifier(number_of_classes, number_of_ferns, 8, 20, 5);
+  fern_based_point_classifier::recognition_context * context =
+    new fern_based_point_classifier::recognition_context(classifier);
+
+  // Dense results and partial results after each fern, as test() computes them:
+  unsigned int state = 6;
+  int * leaves_index = new int[number_of_samples * number_of_ferns];
+  keypoint * dense_keypoints = new keypoint[number_of_samples];
+  float * dense_distributions = new float[number_of_samples * number_of_classes];
+  float * partial_best_scores = new float[number_of_samples * number_of_ferns];
+  float * partial_margins = new float[number_of_samples * number_of_ferns];
+  int * partial_classes = new int[number_of_samples * number_of_ferns];
+  int * final_classes = new int[number_of_samples];
+  char * correct = new char[number_of_samples];
+  vector<float> partial(number_of_classes);
+  for(int n = 0; n < number_of_samples; n++) {
+    const int * L = leaves_index + n * number_of_ferns;
+    make_check_sample(classifier->Ferns, n % number_of_classes, state, leaves_index + n * number_of_ferns);
+    classifier->recognize_from_leaves(context, L, dense_keypoints + n, dense_distributions + n * number_of_classes);
+    final_classes[n] = dense_keypoints[n].class_index;
+    correct[n] = (final_classes[n] == n % number_of_classes);
+
+    fill(partial.begin(), partial.end(), 0.f);
+    for(int i = 0; i < number_of_ferns; i++) {
+      const float * ld = classifier->leaves_distributions + i * classifier->step2 + L[i] * classifier->step1;
+      int best_class = 0;
+      for(int c = 0; c < number_of_classes; c++) {
+        partial[c] += ld[c];
+        if (partial[c] > partial[best_class]) best_class = c;
+      }
+      float second = -1e30f;
+      for(int c = 0; c < number_of_classes; c++)
+        if (c != best_class) second = max(second, partial[c]);
+      partial_classes[n * number_of_ferns + i] = best_class;
+      partial_best_scores[n * number_of_ferns + i] = partial[best_class];
+      partial_margins[n * number_of_ferns + i] = partial[best_class] - second;
+    }
+  }
+
+  // Bounds that never stop before the last fern:
+  classifier->calibrate_early_termination(partial_best_scores, partial_margins, partial_classes, final_classes,
+                                          correct, number_of_samples, 0.f);
+  for(int i = 0; i < number_of_ferns; i++) {
+    classifier->early_accept_margins[i] = 1e30f;
+    classifier->early_reject_scores[i] = -1e30f;
+  }
+  classifier->set_early_termination(true);
+  CHECK(classifier->use_early_termination);
+
+  float * distribution = new float[number_of_classes];
+  int errors = 0;
+  for(int n = 0; n < number_of_samples; n++) {
+    keypoint K;
+    classifier->recognize_from_leaves(context, leaves_index + n * number_of_ferns, &K, distribution);
+    if (K.class_index != dense_keypoints[n].class_index || K.class_score != dense_keypoints[n].class_score) errors++;
+    for(int c = 0; c < number_of_classes; c++)
+      if (distribution[c] != dense_distributions[n * number_of_classes + c]) errors++;
+  }
+  CHECK(errors == 0);
+
+  const float loss_rates[] = { 0.f, 0.02f, 0.1f };
+  for(float loss_rate : loss_rates) {
+    classifier->calibrate_early_termination(partial_best_scores, partial_margins, partial_classes, final_classes,
+                                            correct, number_of_samples, loss_rate);
+    int losses = 0, changed_classes = 0, stopped_early = 0;
+    for(int n = 0; n < number_of_samples; n++) {
+      keypoint K;
+      classifier->recognize_from_leaves(context, leaves_index + n * number_of_ferns, &K, distribution);
+      if (correct[n] && K.class_index != final_classes[n]) losses++;
+      // An early accept only returns the final class if the bound allows no loss:
+      if (K.class_index >= 0 && K.class_index != final_classes[n]) changed_classes++;
+      if (K.class_index < 0 || K.class_score != dense_keypoints[n].class_score) stopped_early++;
+    }
+    CHECK(losses <= loss_rate * number_of_samples);
+    if (loss_rate == 0.f) CHECK(changed_classes == 0);
+    CHECK(stopped_early > 0);
+  }
+
+  delete [] distribution;
+  delete [] correct;
+  delete [] final_classes;
+  delete [] partial_classes;
+  delete [] partial_margins;
+  delete [] partial_best_scores;
+  delete [] dense_distributions;
+  delete [] dense_keypoints;
+  delete [] leaves_index;
+  delete context;
+  delete classifier;
+
+  return checks_result();
+}
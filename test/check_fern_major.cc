@@ -0,0 +1,99 @@
+/*
+  Copyright 2007 Computer Vision Lab,
+  Ecole Polytechnique Federale de Lausanne (EPFL), Switzerland.
+  All rights reserved.
+
+  Author: Vincent Lepetit (http://cvlab.epfl.ch/~lepetit)
+
+  This file is part of the ferns_demo software.
+
+  ferns_demo is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 2 of the License, or (at your option) any later
+  version.
+
+  ferns_demo is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+  PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  ferns_demo; if not, write to the Free Software Foundation, Inc., 51 Franklin
+  Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+// The batched recognition of dense classifiers (fern after fern on tiles of keypoints) gives the
+// classes, scores and distributions of the per keypoint recognition.
+
+#include "checks.h"
+#include "pyr_yape06.h"
+
+// Number of keypoints whose batched recognition differs from the per keypoint one:
+static int batched_recognition_errors(fern_based_point_classifier * classifier, fine_gaussian_pyramid * pyramid,
+                                      const vector<keypoint> & keypoints)
+{
+  const int number_of_classes = classifier->number_of_classes, number_of_keypoints = int(keypoints.size());
+  fern_based_point_classifier::recognition_context * context =
+    new fern_based_point_classifier::recognition_context(classifier);
+  vector<keypoint> batched(keypoints), batched_without_distributions(keypoints);
+  vector<float> distributions(number_of_keypoints * number_of_classes), distribution(number_of_classes);
+  int errors = 0;
+
+  classifier->recognize(context, pyramid, &batched[0], number_of_keypoints, &distributions[0]);
+  classifier->recognize(context, pyramid, &batched_without_distributions[0], number_of_keypoints);
+  for(int i = 0; i < number_of_keypoints; i++) {
+    keypoint K = keypoints[i];
+    classifier->recognize(context, pyramid, &K, &distribution[0]);
+    if (batched[i].class_index != K.class_index || batched[i].class_score != K.class_score ||
+        batched_without_distributions[i].class_index != K.class_index ||
+        batched_without_distributions[i].class_score != K.class_score)
+      errors++;
+    else
+      for(int c = 0; c < number_of_classes; c++)
+        if (distributions[i * number_of_classes + c] != distribution[c]) {
+          errors++;
+          break;
+        }
+  }
+
+  delete context;
+
+  return errors;
+}
+
+int main(void)
+{
+  const int width = 320, height = 240;
+  IplImage * image = make_check_image(width, height, 9);
+  fine_gaussian_pyramid * pyramid = new fine_gaussian_pyramid(7, 32, 3);
+  pyramid->set_image(image);
+
+  // Detected keypoints, then keypoints on the image and around it, so that some are not dropped:
+  vector<keypoint> keypoints(1000);
+  pyr_yape06 * detector = new pyr_yape06();
+  keypoints.resize(detector->detect(pyramid, &keypoints[0], int(keypoints.size())));
+  delete detector;
+  unsigned int state = 10;
+  for(int i = 0; i < 1500; i++) {
+    const int octave = int(check_random(state) % 3);
+    keypoints.push_back(keypoint(float(int(check_random(state) % ((width >> octave) + 40)) - 20),
+                                 float(int(check_random(state) % ((height >> octave) + 40)) - 20),
+                                 float(octave)));
+  }
+  CHECK(keypoints.size() > 1500);
+
+  // Several tiles of keypoints (16384 / 30 keypoints per tile), and a single one:
+  fern_based_point_classifier * classifier = make_check_classifier(30, 20, 10, 10, 11);
+  CHECK(batched_recognition_errors(classifier, pyramid, keypoints) == 0);
+  classifier->set_number_of_ferns_to_use(13);
+  CHECK(batched_recognition_errors(classifier, pyramid, keypoints) == 0);
+  delete classifier;
+
+  classifier = make_check_classifier(200, 15, 9, 5, 12);
+  CHECK(batched_recognition_errors(classifier, pyramid, keypoints) == 0);
+  CHECK(batched_recognition_errors(classifier, pyramid, vector<keypoint>(keypoints.begin(), keypoints.begin() + 7)) == 0);
+  delete classifier;
+
+  delete pyramid;
+  cvReleaseImage(&image);
+
+  return checks_result();
+}
@@ -0,0 +1,77 @@
+/*
+  Copyright 2007 Computer Vision Lab,
+  Ecole Polytechnique Federale de Lausanne (EPFL), Switzerland.
+  All rights reserved.
+
+  Author: Vincent Lepetit (http://cvlab.epfl.ch/~lepetit)
+
+  This file is part of the ferns_demo software.
+
+  ferns_demo is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 2 of the License, or (at your option) any later
+  version.
+
+  ferns_demo is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+  PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  ferns_demo; if not, write to the Free Software Foundation, Inc., 51 Franklin
+  Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+// The quantized recognition is the dense recognition up to the rounding of the quantized values:
+// each fern adds at most half a quantization step of error to each class score.
+
+#include "checks.h"
+
+int main(void)
+{
+  const int number_of_classes = 50, number_of_ferns = 20, number_of_samples = 2000;
+  fern_based_point_classifier * classifier = make_check_classifier(number_of_classes, number_of_ferns, 8, 20, 1);
+  fern_based_point_classifier::recognition_context * context =
+    new fern_based_point_classifier::recognition_context(classifier);
+
+  // Dense scores of the samples:
+  unsigned int state = 2;
+  int * leaves_index = new int[number_of_samples * number_of_ferns];
+  float * dense_distributions = new float[number_of_samples * number_of_classes];
+  for(int n = 0; n < number_of_samples; n++) {
+    make_check_sample(classifier->Ferns, n % number_of_classes, state, leaves_index + n * number_of_ferns);
+    keypoint K;
+    classifier->recognize_from_leaves(context, leaves_index + n * number_of_ferns, &K,
+                                      dense_distributions + n * number_of_classes);
+  }
+
+  float * distribution = new float[number_of_classes];
+  for(int number_of_bits = 16; number_of_bits >= 8; number_of_bits -= 8) {
+    classifier->quantize_leaves_distributions(number_of_bits);
+    CHECK(classifier->quantization_bits == number_of_bits);
+    const float tolerance = 1.01f * number_of_ferns * 0.5f / classifier->quantization_scale + 1e-3f;
+
+    int score_errors = 0, class_errors = 0;
+    for(int n = 0; n < number_of_samples; n++) {
+      keypoint K;
+      classifier->recognize_from_leaves(context, leaves_index + n * number_of_ferns, &K, distribution);
+      const float * dense = dense_distributions + n * number_of_classes;
+
+      for(int c = 0; c < number_of_classes; c++)
+        if (fabs(distribution[c] - dense[c]) > tolerance) score_errors++;
+      if (K.class_score != distribution[K.class_index]) score_errors++;
+
+      // The recognized class is the dense best class, unless another class is within the rounding error:
+      const float best = *max_element(dense, dense + number_of_classes);
+      if (dense[K.class_index] < best - 2 * tolerance) class_errors++;
+    }
+    CHECK(score_errors == 0);
+    CHECK(class_errors == 0);
+  }
+
+  delete [] distribution;
+  delete [] dense_distributions;
+  delete [] leaves_index;
+  delete context;
+  delete classifier;
+
+  return checks_result();
+}
@@ -0,0 +1,114 @@
+/*
+  Copyright 2007 Computer Vision Lab,
+  Ecole Polytechnique Federale de Lausanne (EPFL), Switzerland.
+  All rights reserved.
+
+  Author: Vincent Lepetit (http://cvlab.epfl.ch/~lepetit)
+
+  This file is part of the ferns_demo software.
+
+  ferns_demo is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 2 of the License, or (at your option) any later
+  version.
+
+  ferns_demo is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+  PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  ferns_demo; if not, write to the Free Software Foundation, Inc., 51 Franklin
+  Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+// The sparse recognition keeps the top_k classes of each leaf and their default: with all the
+// classes kept it is the dense recognition, otherwise it is the sum of the sparse tables.
+
+#include "checks.h"
+
+int main(void)
+{
+  const int number_of_classes = 50, number_of_ferns = 20, number_of_samples = 2000;
+  fern_based_point_classifier * classifier = make_check_classifier(number_of_classes, number_of_ferns, 8, 20, 3);
+  fern_based_point_classifier::recognition_context * context =
+    new fern_based_point_classifier::recognition_context(classifier);
+  const int number_of_leaves = number_of_ferns * classifier->Ferns->number_of_leaves_per_fern;
+
+  unsigned int state = 4;
+  int * leaves_index = new int[number_of_samples * number_of_ferns];
+  keypoint * dense_keypoints = new keypoint[number_of_samples];
+  float * dense_distributions = new float[number_of_samples * number_of_classes];
+  for(int n = 0; n < number_of_samples; n++) {
+    make_check_sample(classifier->Ferns, n % number_of_classes, state, leaves_index + n * number_of_ferns);
+    classifier->recognize_from_leaves(context, leaves_index + n * number_of_ferns, dense_keypoints + n,
+                                      dense_distributions + n * number_of_classes);
+  }
+
+  // All the classes kept: same sums, in the same order.
+  float * distribution = new float[number_of_classes];
+  classifier->sparsify_leaves_distributions(number_of_classes);
+  int errors = 0;
+  for(int n = 0; n < number_of_samples; n++) {
+    keypoint K;
+    classifier->recognize_from_leaves(context, leaves_index + n * number_of_ferns, &K, distribution);
+    if (K.class_index != dense_keypoints[n].class_index || K.class_score != dense_keypoints[n].class_score) errors++;
+    for(int c = 0; c < number_of_classes; c++)
+      if (distribution[c] != dense_distributions[n * number_of_classes + c]) errors++;
+  }
+  CHECK(errors == 0);
+
+  for(int top_k = 1; top_k <= 8; top_k *= 2) {
+    classifier->sparsify_leaves_distributions(top_k);
+    CHECK(classifier->sparse_top_k == top_k);
+
+    // The kept classes are the best classes of the leaf:
+    int selection_errors = 0;
+    for(int l = 0; l < number_of_leaves; l++) {
+      const float * ld = classifier->leaves_distributions + l * classifier->step1;
+      const int * classes = classifier->sparse_classes + l * top_k;
+      vector<bool> kept(number_of_classes, false);
+      float worst_kept = 1e30f;
+      for(int k = 0; k < top_k; k++) {
+        kept[classes[k]] = true;
+        worst_kept = min(worst_kept, ld[classes[k]]);
+        if (fabs(classifier->sparse_defaults[l] + classifier->sparse_values[l * top_k + k] - ld[classes[k]]) > 1e-4f)
+          selection_errors++;
+      }
+      for(int c = 0; c < number_of_classes; c++)
+        if (!kept[c] && ld[c] > worst_kept) selection_errors++;
+    }
+    CHECK(selection_errors == 0);
+
+    // Scores summed from the sparse tables, class by class:
+    int score_errors = 0, class_errors = 0;
+    vector<float> reference(number_of_classes);
+    for(int n = 0; n < number_of_samples; n++) {
+      for(int c = 0; c < number_of_classes; c++) {
+        reference[c] = 0.f;
+        for(int i = 0; i < number_of_ferns; i++) {
+          const int leaf = i * classifier->Ferns->number_of_leaves_per_fern + leaves_index[n * number_of_ferns + i];
+          reference[c] += classifier->sparse_defaults[leaf];
+          for(int k = 0; k < top_k; k++)
+            if (classifier->sparse_classes[leaf * top_k + k] == c)
+              reference[c] += classifier->sparse_values[leaf * top_k + k];
+        }
+      }
+
+      keypoint K;
+      classifier->recognize_from_leaves(context, leaves_index + n * number_of_ferns, &K, distribution);
+      for(int c = 0; c < number_of_classes; c++)
+        if (fabs(distribution[c] - reference[c]) > 1e-3f) score_errors++;
+      if (reference[K.class_index] < *max_element(reference.begin(), reference.end()) - 2e-3f) class_errors++;
+    }
+    CHECK(score_errors == 0);
+    CHECK(class_errors == 0);
+  }
+
+  delete [] distribution;
+  delete [] dense_distributions;
+  delete [] dense_keypoints;
+  delete [] leaves_index;
+  delete context;
+  delete classifier;
+
+  return checks_result();
+}
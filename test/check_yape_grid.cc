@@ -0,0 +1,74 @@
+/*
+  Copyright 2007 Computer Vision Lab,
+  Ecole Polytechnique Federale de Lausanne (EPFL), Switzerland.
+  All rights reserved.
+
+  Author: Vincent Lepetit (http://cvlab.epfl.ch/~lepetit)
+
+  This file is part of the ferns_demo software.
+
+  ferns_demo is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 2 of the License, or (at your option) any later
+  version.
+
+  ferns_demo is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+  PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  ferns_demo; if not, write to the Free Software Foundation, Inc., 51 Franklin
+  Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+// The grid selection of pyr_yape06 keeps the best keypoints of each cell of each octave in per
+// cell heaps: it gives the best keypoints of the M best ones of each cell.
+
+#include "checks.h"
+
+#include <map>
+#include <utility>
+
+static void check_grid(int width, int height, int number_of_octaves, int cell_size, int maximum_number_of_points_per_cell,
+                       unsigned int seed)
+{
+  IplImage * image = make_check_image(width, height, seed);
+  fine_gaussian_pyramid * pyramid = new fine_gaussian_pyramid(7, 32, number_of_octaves);
+  pyramid->set_image(image);
+
+  // The M best keypoints of each (octave, cell):
+  map<pair<int, int>, vector<keypoint> > cells;
+  for(const keypoint & k : reference_yape_keypoints(pyramid, 30, 25, cell_size))
+    cells[make_pair(int(k.scale), k.class_index)].push_back(k);
+  vector<keypoint> reference;
+  for(auto & cell : cells) {
+    const vector<keypoint> best = best_keypoints(cell.second, maximum_number_of_points_per_cell);
+    reference.insert(reference.end(), best.begin(), best.end());
+  }
+
+  pyr_yape06 * detector = new pyr_yape06();
+  detector->set_grid_selection(cell_size, maximum_number_of_points_per_cell);
+  const int maximum_numbers_of_keypoints[] = { 1, 50, 500, 50000 };
+  for(int maximum_number_of_keypoints : maximum_numbers_of_keypoints) {
+    vector<keypoint> keypoints(maximum_number_of_keypoints);
+    const int n = detector->detect(pyramid, &keypoints[0], maximum_number_of_keypoints);
+    const vector<keypoint> expected = best_keypoints(reference, maximum_number_of_keypoints);
+
+    CHECK(n > 0);
+    CHECK(n == int(expected.size()));
+    CHECK(n != int(expected.size()) || same_keypoints(&keypoints[0], &expected[0], n));
+  }
+
+  delete detector;
+  delete pyramid;
+  cvReleaseImage(&image);
+}
+
+int main(void)
+{
+  check_grid(320, 240, 3, 32, 2, 40);
+  check_grid(320, 240, 3, 64, 10, 41);
+  check_grid(333, 251, 2, 50, 1, 42);
+  check_grid(333, 251, 3, 1000, 5, 43);
+
+  return checks_result();
+}
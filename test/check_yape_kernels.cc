@@ -0,0 +1,151 @@
+/*
+  Copyright 2007 Computer Vision Lab,
+  Ecole Polytechnique Federale de Lausanne (EPFL), Switzerland.
+  All rights reserved.
+
+  Author: Vincent Lepetit (http://cvlab.epfl.ch/~lepetit)
+
+  This file is part of the ferns_demo software.
+
+  ferns_demo is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 2 of the License, or (at your option) any later
+  version.
+
+  ferns_demo is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+  PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  ferns_demo; if not, write to the Free Software Foundation, Inc., 51 Franklin
+  Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+// The row kernels of pyr_yape06 selected for the CPU (SSE2 or AVX2) give the laplacian and the
+// extrema of the plain per pixel computation, on rows whose widths are not multiples of the
+// vector sizes.
+
+#include "checks.h"
+#include "pyr_yape06.h"
+
+// Image of width + 2 R columns and 2 R + 1 rows, with the tested row in the middle:
+struct check_rows
+{
+  check_rows(int width, unsigned int & state) : step(width + 2 * pyr_yape06::R + 16),
+    pixels((2 * pyr_yape06::R + 1) * step)
+  {
+    // Flat areas half of the time, so that neighbours are often equal:
+    const int levels = check_random(state) % 2 ? 256 : 4;
+    for(size_t i = 0; i < pixels.size(); i++)
+      pixels[i] = (unsigned char)(check_random(state) % levels * (255 / (levels - 1)));
+
+    D[0] = pyr_yape06::R;
+    D[1] = pyr_yape06::R * step;
+    D[2] = pyr_yape06::Rp + pyr_yape06::Rp * step;
+    D[3] = pyr_yape06::Rp - pyr_yape06::Rp * step;
+  }
+
+  const unsigned char * row(void) const { return &pixels[pyr_yape06::R * step + pyr_yape06::R]; }
+
+  int step;
+  vector<unsigned char> pixels;
+  int D[4];
+};
+
+static void check_laplacian_row(pyr_yape06 * detector, int n, unsigned int & state)
+{
+  check_rows image(n, state);
+  const unsigned char * I = image.row();
+  const int Dxx = image.D[0], Dyy = image.D[1];
+
+  vector<short> laplacian(n + 1, 12345);
+  detector->kernels.laplacian_row(I, &laplacian[0], n, Dxx, Dyy);
+
+  int errors = 0;
+  for(int i = 0; i < n; i++)
+    if (laplacian[i] != -4 * I[i] + I[i + Dxx] + I[i - Dxx] + I[i + Dyy] + I[i - Dyy]) errors++;
+  if (laplacian[n] != 12345) errors++;
+  CHECK(errors == 0);
+}
+
+static bool check_is_extremum(const short * above, const short * row, const short * below, int x, int lap_threshold)
+{
+  bool is_min = row[x] < -lap_threshold, is_max = row[x] > lap_threshold;
+  for(int dx = -1; dx <= 1; dx++) {
+    const short neighbours[3] = { above[x + dx], row[x + dx], below[x + dx] };
+    for(int k = 0; k < 3; k++) {
+      if (dx == 0 && k == 1) continue;
+      is_min = is_min && row[x] < neighbours[k];
+      is_max = is_max && row[x] > neighbours[k];
+    }
+  }
+  return is_min || is_max;
+}
+
+static int check_min_eigen_value(const unsigned char * I, int tr, const int * D)
+{
+  const int Ixx = I[D[0]] + I[-D[0]] - 2 * I[0];
+  const int Iyy = I[D[1]] + I[-D[1]] - 2 * I[0];
+  const int Ixy = I[D[2]] + I[-D[2]] - I[D[3]] - I[-D[3]];
+  const int sqrt_delta = int(sqrt(double((Ixx - Iyy) * (Ixx - Iyy) + 4 * Ixy * Ixy)));
+  return min(abs(tr - sqrt_delta), abs(tr + sqrt_delta));
+}
+
+static void check_local_extrema_row(pyr_yape06 * detector, int w, unsigned int & state)
+{
+  check_rows image(w, state);
+
+  // Laplacian rows in [-1020, 1020], on a few values half of the time:
+  const int levels = check_random(state) % 2 ? 2041 : 5;
+  vector<short> rows(3 * w);
+  for(int i = 0; i < 3 * w; i++)
+    rows[i] = short(int(check_random(state) % levels) * (2040 / (levels - 1)) - 1020);
+  const short * above = &rows[0], * row = &rows[w], * below = &rows[2 * w];
+
+  const int lap_thresholds[] = { -5, 0, 30, 500, 1020, 40000 };
+  vector<int> xs(w), scores(w);
+  for(int lap_threshold : lap_thresholds) {
+    // The eigen value of one of the extrema is also a threshold, the points equal to it are rejected:
+    vector<int> min_ev_thresholds = { -1, 0, 25, 300, 100000 };
+    for(int x = w / 2; x <= w - 2; x++)
+      if (check_is_extremum(above, row, below, x, lap_threshold)) {
+        min_ev_thresholds.push_back(check_min_eigen_value(image.row() + x, row[x], image.D));
+        break;
+      }
+
+    for(int min_ev_threshold : min_ev_thresholds) {
+      vector<int> expected_xs, expected_scores;
+      for(int x = 1; x <= w - 2; x++)
+        if (check_is_extremum(above, row, below, x, lap_threshold)) {
+          const int ev = check_min_eigen_value(image.row() + x, row[x], image.D);
+          if (ev > min_ev_threshold) {
+            expected_xs.push_back(x);
+            expected_scores.push_back(ev);
+          }
+        }
+
+      const int n = detector->kernels.local_extrema_row(above, row, below, w, image.row(), image.D,
+                                                        lap_threshold, min_ev_threshold, &xs[0], &scores[0]);
+      CHECK(n == int(expected_xs.size()));
+      CHECK(n != int(expected_xs.size()) ||
+            (equal(expected_xs.begin(), expected_xs.end(), xs.begin()) &&
+             equal(expected_scores.begin(), expected_scores.end(), scores.begin())));
+    }
+  }
+}
+
+int main(void)
+{
+  pyr_yape06 * detector = new pyr_yape06();
+  unsigned int state = 13;
+
+  const int widths[] = { 1, 3, 7, 8, 9, 15, 16, 17, 18, 19, 31, 33, 34, 100, 333, 640 };
+  for(int width : widths)
+    for(int k = 0; k < 4; k++) {
+      check_laplacian_row(detector, width, state);
+      if (width >= 3) check_local_extrema_row(detector, width, state);
+    }
+
+  delete detector;
+
+  return checks_result();
+}
@@ -0,0 +1,67 @@
+/*
+  Copyright 2007 Computer Vision Lab,
+  Ecole Polytechnique Federale de Lausanne (EPFL), Switzerland.
+  All rights reserved.
+
+  Author: Vincent Lepetit (http://cvlab.epfl.ch/~lepetit)
+
+  This file is part of the ferns_demo software.
+
+  ferns_demo is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 2 of the License, or (at your option) any later
+  version.
+
+  ferns_demo is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+  PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  ferns_demo; if not, write to the Free Software Foundation, Inc., 51 Franklin
+  Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+// pyr_yape06 keeps the best keypoints in a bounded heap instead of sorting all of them: detect()
+// with at most K keypoints returns the K best ones, sorted, which are also the first K ones of a
+// detection with no limit.
+
+#include "checks.h"
+
+static void check_selection(int width, int height, int number_of_octaves, unsigned int seed)
+{
+  IplImage * image = make_check_image(width, height, seed);
+  fine_gaussian_pyramid * pyramid = new fine_gaussian_pyramid(7, 32, number_of_octaves);
+  pyramid->set_image(image);
+
+  pyr_yape06 * detector = new pyr_yape06();
+  vector<keypoint> all_keypoints(50000);
+  const int number_of_keypoints = detector->detect(pyramid, &all_keypoints[0], int(all_keypoints.size()));
+  const vector<keypoint> reference = reference_yape_keypoints(pyramid, 30, 25);
+  CHECK(number_of_keypoints > 100);
+
+  const int maximum_numbers_of_keypoints[] = { 1, 2, 10, 99, 100, number_of_keypoints - 1, number_of_keypoints };
+  for(int maximum_number_of_keypoints : maximum_numbers_of_keypoints) {
+    vector<keypoint> keypoints(maximum_number_of_keypoints + 1);
+    const int n = detector->detect(pyramid, &keypoints[0], maximum_number_of_keypoints);
+    const vector<keypoint> expected = best_keypoints(reference, maximum_number_of_keypoints);
+
+    CHECK(n == int(expected.size()));
+    CHECK(n != int(expected.size()) || same_keypoints(&keypoints[0], &expected[0], n));
+    CHECK(same_keypoints(&keypoints[0], &all_keypoints[0], min(n, number_of_keypoints)));
+    int unsorted = 0;
+    for(int i = 1; i < n; i++)
+      if (!check_is_better(keypoints[i - 1], keypoints[i])) unsorted++;
+    CHECK(unsorted == 0);
+  }
+
+  delete detector;
+  delete pyramid;
+  cvReleaseImage(&image);
+}
+
+int main(void)
+{
+  check_selection(320, 240, 3, 30);
+  check_selection(211, 157, 2, 31);
+
+  return checks_result();
+}
@@ -0,0 +1,61 @@
+/*
+  Copyright 2007 Computer Vision Lab,
+  Ecole Polytechnique Federale de Lausanne (EPFL), Switzerland.
+  All rights reserved.
+
+  Author: Vincent Lepetit (http://cvlab.epfl.ch/~lepetit)
+
+  This file is part of the ferns_demo software.
+
+  ferns_demo is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 2 of the License, or (at your option) any later
+  version.
+
+  ferns_demo is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+  PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  ferns_demo; if not, write to the Free Software Foundation, Inc., 51 Franklin
+  Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+// pyr_yape06 streams the laplacian row by row in a ring buffer: it detects the keypoints of a
+// full laplacian image per octave, with the same scores.
+
+#include "checks.h"
+
+static void check_streaming(int width, int height, int number_of_octaves, int lap_threshold, int min_ev_threshold,
+                            unsigned int seed)
+{
+  IplImage * image = make_check_image(width, height, seed);
+  fine_gaussian_pyramid * pyramid = new fine_gaussian_pyramid(7, 32, number_of_octaves);
+  pyramid->set_image(image);
+
+  pyr_yape06 * detector = new pyr_yape06();
+  detector->set_laplacian_threshold(lap_threshold);
+  detector->set_min_eigenvalue_threshold(min_ev_threshold);
+  vector<keypoint> keypoints(50000);
+  const int number_of_keypoints = detector->detect(pyramid, &keypoints[0], int(keypoints.size()));
+
+  const vector<keypoint> expected = best_keypoints(reference_yape_keypoints(pyramid, lap_threshold, min_ev_threshold),
+                                                   int(keypoints.size()));
+  CHECK(number_of_keypoints > 0);
+  CHECK(number_of_keypoints == int(expected.size()));
+  CHECK(number_of_keypoints != int(expected.size()) || same_keypoints(&keypoints[0], &expected[0], number_of_keypoints));
+
+  delete detector;
+  delete pyramid;
+  cvReleaseImage(&image);
+}
+
+int main(void)
+{
+  check_streaming(320, 240, 3, 30, 25, 20);
+  check_streaming(333, 251, 4, 30, 25, 21);
+  check_streaming(97, 61, 2, 30, 25, 22);
+  check_streaming(320, 240, 3, 10, 10, 23);
+  check_streaming(201, 173, 3, 100, 60, 24);
+
+  return checks_result();
+}
@@ -0,0 +1,91 @@
+/*
+  Copyright 2007 Computer Vision Lab,
+  Ecole Polytechnique Federale de Lausanne (EPFL), Switzerland.
+  All rights reserved.
+
+  Author: Vincent Lepetit (http://cvlab.epfl.ch/~lepetit)
+
+  This file is part of the ferns_demo software.
+
+  ferns_demo is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 2 of the License, or (at your option) any later
+  version.
+
+  ferns_demo is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+  PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  ferns_demo; if not, write to the Free Software Foundation, Inc., 51 Franklin
+  Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+// pyr_yape06 detects the bands of octave 0 and the other octaves in parallel: the keypoints do
+// not depend on the number of threads, with or without the grid selection, and the contexts
+// kept from one detection to the next do not change them.
+
+#include "checks.h"
+
+#include <map>
+#include <utility>
+
+static vector<keypoint> reference_keypoints(fine_gaussian_pyramid * pyramid, int cell_size,
+                                            int maximum_number_of_points_per_cell, int maximum_number_of_keypoints)
+{
+  const vector<keypoint> keypoints = reference_yape_keypoints(pyramid, 30, 25, cell_size);
+  if (cell_size == 0)
+    return best_keypoints(keypoints, maximum_number_of_keypoints);
+
+  map<pair<int, int>, vector<keypoint> > cells;
+  for(const keypoint & k : keypoints)
+    cells[make_pair(int(k.scale), k.class_index)].push_back(k);
+  vector<keypoint> selected;
+  for(auto & cell : cells) {
+    const vector<keypoint> best = best_keypoints(cell.second, maximum_number_of_points_per_cell);
+    selected.insert(selected.end(), best.begin(), best.end());
+  }
+  return best_keypoints(selected, maximum_number_of_keypoints);
+}
+
+static void check_threads(int width, int height, int cell_size, int maximum_number_of_points_per_cell,
+                          int maximum_number_of_keypoints, unsigned int seed)
+{
+  IplImage * image = make_check_image(width, height, seed);
+  fine_gaussian_pyramid * pyramid = new fine_gaussian_pyramid(7, 32, 3);
+  pyramid->set_image(image);
+
+  const vector<keypoint> expected = reference_keypoints(pyramid, cell_size, maximum_number_of_points_per_cell,
+                                                        maximum_number_of_keypoints);
+  CHECK(!expected.empty());
+
+  // The same detector for all the numbers of threads, and a new one for each:
+  pyr_yape06 * detector = new pyr_yape06();
+  const int numbers_of_threads[] = { 1, 2, 3, 5, 8, 2 };
+  vector<keypoint> keypoints(maximum_number_of_keypoints);
+  for(int number_of_threads : numbers_of_threads)
+    for(int new_detector = 0; new_detector < 2; new_detector++) {
+      pyr_yape06 * D = new_detector ? new pyr_yape06() : detector;
+      D->set_grid_selection(cell_size, maximum_number_of_points_per_cell);
+      D->set_number_of_threads(number_of_threads);
+      const int n = D->detect(pyramid, &keypoints[0], maximum_number_of_keypoints);
+
+      CHECK(n == int(expected.size()));
+      CHECK(n != int(expected.size()) || same_keypoints(&keypoints[0], &expected[0], n));
+      if (new_detector) delete D;
+    }
+
+  delete detector;
+  delete pyramid;
+  cvReleaseImage(&image);
+}
+
+int main(void)
+{
+  // 32 rows at least per band of octave 0: up to 17 bands on the padded 320 x 480 image.
+  check_threads(320, 480, 0, 0, 50000, 50);
+  check_threads(320, 480, 0, 0, 100, 51);
+  check_threads(320, 480, 32, 3, 50000, 52);
+  check_threads(257, 411, 40, 1, 200, 53);
+
+  return checks_result();
+}
@@ -0,0 +1,214 @@
+/*
+  Copyright 2007 Computer Vision Lab,
+  Ecole Polytechnique Federale de Lausanne (EPFL), Switzerland.
+  All rights reserved.
+
+  Author: Vincent Lepetit (http://cvlab.epfl.ch/~lepetit)
+
+  This file is part of the ferns_demo software.
+
+  ferns_demo is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 2 of the License, or (at your option) any later
+  version.
+
+  ferns_demo is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+  PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  ferns_demo; if not, write to the Free Software Foundation, Inc., 51 Franklin
+  Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+#ifndef checks_h
+#define checks_h
+
+// Helpers of the check_* programs run by ctest. Each program compares an optimized code path
+// with a plain implementation of the same computation, and returns 1 if a check failed.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+using namespace std;
+
+#include "cv.h"
+
+#include "fern_based_point_classifier.h"
+#include "fine_gaussian_pyramid.h"
+#include "keypoint.h"
+#include "pyr_yape06.h"
+
+static int number_of_failed_checks = 0;
+
+#define CHECK(condition)                                                \
+  do {                                                                  \
+    if (!(condition)) {                                                 \
+      cerr << __FILE__ << ":" << __LINE__ << ": check failed: " << #condition << endl; \
+      number_of_failed_checks++;                                        \
+    }                                                                   \
+  } while(0)
+
+static inline int checks_result(void)
+{
+  if (number_of_failed_checks > 0) {
+    cerr << number_of_failed_checks << " failed checks." << endl;
+    return 1;
+  }
+  return 0;
+}
+
+//! Pseudo random numbers that do not depend on the C library, so that the checks see the same
+//! data on every platform.
+static inline unsigned int check_random(unsigned int & state)
+{
+  state = state * 1103515245u + 12345u;
+  return (state >> 16) & 0x7fff;
+}
+
+//! Textured image: discs of random gray levels on a smooth wave, plus noise.
+static inline IplImage * make_check_image(int width, int height, unsigned int seed)
+{
+  IplImage * image = cvCreateImage(cvSize(width, height), IPL_DEPTH_8U, 1);
+
+  const int number_of_discs = 60;
+  float cx[number_of_discs], cy[number_of_discs], r[number_of_discs], gray[number_of_discs];
+  for(int i = 0; i < number_of_discs; i++) {
+    cx[i] = float(check_random(seed) % width);
+    cy[i] = float(check_random(seed) % height);
+    r[i] = float(4 + check_random(seed) % 30);
+    gray[i] = float(check_random(seed) % 256);
+  }
+
+  for(int y = 0; y < height; y++)
+    for(int x = 0; x < width; x++) {
+      float v = 128.f + 40.f * sinf(x * 0.05f) * cosf(y * 0.07f);
+      for(int i = 0; i < number_of_discs; i++)
+        if ((x - cx[i]) * (x - cx[i]) + (y - cy[i]) * (y - cy[i]) < r[i] * r[i])
+          v = gray[i];
+      v += float(int(check_random(seed) % 9) - 4);
+      ((unsigned char *)(image->imageData + y * image->widthStep))[x] = (unsigned char)(max(0.f, min(255.f, v)));
+    }
+
+  return image;
+}
+
+//! Leaves of a sample of class class_index: in each fern, the leaf preferred by the class half
+//! of the time, a random leaf otherwise.
+static inline void make_check_sample(const ferns * F, int class_index, unsigned int & state, int * leaves_index)
+{
+  for(int i = 0; i < F->number_of_ferns; i++)
+    if (check_random(state) % 2)
+      leaves_index[i] = (class_index * 7919 + i * 104729) % F->number_of_leaves_per_fern;
+    else
+      leaves_index[i] = int(check_random(state) % F->number_of_leaves_per_fern);
+}
+
+//! Classifier trained with number_of_samples_per_class samples of each class from make_check_sample().
+static inline fern_based_point_classifier * make_check_classifier(int number_of_classes, int number_of_ferns,
+                                                                  int number_of_tests_per_fern,
+                                                                  int number_of_samples_per_class, unsigned int seed)
+{
+  srand(seed);
+  fern_based_point_classifier * classifier =
+    new fern_based_point_classifier(number_of_classes, number_of_ferns, number_of_tests_per_fern, -16, 16, -16, 16, 0, 0);
+  classifier->reset_leaves_distributions();
+
+  int * leaves_index = new int[number_of_ferns];
+  for(int n = 0; n < number_of_samples_per_class * number_of_classes; n++) {
+    make_check_sample(classifier->Ferns, n % number_of_classes, seed, leaves_index);
+    classifier->add_sample(leaves_index, n % number_of_classes);
+  }
+  delete [] leaves_index;
+
+  classifier->finalize_training();
+
+  return classifier;
+}
+
+//! Order of the keypoints selected by pyr_yape06: higher score first, then scale, v and u.
+static inline bool check_is_better(const keypoint & k1, const keypoint & k2)
+{
+  if (k1.score != k2.score) return k1.score > k2.score;
+  if (k1.scale != k2.scale) return k1.scale < k2.scale;
+  if (k1.v != k2.v) return k1.v < k2.v;
+  return k1.u < k2.u;
+}
+
+static inline bool same_keypoints(const keypoint * k1, const keypoint * k2, int n)
+{
+  for(int i = 0; i < n; i++)
+    if (k1[i].u != k2[i].u || k1[i].v != k2[i].v || k1[i].scale != k2[i].scale || k1[i].score != k2[i].score)
+      return false;
+  return true;
+}
+
+//! Keypoints of pyr_yape06 computed as before the row kernels: a full int laplacian image per
+//! octave, then the 3x3 extrema above lap_threshold whose hessian min eigen value is above
+//! min_ev_threshold. Each keypoint also gets the cell of the level 0 grid it is in, in class_index,
+//! if cell_size > 0. The keypoints are returned unsorted.
+static inline vector<keypoint> reference_yape_keypoints(fine_gaussian_pyramid * pyramid,
+                                                       int lap_threshold, int min_ev_threshold,
+                                                       int cell_size = 0)
+{
+  const int R = pyr_yape06::R, Rp = pyr_yape06::Rp;
+  vector<keypoint> keypoints;
+
+  for(int octave = 0; octave < pyramid->number_of_octaves; octave++) {
+    IplImage * image = pyramid->aztec_pyramid[3 + octave * 4];
+    const int w = image->width, h = image->height, step = image->widthStep;
+    const int Dxx = R, Dyy = R * step, Dxy = Rp + Rp * step, Dyx = Rp - Rp * step;
+    const int grid_columns = cell_size > 0 ? ((w << octave) + cell_size - 1) / cell_size : 0;
+
+    vector<int> laplacian(w * h, 0);
+    for(int y = Dxx; y < h - Dxx; y++) {
+      const unsigned char * row = (const unsigned char *)image->imageData + y * step;
+      for(int x = 0; x <= w - 2 * Dxx; x++)
+        laplacian[y * w + x] = -4 * row[x] + row[x + Dxx] + row[x - Dxx] + row[x + Dyy] + row[x - Dyy];
+    }
+
+    for(int y = 1; y < h - 1; y++)
+      for(int x = 1; x < w - 1; x++) {
+        const int * L = &laplacian[y * w + x];
+        const int l = *L;
+        bool is_min = l < -lap_threshold, is_max = l > lap_threshold;
+        for(int dy = -1; dy <= 1; dy++)
+          for(int dx = -1; dx <= 1; dx++)
+            if (dx != 0 || dy != 0) {
+              is_min = is_min && l < L[dy * w + dx];
+              is_max = is_max && l > L[dy * w + dx];
+            }
+        if (!is_min && !is_max) continue;
+
+        const unsigned char * p = (const unsigned char *)image->imageData + y * step + x;
+        const int Ixx = -2 * p[0] + p[Dxx] + p[-Dxx];
+        const int Iyy = -2 * p[0] + p[Dyy] + p[-Dyy];
+        const int Ixy = p[Dxy] + p[-Dxy] - p[Dyx] - p[-Dyx];
+        const int sqrt_delta = int(sqrt(double((Ixx - Iyy) * (Ixx - Iyy) + 4 * Ixy * Ixy)));
+        const int ev = min(abs(l - sqrt_delta), abs(l + sqrt_delta));
+        if (ev <= min_ev_threshold) continue;
+
+        keypoint k;
+        k.u = float(x - (pyramid->border_size >> octave));
+        k.v = float(y - (pyramid->border_size >> octave));
+        k.scale = float(octave);
+        k.score = float(ev);
+        k.class_index = cell_size > 0 ? ((y << octave) / cell_size) * grid_columns + (x << octave) / cell_size : 0;
+        keypoints.push_back(k);
+      }
+  }
+
+  return keypoints;
+}
+
+//! The best maximum_number_of_keypoints keypoints, sorted.
+static inline vector<keypoint> best_keypoints(vector<keypoint> keypoints, int maximum_number_of_keypoints)
+{
+  sort(keypoints.begin(), keypoints.end(), check_is_better);
+  if (int(keypoints.size()) > maximum_number_of_keypoints)
+    keypoints.resize(maximum_number_of_keypoints);
+  return keypoints;
+}
+
+#endif